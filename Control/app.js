@@ -1,6 +1,5 @@
 // guideline: pressing any button should always be safe
 
-// realtime preview from OF to iPad
 // shakiness sensor in OF?
 // make nodemon start without password?
 
@@ -7,12 +7,18 @@
 
 #include "ofxOsc.h"
 #include "ofxGui.h"
+#include "ThreadedOscListener.h"
+#include "Seqlock.h"
+#include "Profiler.h"
 
 float defaultLength = 300;
 float minLength = 100, maxLength = 600;
 float maxSpeed = +100;
 string host = "localhost";
 int sendPort = 12001, receivePort = 12000;
+vector<string> cableNames;
+
+const int maxCables = 16;
 
 template <class T>
 void clamp(ofParameter<T>& x) {
@@ -22,30 +28,50 @@ void clamp(ofParameter<T>& x) {
 class SyncPanel {
 public:
     ofxPanel gui;
-    ofParameter<float> nwLength, neLength, seLength, swLength;
-    ofParameter<float> nwSpeed, neSpeed, seSpeed, swSpeed;
+    vector<ofParameter<float> > lengths, speeds;
     void setup(string name) {
         gui.setup(name);
-        gui.add(nwLength.set("NW Length", defaultLength, minLength, maxLength));
-        gui.add(nwSpeed.set("NW Speed", 0, -maxSpeed, maxSpeed));
-        gui.add(neLength.set("NE Length", defaultLength, minLength, maxLength));
-        gui.add(neSpeed.set("NE Speed", 0, -maxSpeed, maxSpeed));
-        gui.add(seLength.set("SE Length", defaultLength, minLength, maxLength));
-        gui.add(seSpeed.set("SE Speed", 0, -maxSpeed, maxSpeed));
-        gui.add(swLength.set("SW Length", defaultLength, minLength, maxLength));
-        gui.add(swSpeed.set("SW Speed", 0, -maxSpeed, maxSpeed));
+        lengths.resize(cableNames.size());
+        speeds.resize(cableNames.size());
+        for(int i = 0; i < cableNames.size(); i++) {
+            string cable = ofToUpper(cableNames[i]);
+            gui.add(lengths[i].set(cable + " Length", defaultLength, minLength, maxLength));
+            gui.add(speeds[i].set(cable + " Speed", 0, -maxSpeed, maxSpeed));
+        }
+    }
+};
+
+// length and speed pairs in the same order as /motors
+struct RemoteState {
+    float values[maxCables * 2];
+    int count;
+};
+
+// keeps only the newest remote state, parsed on the receive thread
+class RemoteReceiver : public ThreadedOscListener {
+public:
+    Seqlock<RemoteState> latest;
+protected:
+    void ProcessMessage(const osc::ReceivedMessage& m, const IpEndpointName& remoteEndpoint) {
+        RemoteState state = latest.load();
+        state.count = 0;
+        for(osc::ReceivedMessageArgumentIterator arg = m.ArgumentsBegin(); arg != m.ArgumentsEnd() && state.count < maxCables * 2; ++arg) {
+            state.values[state.count++] = arg->AsFloat();
+        }
+        latest.store(state);
     }
 };
 
 class ofApp : public ofBaseApp {
 public:
     ofxOscSender oscSend;
-    ofxOscReceiver oscReceive;
+    RemoteReceiver oscReceive;
+    unsigned int remoteSequence = 0;
     ofXml config;
     
     SyncPanel local, remote;
     ofxPanel zeros;
-    ofxButton nwZero, neZero, seZero, swZero;
+    vector<ofParameter<bool> > zeroSpeeds;
     
     void setup() {
         ofBackground(255);
@@ -58,6 +84,13 @@ public:
         host = config.getValue("osc/host");
         sendPort = config.getIntValue("osc/sendPort");
         receivePort = config.getIntValue("osc/receive");
+        for(int i = 0; i < maxCables && config.exists("cables/name[" + ofToString(i) + "]"); i++) {
+            cableNames.push_back(config.getValue("cables/name[" + ofToString(i) + "]"));
+        }
+        if(cableNames.empty()) {
+            // the original four cable rig
+            cableNames = {"nw", "ne", "se", "sw"};
+        }
         
         oscSend.setup(host, sendPort);
         oscReceive.setup(receivePort);
@@ -66,81 +99,77 @@ public:
         remote.setup("Remote");
         
         zeros.setup("Zeros");
-        zeros.add(nwZero.setup("NW Zero"));
-        zeros.add(neZero.setup("NE Zero"));
-        zeros.add(seZero.setup("SE Zero"));
-        zeros.add(swZero.setup("SW Zero"));
-
-        nwZero.addListener(this, &ofApp::zeroNW);
-        neZero.addListener(this, &ofApp::zeroNE);
-        seZero.addListener(this, &ofApp::zeroSE);
-        swZero.addListener(this, &ofApp::zeroSW);
+        zeroSpeeds.resize(cableNames.size());
+        for(int i = 0; i < cableNames.size(); i++) {
+            zeros.add(zeroSpeeds[i].set(ofToUpper(cableNames[i]) + " Zero", false));
+        }
         
         local.gui.loadFromFile("settings.xml");
         
         local.gui.setPosition(10, 10);
-        zeros.setPosition(10, 200);
-        remote.gui.setPosition(10, 310);
-        
+        zeros.setPosition(10, local.gui.getShape().getBottom() + 10);
+        remote.gui.setPosition(10, zeros.getShape().getBottom() + 10);
+        ofSetWindowShape(225, remote.gui.getShape().getBottom() + 10);
     }
     void receiveOsc() {
-        while(oscReceive.hasWaitingMessages()) {
-            ofxOscMessage msg;
-            oscReceive.getNextMessage(&msg);
-            for(int i = 0; i < msg.getNumArgs(); i++) {
-                float x = msg.getArgAsFloat(i);
-                switch(i) {
-                    case 0: remote.nwLength = x; break;
-                    case 1: remote.nwSpeed = x; break;
-                    case 2: remote.neLength = x; break;
-                    case 3: remote.neSpeed = x; break;
-                    case 4: remote.seLength = x; break;
-                    case 5: remote.seSpeed = x; break;
-                    case 6: remote.swLength = x; break;
-                    case 7: remote.swSpeed = x; break;
-                }
+        RemoteState state;
+        if(oscReceive.latest.loadIfNewer(state, remoteSequence)) {
+            int n = MIN(state.count / 2, (int) cableNames.size());
+            for(int i = 0; i < n; i++) {
+                remote.lengths[i] = state.values[2 * i];
+                remote.speeds[i] = state.values[2 * i + 1];
             }
         }
     }
     void sendOsc() {
+        PROFILE_SCOPE("send");
         ofxOscMessage msg;
         msg.setAddress("/motors");
-        msg.addFloatArg(local.nwLength);
-        msg.addFloatArg(local.nwSpeed);
-        msg.addFloatArg(local.neLength);
-        msg.addFloatArg(local.neSpeed);
-        msg.addFloatArg(local.seLength);
-        msg.addFloatArg(local.seSpeed);
-        msg.addFloatArg(local.swLength);
-        msg.addFloatArg(local.swSpeed);
+        for(int i = 0; i < cableNames.size(); i++) {
+            msg.addFloatArg(local.lengths[i]);
+            msg.addFloatArg(local.speeds[i]);
+        }
         oscSend.sendMessage(msg);
     }
     void updateOsc() {
         receiveOsc();
         sendOsc();
     }
-    void zeroNW() { local.nwSpeed = 0; }
-    void zeroNE() { local.neSpeed = 0; }
-    void zeroSE() { local.seSpeed = 0; }
-    void zeroSW() { local.swSpeed = 0; }
+    void exit() {
+        oscReceive.stop();
+    }
     void update() {
-        float cpsToCpf = 1. / 60.;
-        local.nwLength += local.nwSpeed * cpsToCpf;
-        local.neLength += local.neSpeed * cpsToCpf;
-        local.seLength += local.seSpeed * cpsToCpf;
-        local.swLength += local.swSpeed * cpsToCpf;
-        clamp(local.nwLength);
-        clamp(local.neLength);
-        clamp(local.seLength);
-        clamp(local.swLength);
+        Profiler::get().update();
+        updateKinematics();
         updateOsc();
-        ofSetWindowTitle(ofToString(roundf(ofGetFrameRate())));
+        Profiler::Stats frame = Profiler::get().getStats("frame");
+        ofSetWindowTitle(ofToString(roundf(ofGetFrameRate())) + " fps, " + ofToString(frame.p99, 1) + "ms p99");
+    }
+    void updateKinematics() {
+        PROFILE_SCOPE("kinematics");
+        float cpsToCpf = 1. / 60.;
+        for(int i = 0; i < cableNames.size(); i++) {
+            // zero toggles act like buttons
+            if(zeroSpeeds[i]) {
+                local.speeds[i] = 0;
+                zeroSpeeds[i] = false;
+            }
+            local.lengths[i] += local.speeds[i] * cpsToCpf;
+            clamp(local.lengths[i]);
+        }
     }
     void draw() {
+        PROFILE_SCOPE("draw");
         local.gui.draw();
         remote.gui.draw();
         zeros.draw();
     }
+    void keyPressed(int key) {
+        if(key == 'x') {
+            Profiler::get().saveTrace(ofGetTimestampString() + ".trace.json");
+            ofLogNotice() << "\n" << Profiler::get().getSummary();
+        }
+    }
 };
 int main() {
     ofSetupOpenGL(225, 500, OF_WINDOW);
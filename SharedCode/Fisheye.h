@@ -18,21 +18,30 @@ public:
         int k = 0;
         for(int i = 0; i < radiusResolution; i++) {
             for(int j = 0; j < thetaResolution; j++) {
-                float sampleRadius = ofMap(i, 0, radiusResolution - 1, 0, radius);
-                float sampleTheta = ofMap(j, 0, thetaResolution - 1, 0, 360);
-                ofVec2f samplePos(sampleRadius, 0);
-                samplePos.rotate(sampleTheta);
-                ofVec3f vertex(0, 0, 1);
-                vertex.rotate(0, ofMap(i, 0, radiusResolution - 1, 0, fov) / 2., 0);
-                vertex.rotate(0, 0, sampleTheta);
-                sampleMesh.setVertex(k, samplePos);
-                ofVec2f texPos = samplePos + offset;
+                float phi = ofMap(i, 0, radiusResolution - 1, 0, fov) / 2.;
+                float theta = ofMap(j, 0, thetaResolution - 1, 0, 360);
+                ofVec2f texPos = getPosition(phi, theta);
+                sampleMesh.setVertex(k, texPos - offset);
                 mesh.setTexCoord(k, texPos);
-                mesh.setVertex(k, vertex);
+                mesh.setVertex(k, getDirection(phi, theta));
                 k++;
             }
         }
     }
+    // phi is the angle from the optical axis, theta the angle around it, both in degrees
+    ofVec3f getDirection(float phi, float theta) const {
+        float sinPhi = sin(phi * DEG_TO_RAD);
+        return ofVec3f(sinPhi * cos(theta * DEG_TO_RAD), sinPhi * sin(theta * DEG_TO_RAD), cos(phi * DEG_TO_RAD));
+    }
+    // where that direction lands on the equidistant fisheye image, in pixels
+    ofVec2f getPosition(float phi, float theta) const {
+        float sampleRadius = getSampleRadius(phi);
+        return offset + ofVec2f(sampleRadius * cos(theta * DEG_TO_RAD), sampleRadius * sin(theta * DEG_TO_RAD));
+    }
+    // distance from the center of the circle in pixels, equidistant projection
+    float getSampleRadius(float phi) const {
+        return radius * phi / (fov / 2.);
+    }
     void draw() {
         ofPushStyle();
         ofSetColor(ofColor::white);
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Fisheye.h"
+#include "UyvyImage.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// optional stages for the cpu unwrap in FisheyePanorama, applied while each
+// panorama row is written instead of in passes of their own.
+// vignetting: a gain by distance from the circle center, measured from a flat
+// field shot. every panorama row is one distance, so it costs one multiply.
+// denoise: each fresh row is blended into the row already in the panorama,
+// keeping more of the old value where little changed and none where it moved.
+class FisheyeCorrection {
+public:
+    bool vignetting = false;
+    vector<float> gains; // by distance from the circle center in pixels
+    float maxGain = 4;
+
+    bool denoise = false;
+    float denoiseStrength = .75; // how much of the previous frame is kept where nothing moves
+    float motionThreshold = 24; // change in levels that counts as motion
+
+    bool isEnabled() const {
+        return denoise || (vignetting && !gains.empty());
+    }
+    // gains from the mean brightness of each ring, relative to the brightest
+    void calibrate(const Fisheye& fisheye, const ofPixels& flatField) {
+        int channels = flatField.getNumChannels();
+        calibrate(fisheye, flatField.getWidth(), flatField.getHeight(), [&](int x, int y) {
+            const unsigned char* p = flatField.getData() + (y * flatField.getWidth() + x) * channels;
+            int sum = 0;
+            for(int c = 0; c < channels; c++) {
+                sum += p[c];
+            }
+            return (float) sum / channels;
+        });
+    }
+    void calibrate(const Fisheye& fisheye, const UyvyImage& flatField) {
+        calibrate(fisheye, flatField.getWidth(), flatField.getHeight(), [&](int x, int y) {
+            return (float) flatField.getLuma(x, y) - 16;
+        });
+    }
+    float getGain(float radius) const {
+        if(!vignetting || gains.empty()) {
+            return 1;
+        }
+        float i = ofClamp(radius, 0, gains.size() - 1);
+        int i0 = i;
+        int i1 = MIN(i0 + 1, (int) gains.size() - 1);
+        return ofLerp(gains[i0], gains[i1], i - i0);
+    }
+    // blends n bytes of a fresh row into the previous row, in place
+    void filterRow(const unsigned char* fresh, unsigned char* previous, int n) const {
+        // weight of the fresh value out of 128, rising from base to all of it at the threshold
+        int threshold = MAX(1, (int) motionThreshold);
+        int base = ofClamp(128 * (1 - denoiseStrength), 0, 128);
+        int slope = (128 - base) * 16 / threshold;
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i thresholds = _mm_set1_epi16(threshold), bases = _mm_set1_epi16(base);
+        const __m128i slopes = _mm_set1_epi16(slope), full = _mm_set1_epi16(128), half = _mm_set1_epi16(64);
+        for(; i + 16 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (fresh + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (previous + i));
+            __m128i result[2];
+            for(int k = 0; k < 2; k++) {
+                __m128i a16 = k ? _mm_unpackhi_epi8(a, zero) : _mm_unpacklo_epi8(a, zero);
+                __m128i b16 = k ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+                __m128i delta = _mm_sub_epi16(a16, b16);
+                __m128i difference = _mm_max_epi16(delta, _mm_sub_epi16(zero, delta));
+                __m128i weight = _mm_add_epi16(bases, _mm_srli_epi16(_mm_mullo_epi16(_mm_min_epi16(difference, thresholds), slopes), 4));
+                weight = _mm_min_epi16(weight, full);
+                __m128i step = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(delta, weight), half), 7);
+                result[k] = _mm_add_epi16(b16, step);
+            }
+            _mm_storeu_si128((__m128i*) (previous + i), _mm_packus_epi16(result[0], result[1]));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const int16x8_t thresholds = vdupq_n_s16(threshold), bases = vdupq_n_s16(base);
+        const int16x8_t full = vdupq_n_s16(128), half = vdupq_n_s16(64);
+        for(; i + 8 <= n; i += 8) {
+            int16x8_t a16 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(fresh + i)));
+            int16x8_t b16 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(previous + i)));
+            int16x8_t delta = vsubq_s16(a16, b16);
+            int16x8_t difference = vminq_s16(vabsq_s16(delta), thresholds);
+            int16x8_t weight = vaddq_s16(bases, vshrq_n_s16(vmulq_n_s16(difference, slope), 4));
+            weight = vminq_s16(weight, full);
+            int16x8_t step = vshrq_n_s16(vaddq_s16(vmulq_s16(delta, weight), half), 7);
+            vst1_u8(previous + i, vqmovun_s16(vaddq_s16(b16, step)));
+        }
+#endif
+        for(; i < n; i++) {
+            int delta = fresh[i] - previous[i];
+            int weight = MIN(base + ((MIN(abs(delta), threshold) * slope) >> 4), 128);
+            previous[i] += (delta * weight + 64) >> 7;
+        }
+    }
+
+protected:
+    template <class Brightness>
+    void calibrate(const Fisheye& fisheye, int width, int height, Brightness brightness) {
+        int rings = ceil(fisheye.radius) + 1;
+        vector<double> sums(rings, 0);
+        vector<int> counts(rings, 0);
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                int ring = fisheye.offset.distance(ofVec2f(x + .5, y + .5)) + .5;
+                if(ring < rings) {
+                    sums[ring] += brightness(x, y);
+                    counts[ring]++;
+                }
+            }
+        }
+        // the inner rings have few pixels, so average a few rings together
+        int smoothing = 2;
+        vector<float> means(rings, 0);
+        float brightest = 0;
+        for(int i = 0; i < rings; i++) {
+            double sum = 0;
+            int count = 0;
+            for(int j = MAX(0, i - smoothing); j <= MIN(rings - 1, i + smoothing); j++) {
+                sum += sums[j];
+                count += counts[j];
+            }
+            means[i] = count ? sum / count : 0;
+            brightest = MAX(brightest, means[i]);
+        }
+        gains.resize(rings);
+        for(int i = 0; i < rings; i++) {
+            gains[i] = means[i] > 0 ? MIN(brightest / means[i], maxGain) : maxGain;
+        }
+        vignetting = true;
+    }
+};
@@ -0,0 +1,377 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Fisheye.h"
+#include "UyvyImage.h"
+#include "Seqlock.h"
+#include <condition_variable>
+#include <random>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+struct FisheyeCircle {
+    float x = 0, y = 0, radius = 0; // full resolution pixels, like Fisheye::offset
+    int points = 0, inliers = 0;
+    bool found = false;
+};
+
+// finds the lens circle in live frames on a background thread. submit() keeps
+// a half resolution copy of the luma and wakes the thread, which scans every
+// row from both ends for the first pixel brighter than the black around the
+// circle, places the edge to a fraction of a pixel along the gradient, and
+// fits a circle to those points while ignoring the rows where the picture
+// itself is dark at the rim. small changes are smoothed so the unwrap doesn't
+// shimmer, anything past jumpPixels is taken as soon as a second fit agrees.
+class FisheyeDetector : public ofThread {
+protected:
+    // only touched while holding mutex
+    vector<unsigned char> pending;
+    int pendingWidth = 0, pendingHeight = 0;
+    bool hasPending = false;
+    std::condition_variable condition;
+
+    // only touched by the thread
+    vector<unsigned char> luma;
+    int width = 0, height = 0;
+    vector<ofVec2f> edges;
+    std::mt19937 random;
+    FisheyeCircle tracked, jump;
+
+    Seqlock<FisheyeCircle> result;
+    unsigned int lastSequence = 0;
+
+public:
+    float edgeThreshold = 24; // levels above the black outside the circle
+    float inlierPixels = 1.5; // at half resolution
+    float minInlierFraction = .5;
+    float jumpPixels = 3;
+    float smoothing = .1; // how much of each new fit goes into the tracked circle
+    float minChange = .25; // pixels before the fisheye is rebuilt
+    int iterations = 128;
+
+    ~FisheyeDetector() {
+        close();
+    }
+    void setup() {
+        if(!isThreadRunning()) {
+            startThread();
+        }
+    }
+    void close() {
+        if(isThreadRunning()) {
+            {
+                // while the thread can't be between checking and waiting, or it misses the wakeup
+                std::unique_lock<std::mutex> lock(mutex);
+                stopThread();
+                condition.notify_all();
+            }
+            waitForThread(false);
+        }
+    }
+    // skipped if the thread is still busy with the last frame
+    void submit(const ofPixels& pixels) {
+        int channels = pixels.getNumChannels();
+        int w = pixels.getWidth();
+        submit(w, pixels.getHeight(), [&](int y, unsigned char* out, int n) {
+            const unsigned char* p = pixels.getData() + y * w * channels;
+            for(int x = 0; x < n; x++, p += channels * 2) {
+                const unsigned char* q = p + channels;
+                *out++ = channels < 3 ? (p[0] + q[0]) / 2 : (p[0] + 2 * p[1] + p[2] + q[0] + 2 * q[1] + q[2]) / 8;
+            }
+        });
+    }
+    void submit(const UyvyImage& image) {
+        submit(image.width, image.height, [&](int y, unsigned char* out, int n) {
+            // each U Y0 V Y1 pair becomes one pixel, less 16 to be in the same units as rgb
+            const unsigned char* p = image.data + y * image.stride;
+            for(int x = 0; x < n; x++, p += 4) {
+                int luma = (p[1] + p[3]) / 2;
+                *out++ = luma > 16 ? luma - 16 : 0;
+            }
+        });
+    }
+    FisheyeCircle getCircle() const {
+        return result.load();
+    }
+    // writes a new circle into the fisheye and rebuilds it, true if it moved
+    bool update(Fisheye& fisheye) {
+        FisheyeCircle circle;
+        if(!result.loadIfNewer(circle, lastSequence) || !circle.found) {
+            return false;
+        }
+        ofVec2f offset(circle.x, circle.y);
+        if(offset.distance(fisheye.offset) < minChange && fabsf(circle.radius - fisheye.radius) < minChange) {
+            return false;
+        }
+        fisheye.offset = offset;
+        fisheye.radius = circle.radius;
+        fisheye.setup();
+        return true;
+    }
+
+    // fits a circle to one half resolution luma image, no thread needed
+    FisheyeCircle detect(const unsigned char* data, int w, int h) {
+        FisheyeCircle circle;
+        findEdges(data, w, h);
+        circle.points = edges.size();
+        if(edges.size() < 16) {
+            return circle;
+        }
+        // robust: the three point circle most points agree with
+        float best[3] = {0, 0, 0};
+        int bestInliers = 0;
+        std::uniform_int_distribution<int> pick(0, edges.size() - 1);
+        for(int i = 0; i < iterations; i++) {
+            float candidate[3];
+            if(!getCircleThrough(edges[pick(random)], edges[pick(random)], edges[pick(random)], candidate) ||
+               candidate[2] < h / 4. || candidate[2] > w) {
+                continue;
+            }
+            int inliers = countInliers(candidate);
+            if(inliers > bestInliers) {
+                bestInliers = inliers;
+                copy(candidate, candidate + 3, best);
+            }
+        }
+        if(bestInliers < minInlierFraction * edges.size()) {
+            return circle;
+        }
+        // then least squares over just those points, twice so the second pass
+        // picks its inliers with the better circle
+        for(int pass = 0; pass < 2; pass++) {
+            fitInliers(best);
+        }
+        circle.inliers = countInliers(best);
+        // half resolution pixel i is the mean of full resolution pixels 2i and 2i + 1
+        circle.x = best[0] * 2 + 1;
+        circle.y = best[1] * 2 + .5;
+        circle.radius = best[2] * 2;
+        circle.found = true;
+        return circle;
+    }
+
+protected:
+    // convertRow(y, out, n) fills n half resolution pixels from full resolution row y
+    template <class Converter>
+    void submit(int w, int h, Converter convertRow) {
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if(!lock.owns_lock() || hasPending) {
+            return;
+        }
+        pendingWidth = w / 2;
+        pendingHeight = h / 2;
+        pending.resize(pendingWidth * pendingHeight);
+        for(int y = 0; y < pendingHeight; y++) {
+            convertRow(y * 2, pending.data() + y * pendingWidth, pendingWidth);
+        }
+        hasPending = true;
+        lock.unlock();
+        condition.notify_one();
+    }
+    void threadedFunction() {
+        while(isThreadRunning()) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&] {
+                    return hasPending || !isThreadRunning();
+                });
+                if(!hasPending) {
+                    continue;
+                }
+                luma.swap(pending);
+                width = pendingWidth;
+                height = pendingHeight;
+                hasPending = false;
+            }
+            FisheyeCircle circle = detect(luma.data(), width, height);
+            if(!circle.found) {
+                continue;
+            }
+            if(!tracked.found || isJump(circle, tracked)) {
+                // one bad fit shouldn't move the picture
+                bool confirmed = jump.found && !isJump(circle, jump);
+                jump = circle;
+                if(!confirmed) {
+                    continue;
+                }
+                tracked = circle;
+            } else {
+                jump.found = false;
+                tracked.x = ofLerp(tracked.x, circle.x, smoothing);
+                tracked.y = ofLerp(tracked.y, circle.y, smoothing);
+                tracked.radius = ofLerp(tracked.radius, circle.radius, smoothing);
+                tracked.points = circle.points;
+                tracked.inliers = circle.inliers;
+            }
+            result.store(tracked);
+        }
+    }
+    bool isJump(const FisheyeCircle& a, const FisheyeCircle& b) const {
+        return ofVec2f(a.x, a.y).distance(ofVec2f(b.x, b.y)) > jumpPixels || fabsf(a.radius - b.radius) > jumpPixels;
+    }
+    // the black level is the darkest corner, then each row gives its first and
+    // last pixel above it. a point at the image border is the circle being cut
+    // off, or the picture filling the row, so it's left out.
+    void findEdges(const unsigned char* data, int w, int h) {
+        edges.clear();
+        int patch = MIN(16, MIN(w, h) / 4);
+        float black = 255;
+        for(int corner = 0; corner < 4; corner++) {
+            int x0 = corner % 2 ? w - patch : 0, y0 = corner / 2 ? h - patch : 0;
+            int sum = 0;
+            for(int y = y0; y < y0 + patch; y++) {
+                for(int x = x0; x < x0 + patch; x++) {
+                    sum += data[y * w + x];
+                }
+            }
+            black = MIN(black, (float) sum / (patch * patch));
+        }
+        int threshold = MIN(black + edgeThreshold, 254);
+        for(int y = 0; y < h; y++) {
+            const unsigned char* row = data + y * w;
+            int left = findFirstAbove(row, w, threshold);
+            if(left <= 0) {
+                continue;
+            }
+            int right = findLastAbove(row, w, threshold);
+            if(right - left < 2) {
+                continue;
+            }
+            edges.push_back(ofVec2f(getCrossing(row[left - 1], row[left], threshold) + left - 1, y));
+            if(right < w - 1) {
+                edges.push_back(ofVec2f(right + 1 - getCrossing(row[right + 1], row[right], threshold), y));
+            }
+        }
+    }
+    // where the ramp from outside to inside passes the threshold, 0 to 1 from outside
+    static float getCrossing(int outside, int inside, int threshold) {
+        return inside > outside ? ofClamp((threshold - outside) / (float) (inside - outside), 0, 1) : 0;
+    }
+    // 16 pixels per step, -1 if nothing is above
+    static int findFirstAbove(const unsigned char* row, int n, int threshold) {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128i limit = _mm_set1_epi8((char) threshold), zero = _mm_setzero_si128();
+        for(; i + 16 <= n; i += 16) {
+            __m128i above = _mm_subs_epu8(_mm_loadu_si128((const __m128i*) (row + i)), limit);
+            int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(above, zero)) & 0xffff;
+            if(mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint8x16_t limit = vdupq_n_u8(threshold);
+        for(; i + 16 <= n; i += 16) {
+            if(vmaxvq_u8(vcgtq_u8(vld1q_u8(row + i), limit))) {
+                break;
+            }
+        }
+#endif
+        for(; i < n; i++) {
+            if(row[i] > threshold) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    static int findLastAbove(const unsigned char* row, int n, int threshold) {
+        int i = n;
+#if defined(__SSE2__)
+        const __m128i limit = _mm_set1_epi8((char) threshold), zero = _mm_setzero_si128();
+        for(; i - 16 >= 0; i -= 16) {
+            __m128i above = _mm_subs_epu8(_mm_loadu_si128((const __m128i*) (row + i - 16)), limit);
+            int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(above, zero)) & 0xffff;
+            if(mask) {
+                return i - 16 + 31 - __builtin_clz(mask);
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint8x16_t limit = vdupq_n_u8(threshold);
+        for(; i - 16 >= 0; i -= 16) {
+            if(vmaxvq_u8(vcgtq_u8(vld1q_u8(row + i - 16), limit))) {
+                break;
+            }
+        }
+#endif
+        for(i--; i >= 0; i--) {
+            if(row[i] > threshold) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    static bool getCircleThrough(const ofVec2f& a, const ofVec2f& b, const ofVec2f& c, float* circle) {
+        float d = 2 * (a.x * (b.y - c.y) + b.x * (c.y - a.y) + c.x * (a.y - b.y));
+        if(fabsf(d) < 1e-3) {
+            return false;
+        }
+        float a2 = a.x * a.x + a.y * a.y, b2 = b.x * b.x + b.y * b.y, c2 = c.x * c.x + c.y * c.y;
+        circle[0] = (a2 * (b.y - c.y) + b2 * (c.y - a.y) + c2 * (a.y - b.y)) / d;
+        circle[1] = (a2 * (c.x - b.x) + b2 * (a.x - c.x) + c2 * (b.x - a.x)) / d;
+        circle[2] = a.distance(ofVec2f(circle[0], circle[1]));
+        return true;
+    }
+    int countInliers(const float* circle) const {
+        int inliers = 0;
+        for(const ofVec2f& edge : edges) {
+            float dx = edge.x - circle[0], dy = edge.y - circle[1];
+            if(fabsf(sqrtf(dx * dx + dy * dy) - circle[2]) < inlierPixels) {
+                inliers++;
+            }
+        }
+        return inliers;
+    }
+    // x^2 + y^2 + dx + ey + f = 0 by least squares, relative to the current
+    // center to keep the sums well conditioned
+    void fitInliers(float* circle) const {
+        double m[3][4] = {{0}};
+        for(const ofVec2f& edge : edges) {
+            double x = edge.x - circle[0], y = edge.y - circle[1];
+            if(fabs(sqrt(x * x + y * y) - circle[2]) >= inlierPixels) {
+                continue;
+            }
+            double row[4] = {x, y, 1, -(x * x + y * y)};
+            for(int i = 0; i < 3; i++) {
+                for(int j = 0; j < 4; j++) {
+                    m[i][j] += row[i] * row[j];
+                }
+            }
+        }
+        // gaussian elimination with partial pivoting
+        for(int i = 0; i < 3; i++) {
+            int pivot = i;
+            for(int k = i + 1; k < 3; k++) {
+                if(fabs(m[k][i]) > fabs(m[pivot][i])) {
+                    pivot = k;
+                }
+            }
+            if(fabs(m[pivot][i]) < 1e-9) {
+                return;
+            }
+            for(int j = 0; j < 4; j++) {
+                swap(m[i][j], m[pivot][j]);
+            }
+            for(int k = 0; k < 3; k++) {
+                if(k != i) {
+                    double f = m[k][i] / m[i][i];
+                    for(int j = i; j < 4; j++) {
+                        m[k][j] -= f * m[i][j];
+                    }
+                }
+            }
+        }
+        double d = m[0][3] / m[0][0], e = m[1][3] / m[1][1], f = m[2][3] / m[2][2];
+        double cx = -d / 2, cy = -e / 2;
+        double r2 = cx * cx + cy * cy - f;
+        if(r2 <= 0) {
+            return;
+        }
+        circle[0] += cx;
+        circle[1] += cy;
+        circle[2] = sqrt(r2);
+    }
+};
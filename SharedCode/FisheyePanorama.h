@@ -0,0 +1,517 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Fisheye.h"
+#include "UyvyImage.h"
+#include "FisheyeCorrection.h"
+
+// caches the fisheye as a polar panorama: x is theta (0 to 360) around the
+// optical axis, y is phi (0 to fov / 2) away from it. the camera image is only
+// resampled into the cache when a new camera frame arrives, and every display
+// frame just reprojects the cache onto the sphere with the current head
+// orientation and look angle.
+// the cache is split into tiles that go stale on each new camera frame. given
+// the head's view, only the stale tiles inside either eye's frustum are
+// unwrapped, the rest keep the last frame until they come into view.
+class FisheyePanorama {
+public:
+    // where the head is looking, in the same camera space as Fisheye::getDirection()
+    struct View {
+        ofVec3f forward, up;
+    };
+    // tangents of the half angles from one eye's axis to the edges of its
+    // image, the dk2's left eye by default
+    struct EyeFov {
+        float left = 1.0586, right = 1.0923, up = 1.3292, down = 1.3292;
+    };
+    struct Tile {
+        int x, y, width, height; // in panorama pixels
+        ofVec3f center;
+        float radius; // degrees from center to the farthest edge
+        bool fresh = false;
+        bool history = false; // the cpu panorama holds an earlier frame here to denoise against
+        ofMesh mesh; // panorama position vertices, fisheye texcoords
+    };
+
+    // rows get taller away from the axis. every row is as many panorama pixels
+    // wide, so near the axis a row is a lot of work for a small part of the view.
+    int tileColumns = 32, tileRows = 12;
+    float rowExponent = 1.5;
+    EyeFov eyeFov; // the right eye is the mirror image
+    float predictionMargin = 5; // degrees of head motion before the next display frame
+
+    int width = 0, height = 0;
+    float fov = 180;
+    ofFbo fbo;
+    ofMesh sphereMesh;
+    vector<Tile> tiles;
+    int tilesUpdated = 0;
+    bool uyvy = false; // camera texture holds packed 4:2:2, see setUyvy()
+    ofShader uyvyShader;
+    FisheyeCorrection correction; // cpu path only
+
+    void setup(const Fisheye& fisheye) {
+        fov = fisheye.fov;
+        // match the fisheye sampling density at the rim, where it is highest
+        int newWidth = ceil(TWO_PI * fisheye.radius);
+        int newHeight = ceil(fisheye.radius);
+        if(newWidth != width || newHeight != height) {
+            width = newWidth;
+            height = newHeight;
+            fbo.allocate(width, height, GL_RGB);
+        }
+        setupTiles(fisheye);
+        // same grid as the fisheye mesh, textured from the cache
+        sphereMesh = fisheye.mesh;
+        int k = 0;
+        for(int i = 0; i < fisheye.radiusResolution; i++) {
+            for(int j = 0; j < fisheye.thetaResolution; j++) {
+                ofVec2f panoramaPos(ofMap(j, 0, fisheye.thetaResolution - 1, 0, width),
+                                    ofMap(i, 0, fisheye.radiusResolution - 1, 0, height));
+                sphereMesh.setTexCoord(k, panoramaPos);
+                k++;
+            }
+        }
+    }
+    // the camera texture is raw uyvy uploaded as rgba at half width, like
+    // SharedFrameViewer does. the unwrap converts just the panorama pixels.
+    // needs the programmable renderer.
+    void setUyvy(bool uyvy) {
+        if(uyvy && !uyvyShader.isLoaded()) {
+            uyvyShader.setupShaderFromSource(GL_VERTEX_SHADER, getUyvyVertexShader());
+            uyvyShader.setupShaderFromSource(GL_FRAGMENT_SHADER, getUyvyFragmentShader());
+            uyvyShader.bindDefaults();
+            uyvyShader.linkProgram();
+        }
+        if(uyvy != this->uyvy) {
+            invalidate();
+        }
+        this->uyvy = uyvy;
+    }
+    // call when a new camera frame arrives
+    void invalidate() {
+        for(Tile& tile : tiles) {
+            tile.fresh = false;
+        }
+    }
+    // true if some of the tile could be in either eye's frustum after the head
+    // turns by up to predictionMargin
+    bool isVisible(const Tile& tile, const View& view) const {
+        ofVec3f forward = view.forward.getNormalized();
+        ofVec3f right = forward.getCrossed(view.up).getNormalized();
+        ofVec3f up = right.getCrossed(forward);
+        // how far past a side the tile's bounding circle, plus the margin, reaches
+        float reach = tile.radius + predictionMargin;
+        if(reach >= 90) {
+            return true;
+        }
+        float outside = -sin(reach * DEG_TO_RAD);
+        EyeFov rightEye = eyeFov;
+        swap(rightEye.left, rightEye.right);
+        return isInFrustum(tile.center, forward, right, up, eyeFov, outside) ||
+            isInFrustum(tile.center, forward, right, up, rightEye, outside);
+    }
+    // unwrap every stale tile, with the camera texture's bind() / unbind()
+    template <class T>
+    void update(T& camera) {
+        update(camera, View(), false);
+    }
+    // unwrap only the stale tiles that can be seen from this view
+    template <class T>
+    void update(T& camera, const View& view, bool cull = true) {
+        tilesUpdated = 0;
+        bool bound = false;
+        for(Tile& tile : tiles) {
+            if(tile.fresh || (cull && !isVisible(tile, view))) {
+                continue;
+            }
+            if(!bound) {
+                fbo.begin();
+                ofPushStyle();
+                ofSetColor(ofColor::white);
+                if(uyvy) {
+                    uyvyShader.begin();
+                    uyvyShader.setUniformTexture("tex0", camera, 0);
+                } else {
+                    camera.bind();
+                }
+                bound = true;
+            }
+            tile.mesh.draw();
+            tile.fresh = true;
+            tilesUpdated++;
+        }
+        if(bound) {
+            if(uyvy) {
+                uyvyShader.end();
+            } else {
+                camera.unbind();
+            }
+            ofPopStyle();
+            fbo.end();
+        }
+    }
+    // drop-in for Fisheye::draw() while the camera texture is bound
+    void draw() {
+        ofPushStyle();
+        ofSetColor(ofColor::white);
+        ofRotateX(180);
+        fbo.getTexture().bind();
+        sphereMesh.drawFaces();
+        fbo.getTexture().unbind();
+        ofPopStyle();
+    }
+
+    // cpu path into panorama pixels from ofPixels or a UyvyImage, same tiles and
+    // the same culling as update(), with the correction applied as it goes
+    template <class Image>
+    void update(const Fisheye& fisheye, const Image& camera, ofPixels& panorama, const View& view, bool cull = true) {
+        if(panorama.getWidth() != width || panorama.getHeight() != height) {
+            panorama.allocate(width, height, getNumChannels(camera));
+            invalidate();
+            for(Tile& tile : tiles) {
+                tile.history = false;
+            }
+        }
+        tilesUpdated = 0;
+        for(Tile& tile : tiles) {
+            if(tile.fresh || (cull && !isVisible(tile, view))) {
+                continue;
+            }
+            unwrap(fisheye, camera, panorama, tile.x, tile.y, tile.x + tile.width, tile.y + tile.height,
+                   correction.isEnabled() ? &correction : nullptr, tile.history);
+            tile.fresh = true;
+            tile.history = true;
+            tilesUpdated++;
+        }
+    }
+    // times full and view-dependent cpu unwraps of one frame while sweeping the
+    // view around the fisheye, and logs what fraction of the work was needed
+    template <class Image>
+    void benchmark(const Fisheye& fisheye, const Image& camera) {
+        ofPixels panorama;
+        update(fisheye, camera, panorama, View(), false);
+        float fullStart = ofGetElapsedTimef();
+        int fullRuns = 4;
+        for(int i = 0; i < fullRuns; i++) {
+            invalidate();
+            update(fisheye, camera, panorama, View(), false);
+        }
+        float fullSeconds = (ofGetElapsedTimef() - fullStart) / fullRuns;
+        ofLog() << "full unwrap: " << ofToString(fullSeconds * 1000, 2) << "ms, " << tiles.size() << " tiles";
+        // the same with both corrections on, flat gains if there's no calibration
+        FisheyeCorrection saved = correction;
+        correction.denoise = true;
+        correction.vignetting = true;
+        if(correction.gains.empty()) {
+            correction.gains.assign(ceil(fisheye.radius) + 1, 1);
+        }
+        float correctedStart = ofGetElapsedTimef();
+        for(int i = 0; i < fullRuns; i++) {
+            invalidate();
+            update(fisheye, camera, panorama, View(), false);
+        }
+        float correctedSeconds = (ofGetElapsedTimef() - correctedStart) / fullRuns;
+        ofLog() << "full unwrap with denoise and vignetting: " << ofToString(correctedSeconds * 1000, 2) << "ms";
+        correction = saved;
+        // tiles aren't all the same size, so count the pixels unwrapped
+        float totalSeconds = 0, totalPixels = 0;
+        int runs = 0;
+        for(float phi = 0; phi <= 90; phi += 30) {
+            float sweepSeconds = 0, sweepPixels = 0;
+            int sweepRuns = 0;
+            for(float theta = 0; theta < 360; theta += 30) {
+                // head upright, with its up away from the optical axis
+                View view;
+                view.forward = fisheye.getDirection(phi, theta);
+                view.up = fisheye.getDirection(phi + 90, theta);
+                invalidate();
+                float start = ofGetElapsedTimef();
+                update(fisheye, camera, panorama, view);
+                sweepSeconds += ofGetElapsedTimef() - start;
+                for(Tile& tile : tiles) {
+                    if(tile.fresh) {
+                        sweepPixels += tile.width * tile.height;
+                    }
+                }
+                sweepRuns++;
+            }
+            ofLog() << "view " << phi << " degrees off axis: " <<
+                ofToString(sweepSeconds * 1000 / sweepRuns, 2) << "ms, " <<
+                ofToString(100. * sweepPixels / (sweepRuns * width * height), 0) << "% of the panorama";
+            totalSeconds += sweepSeconds;
+            totalPixels += sweepPixels;
+            runs += sweepRuns;
+        }
+        ofLog() << "view dependent unwrap: " << ofToString(totalSeconds * 1000 / runs, 2) << "ms, " <<
+            ofToString(100. * totalPixels / (runs * width * height), 0) << "% of the panorama, " <<
+            ofToString(100. * totalSeconds / (runs * fullSeconds), 0) << "% of the full unwrap time";
+    }
+
+    // cpu reference, no gl needed. unwrap() fills the panorama the same way
+    // update() does, sample() reads it back the same way draw() does.
+    template <class Image>
+    static void unwrap(const Fisheye& fisheye, const Image& camera, ofPixels& panorama, int width, int height) {
+        panorama.allocate(width, height, getNumChannels(camera));
+        unwrap(fisheye, camera, panorama, 0, 0, width, height);
+    }
+    // just the pixels from x0, y0 up to x1, y1 of an allocated panorama. with a
+    // correction, rows get its gain and, if history says the panorama already
+    // holds an earlier frame there, are denoised against it as they're written.
+    static void unwrap(const Fisheye& fisheye, const ofPixels& camera, ofPixels& panorama, int x0, int y0, int x1, int y1,
+                       const FisheyeCorrection* correction = nullptr, bool history = false) {
+        int width = panorama.getWidth(), height = panorama.getHeight();
+        int channels = camera.getNumChannels();
+        int n = (x1 - x0) * channels;
+        vector<ofVec2f> directions;
+        getColumnDirections(width, x0, x1, directions);
+        bool denoise = correction && correction->denoise && history;
+        vector<unsigned char> fresh(denoise ? n : 0);
+        float color[4];
+        for(int y = y0; y < y1; y++) {
+            float sampleRadius = fisheye.getSampleRadius(ofMap(y + .5, 0, height, 0, fisheye.fov / 2.));
+            float gain = correction ? correction->getGain(sampleRadius) : 1;
+            unsigned char* row = panorama.getData() + (y * width + x0) * channels;
+            unsigned char* out = denoise ? fresh.data() : row;
+            for(int x = x0; x < x1; x++) {
+                // same as fisheye.getPosition(), pixel centers are at +.5 like gl
+                ofVec2f position = fisheye.offset + directions[x - x0] * sampleRadius;
+                sampleBilinear(camera, position.x - .5, position.y - .5, color);
+                for(int c = 0; c < channels; c++) {
+                    *out++ = MIN(color[c] * gain + .5, 255);
+                }
+            }
+            if(denoise) {
+                correction->filterRow(fresh.data(), row, n);
+            }
+        }
+    }
+    // same from packed 4:2:2. luma and chroma are interpolated separately and
+    // only the results go through the simd rgb conversion, a row at a time.
+    static void unwrap(const Fisheye& fisheye, const UyvyImage& camera, ofPixels& panorama, int x0, int y0, int x1, int y1,
+                       const FisheyeCorrection* correction = nullptr, bool history = false) {
+        int width = panorama.getWidth(), height = panorama.getHeight();
+        int n = x1 - x0;
+        vector<ofVec2f> directions;
+        getColumnDirections(width, x0, x1, directions);
+        bool denoise = correction && correction->denoise && history;
+        vector<unsigned char> fresh(denoise ? n * 3 : 0);
+        vector<float> luma(n), u(n), v(n);
+        for(int y = y0; y < y1; y++) {
+            float sampleRadius = fisheye.getSampleRadius(ofMap(y + .5, 0, height, 0, fisheye.fov / 2.));
+            float gain = correction ? correction->getGain(sampleRadius) : 1;
+            for(int i = 0; i < n; i++) {
+                ofVec2f position = fisheye.offset + directions[i] * sampleRadius;
+                camera.sampleBilinear(position.x - .5, position.y - .5, luma[i], u[i], v[i]);
+            }
+            if(gain != 1) {
+                // scaling luma and chroma about black scales rgb the same way
+                for(int i = 0; i < n; i++) {
+                    luma[i] = 16 + (luma[i] - 16) * gain;
+                    u[i] = 128 + (u[i] - 128) * gain;
+                    v[i] = 128 + (v[i] - 128) * gain;
+                }
+            }
+            unsigned char* row = panorama.getData() + (y * width + x0) * 3;
+            UyvyImage::convertRow(luma.data(), u.data(), v.data(), denoise ? fresh.data() : row, n);
+            if(denoise) {
+                correction->filterRow(fresh.data(), row, n * 3);
+            }
+        }
+    }
+    // color of a direction in camera space, from the panorama. false if outside the fov.
+    static bool sample(const ofPixels& panorama, float fov, const ofVec3f& direction, float* color) {
+        ofVec3f normalized = direction.getNormalized();
+        float phi = acos(ofClamp(normalized.z, -1, 1)) * RAD_TO_DEG;
+        if(phi > fov / 2.) {
+            return false;
+        }
+        float theta = atan2(normalized.y, normalized.x) * RAD_TO_DEG;
+        if(theta < 0) {
+            theta += 360;
+        }
+        float x = ofMap(theta, 0, 360, 0, panorama.getWidth());
+        float y = ofMap(phi, 0, fov / 2., 0, panorama.getHeight());
+        sampleBilinear(panorama, x - .5, y - .5, color, true);
+        return true;
+    }
+    // same direction straight from the camera image, which is what Fisheye::draw() shows
+    static bool sample(const Fisheye& fisheye, const ofPixels& camera, const ofVec3f& direction, float* color) {
+        ofVec3f normalized = direction.getNormalized();
+        float phi = acos(ofClamp(normalized.z, -1, 1)) * RAD_TO_DEG;
+        if(phi > fisheye.fov / 2.) {
+            return false;
+        }
+        float theta = atan2(normalized.y, normalized.x) * RAD_TO_DEG;
+        ofVec2f position = fisheye.getPosition(phi, theta);
+        sampleBilinear(camera, position.x - .5, position.y - .5, color);
+        return true;
+    }
+    // unwraps the frame on the cpu and compares reprojected samples against
+    // direct samples over a grid of directions. returns the mean absolute
+    // error in 0-255 levels, and the worst one in maxError.
+    static float verify(const Fisheye& fisheye, const ofPixels& camera, float& maxError, int steps = 64) {
+        ofPixels panorama;
+        unwrap(fisheye, camera, panorama, ceil(TWO_PI * fisheye.radius), ceil(fisheye.radius));
+        int channels = camera.getNumChannels();
+        float direct[4], reprojected[4];
+        double sum = 0;
+        int count = 0;
+        maxError = 0;
+        for(int i = 0; i < steps; i++) {
+            for(int j = 0; j < steps; j++) {
+                // stay off the rim, where the direct lookup starts reading outside the circle
+                float phi = ofMap(i + .5, 0, steps, 0, fisheye.fov / 2. - 1);
+                float theta = ofMap(j + .5, 0, steps, 0, 360);
+                ofVec3f direction = fisheye.getDirection(phi, theta);
+                if(!sample(fisheye, camera, direction, direct) ||
+                   !sample(panorama, fisheye.fov, direction, reprojected)) {
+                    continue;
+                }
+                for(int c = 0; c < channels; c++) {
+                    float error = fabsf(direct[c] - reprojected[c]);
+                    maxError = MAX(maxError, error);
+                    sum += error;
+                    count++;
+                }
+            }
+        }
+        return count ? sum / count : 0;
+    }
+
+protected:
+    // false if center is far enough beyond one side of the eye's frustum, that
+    // is if its dot with the side's inward normal is below outside
+    static bool isInFrustum(const ofVec3f& center, const ofVec3f& forward, const ofVec3f& right, const ofVec3f& up,
+                            const EyeFov& fov, float outside) {
+        ofVec3f sides[] = {-right, right, up, -up};
+        float tangents[] = {fov.left, fov.right, fov.up, fov.down};
+        for(int i = 0; i < 4; i++) {
+            ofVec3f normal = (forward * tangents[i] - sides[i]) / sqrt(1 + tangents[i] * tangents[i]);
+            if(center.dot(normal) < outside) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // cos and sin of theta for each panorama column, they're the same on every row
+    static void getColumnDirections(int width, int x0, int x1, vector<ofVec2f>& directions) {
+        directions.resize(x1 - x0);
+        for(int x = x0; x < x1; x++) {
+            float theta = ofMap(x + .5, 0, width, 0, 360) * DEG_TO_RAD;
+            directions[x - x0].set(cos(theta), sin(theta));
+        }
+    }
+    static int getNumChannels(const ofPixels& camera) {
+        return camera.getNumChannels();
+    }
+    static int getNumChannels(const UyvyImage& camera) {
+        return 3;
+    }
+    static string getUyvyVertexShader() {
+        return R"(#version 150
+uniform mat4 modelViewProjectionMatrix;
+in vec4 position;
+in vec2 texcoord;
+out vec2 texCoordVarying;
+void main() {
+    texCoordVarying = texcoord;
+    gl_Position = modelViewProjectionMatrix * position;
+}
+)";
+    }
+    // texcoords are in full resolution pixels, each texel is one U Y0 V Y1 pair
+    static string getUyvyFragmentShader() {
+        return R"(#version 150
+uniform sampler2DRect tex0;
+in vec2 texCoordVarying;
+out vec4 outputColor;
+float luma(ivec2 p) {
+    ivec2 size = textureSize(tex0);
+    p = clamp(p, ivec2(0), ivec2(size.x * 2 - 1, size.y - 1));
+    vec4 pair = texelFetch(tex0, ivec2(p.x / 2, p.y));
+    return (p.x % 2 == 0) ? pair.g : pair.a;
+}
+void main() {
+    vec2 p = texCoordVarying - 0.5;
+    ivec2 i = ivec2(floor(p));
+    vec2 f = p - floor(p);
+    float y = mix(mix(luma(i), luma(i + ivec2(1, 0)), f.x),
+                  mix(luma(i + ivec2(0, 1)), luma(i + ivec2(1, 1)), f.x), f.y);
+    // chroma is sited on the even pixels, the texture's linear filter interpolates it
+    vec2 uv = texture(tex0, vec2((texCoordVarying.x + 0.5) / 2.0, texCoordVarying.y)).rb;
+    y = 1.1644 * (y - 16.0 / 255.0);
+    uv -= 128.0 / 255.0;
+    outputColor = vec4(y + 1.7927 * uv.y, y - 0.2132 * uv.x - 0.5329 * uv.y, y + 2.1124 * uv.x, 1.0);
+}
+)";
+    }
+    int getRowY(int row) const {
+        return round(height * pow((float) row / tileRows, rowExponent));
+    }
+    void setupTiles(const Fisheye& fisheye) {
+        tiles.clear();
+        // enough steps per tile that the tiles together are as fine as the fisheye mesh
+        int thetaSteps = MAX(1, (int) ceil((fisheye.thetaResolution - 1) / (float) tileColumns));
+        for(int row = 0; row < tileRows; row++) {
+            int y0 = getRowY(row), y1 = getRowY(row + 1);
+            int phiSteps = MAX(1, (int) ceil((fisheye.radiusResolution - 1) * (y1 - y0) / (float) height));
+            for(int column = 0; column < tileColumns; column++) {
+                Tile tile;
+                tile.x = column * width / tileColumns;
+                tile.y = y0;
+                tile.width = (column + 1) * width / tileColumns - tile.x;
+                tile.height = y1 - y0;
+                float phi0 = ofMap(tile.y, 0, height, 0, fov / 2.), phi1 = ofMap(tile.y + tile.height, 0, height, 0, fov / 2.);
+                float theta0 = ofMap(tile.x, 0, width, 0, 360), theta1 = ofMap(tile.x + tile.width, 0, width, 0, 360);
+                tile.center = fisheye.getDirection((phi0 + phi1) / 2, (theta0 + theta1) / 2);
+                tile.radius = 0;
+                tile.mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+                for(int i = 0; i <= phiSteps; i++) {
+                    for(int j = 0; j <= thetaSteps; j++) {
+                        float phi = ofLerp(phi0, phi1, (float) i / phiSteps);
+                        float theta = ofLerp(theta0, theta1, (float) j / thetaSteps);
+                        tile.mesh.addVertex(ofVec3f(ofMap(theta, 0, 360, 0, width), ofMap(phi, 0, fov / 2., 0, height)));
+                        tile.mesh.addTexCoord(fisheye.getPosition(phi, theta));
+                        float angle = acos(ofClamp(tile.center.dot(fisheye.getDirection(phi, theta)), -1, 1)) * RAD_TO_DEG;
+                        tile.radius = MAX(tile.radius, angle);
+                        if(i < phiSteps && j < thetaSteps) {
+                            int k = i * (thetaSteps + 1) + j;
+                            int below = k + thetaSteps + 1;
+                            tile.mesh.addTriangle(k, k + 1, below);
+                            tile.mesh.addTriangle(k + 1, below + 1, below);
+                        }
+                    }
+                }
+                tiles.push_back(tile);
+            }
+        }
+    }
+    // clamps to the edge, or wraps horizontally for the panorama seam
+    static void sampleBilinear(const ofPixels& pixels, float x, float y, float* color, bool wrapX = false) {
+        int w = pixels.getWidth(), h = pixels.getHeight();
+        int channels = pixels.getNumChannels();
+        const unsigned char* data = pixels.getData();
+        int x0 = floor(x), y0 = floor(y);
+        float fx = x - x0, fy = y - y0;
+        int x1 = x0 + 1, y1 = y0 + 1;
+        if(wrapX) {
+            x0 = (x0 % w + w) % w;
+            x1 = (x1 % w + w) % w;
+        } else {
+            x0 = ofClamp(x0, 0, w - 1);
+            x1 = ofClamp(x1, 0, w - 1);
+        }
+        y0 = ofClamp(y0, 0, h - 1);
+        y1 = ofClamp(y1, 0, h - 1);
+        const unsigned char* p00 = data + (y0 * w + x0) * channels;
+        const unsigned char* p10 = data + (y0 * w + x1) * channels;
+        const unsigned char* p01 = data + (y1 * w + x0) * channels;
+        const unsigned char* p11 = data + (y1 * w + x1) * channels;
+        for(int c = 0; c < channels; c++) {
+            float top = p00[c] + (p10[c] - p00[c]) * fx;
+            float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+            color[c] = top + (bottom - top) * fy;
+        }
+    }
+};
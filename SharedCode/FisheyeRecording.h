@@ -0,0 +1,392 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Fisheye.h"
+#include "SharedFrameRing.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// session recordings that only keep the pixels inside the fisheye circle.
+// each row stores one span, from where it enters the circle to where it leaves,
+// and a frame is those spans back to back. frames are either whole (key) or
+// the xor against the previous frame as runs of zero bytes and literal bytes
+// (delta), whichever is smaller. an index at the end gives random access by
+// mapping the file, and if the recorder never closed the file the reader
+// rebuilds the index by walking the frame records.
+//
+// file: FileHeader, Span[height], then per frame a FrameRecord and its payload,
+// then uint64_t offsets[frameCount] and a Footer.
+namespace FisheyeRecording {
+    const uint32_t fileMagic = 0x43465348; // HSFC
+    const uint32_t frameMagic = 0x4d415246; // FRAM
+    const uint32_t footerMagic = 0x49465348; // HSFI
+    const uint32_t version = 1;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format; // SharedFrameFormat, also the bytes per pixel
+        uint32_t width, height;
+        uint32_t payloadBytes; // bytes of a whole frame
+        float offsetX, offsetY, radius; // the circle this was masked with
+    };
+    struct Span {
+        uint32_t start, length; // in pixels
+    };
+    enum FrameType {
+        KEY_FRAME = 0,
+        DELTA_FRAME = 1
+    };
+    struct FrameRecord {
+        uint32_t magic;
+        uint32_t type; // FrameType
+        uint64_t timestampMicros;
+        uint32_t bytes; // payload that follows
+        uint32_t reserved;
+    };
+    struct Footer {
+        uint64_t indexOffset;
+        uint32_t frameCount;
+        uint32_t magic;
+    };
+
+    // spans covering the circle plus a pixel for bilinear sampling at the rim.
+    // 4:2:2 spans start and end on even pixels so the chroma pairs stay whole.
+    inline vector<Span> getSpans(const Fisheye& fisheye, int width, int height, SharedFrameFormat format) {
+        vector<Span> spans(height);
+        float radius = fisheye.radius + 1;
+        for(int y = 0; y < height; y++) {
+            float dy = y + .5 - fisheye.offset.y;
+            spans[y].start = spans[y].length = 0;
+            if(fabsf(dy) >= radius) {
+                continue;
+            }
+            float half = sqrt(radius * radius - dy * dy);
+            int start = ofClamp(floor(fisheye.offset.x - half), 0, width);
+            int end = ofClamp(ceil(fisheye.offset.x + half), 0, width);
+            if(format == SHARED_FRAME_UYVY) {
+                start &= ~1;
+                end = MIN((end + 1) & ~1, width & ~1);
+            }
+            spans[y].start = start;
+            spans[y].length = MAX(end - start, 0);
+        }
+        return spans;
+    }
+}
+
+class FisheyeRecorder {
+protected:
+    FILE* file = nullptr;
+    FisheyeRecording::FileHeader header;
+    vector<FisheyeRecording::Span> spans;
+    vector<uint64_t> offsets;
+    vector<unsigned char> payload, previous, delta;
+    uint64_t position = 0;
+    int framesSinceKey = 0;
+    uint64_t rawBytes = 0, writtenBytes = 0;
+
+    void write(const void* data, size_t bytes) {
+        fwrite(data, 1, bytes, file);
+        position += bytes;
+    }
+    // runs of [uint32 zeros][uint32 literals][literals], false if it isn't smaller
+    bool encodeDelta() {
+        size_t n = payload.size();
+        delta.resize(n);
+        size_t out = 0, i = 0;
+        while(i < n) {
+            size_t zeros = i;
+            // step a word at a time through the unchanged stretches
+            while(zeros + 8 <= n && memcmp(&payload[zeros], &previous[zeros], 8) == 0) {
+                zeros += 8;
+            }
+            while(zeros < n && payload[zeros] == previous[zeros]) {
+                zeros++;
+            }
+            size_t literals = zeros;
+            while(literals < n && payload[literals] != previous[literals]) {
+                literals++;
+            }
+            if(out + 8 + (literals - zeros) >= n) {
+                return false;
+            }
+            uint32_t runs[2] = {(uint32_t) (zeros - i), (uint32_t) (literals - zeros)};
+            memcpy(&delta[out], runs, sizeof(runs));
+            out += sizeof(runs);
+            for(size_t j = zeros; j < literals; j++) {
+                delta[out++] = payload[j] ^ previous[j];
+            }
+            i = literals;
+        }
+        delta.resize(out);
+        return true;
+    }
+public:
+    int keyFrameInterval = 30; // 1 turns delta frames off
+
+    ~FisheyeRecorder() {
+        close();
+    }
+    bool setup(string path, const Fisheye& fisheye, int width, int height, SharedFrameFormat format) {
+        close();
+        file = fopen(ofToDataPath(path).c_str(), "wb");
+        if(!file) {
+            ofLogError("FisheyeRecorder") << "can't open " << path;
+            return false;
+        }
+        spans = FisheyeRecording::getSpans(fisheye, width, height, format);
+        header.magic = FisheyeRecording::fileMagic;
+        header.version = FisheyeRecording::version;
+        header.format = format;
+        header.width = width;
+        header.height = height;
+        header.payloadBytes = 0;
+        for(const FisheyeRecording::Span& span : spans) {
+            header.payloadBytes += span.length * format;
+        }
+        header.offsetX = fisheye.offset.x;
+        header.offsetY = fisheye.offset.y;
+        header.radius = fisheye.radius;
+        payload.resize(header.payloadBytes);
+        previous.clear();
+        offsets.clear();
+        position = 0;
+        framesSinceKey = 0;
+        rawBytes = writtenBytes = 0;
+        write(&header, sizeof(header));
+        write(spans.data(), spans.size() * sizeof(FisheyeRecording::Span));
+        return true;
+    }
+    bool isRecording() const {
+        return file != nullptr;
+    }
+    // a whole frame as width x height pixels, stride in bytes
+    void add(const unsigned char* data, int stride, uint64_t timestampMicros = 0) {
+        if(!file) {
+            return;
+        }
+        unsigned char* out = payload.data();
+        for(int y = 0; y < header.height; y++) {
+            size_t bytes = spans[y].length * header.format;
+            memcpy(out, data + y * stride + spans[y].start * header.format, bytes);
+            out += bytes;
+        }
+        FisheyeRecording::FrameRecord record;
+        record.magic = FisheyeRecording::frameMagic;
+        record.type = FisheyeRecording::KEY_FRAME;
+        record.timestampMicros = timestampMicros ? timestampMicros : SharedFrameRing::getTimestampMicros();
+        record.reserved = 0;
+        const vector<unsigned char>* body = &payload;
+        if(!previous.empty() && framesSinceKey + 1 < keyFrameInterval && encodeDelta()) {
+            record.type = FisheyeRecording::DELTA_FRAME;
+            body = &delta;
+            framesSinceKey++;
+        } else {
+            framesSinceKey = 0;
+        }
+        record.bytes = body->size();
+        offsets.push_back(position);
+        write(&record, sizeof(record));
+        write(body->data(), body->size());
+        previous.swap(payload);
+        payload.resize(header.payloadBytes);
+        rawBytes += (uint64_t) header.width * header.height * header.format;
+        writtenBytes += sizeof(record) + record.bytes;
+    }
+    void close() {
+        if(!file) {
+            return;
+        }
+        FisheyeRecording::Footer footer;
+        footer.indexOffset = position;
+        footer.frameCount = offsets.size();
+        footer.magic = FisheyeRecording::footerMagic;
+        write(offsets.data(), offsets.size() * sizeof(uint64_t));
+        write(&footer, sizeof(footer));
+        fclose(file);
+        file = nullptr;
+    }
+    int getFrameCount() const {
+        return offsets.size();
+    }
+    // bytes written per byte of full frames, lower is better
+    float getRatio() const {
+        return rawBytes ? (float) writtenBytes / rawBytes : 0;
+    }
+};
+
+class FisheyeRecordingReader {
+protected:
+    const unsigned char* mapping = nullptr;
+    size_t mappingBytes = 0;
+    FisheyeRecording::FileHeader header;
+    const FisheyeRecording::Span* spans = nullptr;
+    vector<uint64_t> offsets;
+    vector<unsigned char> payload; // the last decoded frame
+    int decoded = -1;
+
+    const FisheyeRecording::FrameRecord& getRecord(int i) const {
+        return *(const FisheyeRecording::FrameRecord*) (mapping + offsets[i]);
+    }
+    bool isRecordAt(uint64_t offset) const {
+        if(offset + sizeof(FisheyeRecording::FrameRecord) > mappingBytes) {
+            return false;
+        }
+        const FisheyeRecording::FrameRecord& record = *(const FisheyeRecording::FrameRecord*) (mapping + offset);
+        return record.magic == FisheyeRecording::frameMagic &&
+            offset + sizeof(record) + record.bytes <= mappingBytes &&
+            (record.type == FisheyeRecording::KEY_FRAME ? record.bytes == header.payloadBytes : record.type == FisheyeRecording::DELTA_FRAME);
+    }
+    void readIndex(uint64_t framesStart) {
+        offsets.clear();
+        if(mappingBytes >= framesStart + sizeof(FisheyeRecording::Footer)) {
+            const FisheyeRecording::Footer& footer = *(const FisheyeRecording::Footer*) (mapping + mappingBytes - sizeof(FisheyeRecording::Footer));
+            if(footer.magic == FisheyeRecording::footerMagic &&
+               footer.indexOffset + footer.frameCount * sizeof(uint64_t) + sizeof(footer) == mappingBytes) {
+                const uint64_t* index = (const uint64_t*) (mapping + footer.indexOffset);
+                offsets.assign(index, index + footer.frameCount);
+                return;
+            }
+        }
+        // not closed cleanly, keep every whole record
+        uint64_t offset = framesStart;
+        while(isRecordAt(offset)) {
+            offsets.push_back(offset);
+            offset += sizeof(FisheyeRecording::FrameRecord) + getRecord(offsets.size() - 1).bytes;
+        }
+    }
+    void applyDelta(const FisheyeRecording::FrameRecord& record) {
+        const unsigned char* in = (const unsigned char*) (&record + 1);
+        const unsigned char* end = in + record.bytes;
+        size_t out = 0;
+        while(in + 8 <= end) {
+            uint32_t runs[2];
+            memcpy(runs, in, sizeof(runs));
+            in += sizeof(runs);
+            out += runs[0];
+            if(out + runs[1] > payload.size() || in + runs[1] > end) {
+                break;
+            }
+            for(uint32_t j = 0; j < runs[1]; j++) {
+                payload[out++] ^= *in++;
+            }
+        }
+    }
+public:
+    ~FisheyeRecordingReader() {
+        close();
+    }
+    bool setup(string path) {
+        close();
+        int fd = ::open(ofToDataPath(path).c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat status;
+        if(fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(header)) {
+            ::close(fd);
+            return false;
+        }
+        void* result = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(result == MAP_FAILED) {
+            return false;
+        }
+        mapping = (const unsigned char*) result;
+        mappingBytes = status.st_size;
+        memcpy(&header, mapping, sizeof(header));
+        uint64_t framesStart = sizeof(header) + (uint64_t) header.height * sizeof(FisheyeRecording::Span);
+        if(header.magic != FisheyeRecording::fileMagic || header.version != FisheyeRecording::version || framesStart > mappingBytes) {
+            ofLogError("FisheyeRecordingReader") << path << " is not a fisheye recording";
+            close();
+            return false;
+        }
+        spans = (const FisheyeRecording::Span*) (mapping + sizeof(header));
+        readIndex(framesStart);
+        payload.assign(header.payloadBytes, 0);
+        decoded = -1;
+        return true;
+    }
+    void close() {
+        if(mapping) {
+            munmap((void*) mapping, mappingBytes);
+            mapping = nullptr;
+            mappingBytes = 0;
+        }
+        offsets.clear();
+        decoded = -1;
+    }
+    int getFrameCount() const {
+        return offsets.size();
+    }
+    int getWidth() const {
+        return header.width;
+    }
+    int getHeight() const {
+        return header.height;
+    }
+    SharedFrameFormat getFormat() const {
+        return (SharedFrameFormat) header.format;
+    }
+    // the circle the frames were masked with
+    ofVec2f getOffset() const {
+        return ofVec2f(header.offsetX, header.offsetY);
+    }
+    float getRadius() const {
+        return header.radius;
+    }
+    uint64_t getTimestampMicros(int i) const {
+        return getRecord(i).timestampMicros;
+    }
+    // the masked pixels of frame i, spans back to back. sequential reads apply
+    // one delta each, seeking goes back to the nearest key frame.
+    const unsigned char* getPayload(int i) {
+        if(i < 0 || i >= getFrameCount()) {
+            return nullptr;
+        }
+        if(i != decoded) {
+            int key = i;
+            while(key > 0 && getRecord(key).type != FisheyeRecording::KEY_FRAME) {
+                key--;
+            }
+            // carry on from the frame we have if it's on the way
+            int start = (decoded >= key && decoded < i) ? decoded + 1 : key;
+            for(int j = start; j <= i; j++) {
+                const FisheyeRecording::FrameRecord& record = getRecord(j);
+                if(record.type == FisheyeRecording::KEY_FRAME) {
+                    memcpy(payload.data(), &record + 1, header.payloadBytes);
+                } else {
+                    applyDelta(record);
+                }
+            }
+            decoded = i;
+        }
+        return payload.data();
+    }
+    // frame i as a whole image, black outside the circle
+    bool getFrame(int i, unsigned char* data, int stride) {
+        const unsigned char* in = getPayload(i);
+        if(!in) {
+            return false;
+        }
+        // black is 16 / 128 in 4:2:2, 0 in rgb
+        unsigned char black[4] = {128, 16, 128, 16};
+        for(int y = 0; y < header.height; y++) {
+            unsigned char* row = data + y * stride;
+            if(header.format == SHARED_FRAME_UYVY) {
+                for(int x = 0; x < header.width * 2; x++) {
+                    row[x] = black[x % 4];
+                }
+            } else {
+                memset(row, 0, header.width * header.format);
+            }
+            size_t bytes = spans[y].length * header.format;
+            memcpy(row + spans[y].start * header.format, in, bytes);
+            in += bytes;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Fisheye.h"
+#include "UyvyImage.h"
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+// blends two or more fisheye cameras into one equirectangular panorama. the
+// cameras are taken to share a center, so only their rotations matter.
+// setup() works out, for every panorama pixel, where to sample each camera
+// that sees it and how much of it to use: the camera furthest inside its own
+// edge wins, and near the seam, where another camera is nearly as far inside,
+// the two are faded over blendDegrees. stitch() then only walks that table,
+// split into bands of rows across worker threads.
+class FisheyeStitcher {
+public:
+    struct Camera {
+        Fisheye fisheye;
+        int width = 1920, height = 1080; // image size
+        ofVec3f rotation; // degrees about x, then y, then z, from camera to panorama
+    };
+    // one camera's contribution to one panorama pixel
+    struct Sample {
+        uint16_t x, y; // top left of the bilinear footprint
+        uint8_t fx, fy; // 256ths of a pixel past it
+        uint8_t camera;
+        uint8_t weight; // a pixel's weights add up to 255
+    };
+
+    float blendDegrees = 10;
+
+    ~FisheyeStitcher() {
+        stopWorkers();
+    }
+    // panorama is width x width / 2, threads 0 uses every core
+    void setup(const vector<Camera>& cameras, int width, int threads = 0) {
+        this->cameras = cameras;
+        this->width = width;
+        height = width / 2;
+        startWorkers(threads ? threads : MAX(1, (int) std::thread::hardware_concurrency()));
+        // each camera's axes in panorama space
+        for(int axis = 0; axis < 3; axis++) {
+            axes[axis].clear();
+            for(const Camera& camera : cameras) {
+                ofVec3f basis(axis == 0, axis == 1, axis == 2);
+                basis.rotate(camera.rotation.x, ofVec3f(1, 0, 0));
+                basis.rotate(camera.rotation.y, ofVec3f(0, 1, 0));
+                basis.rotate(camera.rotation.z, ofVec3f(0, 0, 1));
+                axes[axis].push_back(basis);
+            }
+        }
+        counts.assign(width * height, 0);
+        vector<vector<Sample>> bands(getBands());
+        run([&](int band) {
+            int y0, y1;
+            getRows(band, y0, y1);
+            for(int y = y0; y < y1; y++) {
+                addSamples(y, bands[band]);
+            }
+        });
+        samples.clear();
+        for(vector<Sample>& band : bands) {
+            samples.insert(samples.end(), band.begin(), band.end());
+        }
+        rowStarts.assign(height + 1, 0);
+        for(int y = 0; y < height; y++) {
+            rowStarts[y + 1] = rowStarts[y];
+            for(int x = 0; x < width; x++) {
+                rowStarts[y + 1] += counts[y * width + x];
+            }
+        }
+    }
+    int getWidth() const {
+        return width;
+    }
+    int getHeight() const {
+        return height;
+    }
+    // fraction of the sphere that at least one camera sees
+    float getCoverage() const {
+        double covered = 0;
+        for(int y = 0; y < height; y++) {
+            float lat = ofMap(y + .5, 0, height, 90, -90) * DEG_TO_RAD;
+            int n = 0;
+            for(int x = 0; x < width; x++) {
+                n += counts[y * width + x] > 0;
+            }
+            covered += n * cos(lat);
+        }
+        return covered / (width * height * 2 / PI);
+    }
+    // how much of one camera each panorama pixel uses, for checking the seams
+    void getMask(int camera, ofPixels& mask) const {
+        mask.allocate(width, height, 1);
+        unsigned char* out = mask.getData();
+        const Sample* sample = samples.data();
+        for(int i = 0; i < width * height; i++) {
+            out[i] = 0;
+            for(int k = 0; k < counts[i]; k++, sample++) {
+                if(sample->camera == camera) {
+                    out[i] = sample->weight;
+                }
+            }
+        }
+    }
+    // one image per camera, in setup() order, all ofPixels or all UyvyImage
+    void stitch(const vector<const ofPixels*>& images, ofPixels& panorama) {
+        int channels = images[0]->getNumChannels();
+        if(panorama.getWidth() != width || panorama.getHeight() != height || panorama.getNumChannels() != channels) {
+            panorama.allocate(width, height, channels);
+        }
+        run([&](int band) {
+            int y0, y1;
+            getRows(band, y0, y1);
+            const Sample* sample = samples.data() + rowStarts[y0];
+            const unsigned char* count = counts.data() + y0 * width;
+            unsigned char* out = panorama.getData() + y0 * width * channels;
+            for(int i = 0; i < (y1 - y0) * width; i++) {
+                unsigned int sum[4] = {0, 0, 0, 0};
+                for(int k = 0; k < count[i]; k++, sample++) {
+                    const ofPixels& image = *images[sample->camera];
+                    int stride = image.getWidth() * channels;
+                    const unsigned char* p = image.getData() + sample->y * stride + sample->x * channels;
+                    for(int c = 0; c < channels; c++) {
+                        sum[c] += bilinear(p[c], p[c + channels], p[c + stride], p[c + stride + channels], sample) * sample->weight;
+                    }
+                }
+                for(int c = 0; c < channels; c++) {
+                    *out++ = (sum[c] + 32640) / 65280;
+                }
+            }
+        });
+    }
+    // blends luma and chroma, then converts a row at a time like the uyvy unwrap
+    void stitch(const vector<const UyvyImage*>& images, ofPixels& panorama) {
+        if(panorama.getWidth() != width || panorama.getHeight() != height || panorama.getNumChannels() != 3) {
+            panorama.allocate(width, height, 3);
+        }
+        run([&](int band) {
+            int y0, y1;
+            getRows(band, y0, y1);
+            const Sample* sample = samples.data() + rowStarts[y0];
+            const unsigned char* count = counts.data() + y0 * width;
+            vector<float> luma(width), u(width), v(width);
+            for(int y = y0; y < y1; y++) {
+                for(int x = 0; x < width; x++, count++) {
+                    unsigned int sum[3] = {0, 0, 0};
+                    for(int k = 0; k < *count; k++, sample++) {
+                        const UyvyImage& image = *images[sample->camera];
+                        const unsigned char* row0 = image.data + sample->y * image.stride;
+                        const unsigned char* row1 = row0 + image.stride;
+                        int x0 = sample->x * 2 + 1;
+                        sum[0] += bilinear(row0[x0], row0[x0 + 2], row1[x0], row1[x0 + 2], sample) * sample->weight;
+                        // chroma pair k is sited on pixel 2k, so it sits at x / 2 in pairs
+                        int position = sample->x * 256 + sample->fx;
+                        int k0 = MIN(position >> 9, image.width / 2 - 2) * 4;
+                        int fk = (position & 511) >> 1;
+                        sum[1] += bilinear(row0[k0], row0[k0 + 4], row1[k0], row1[k0 + 4], fk, sample->fy) * sample->weight;
+                        sum[2] += bilinear(row0[k0 + 2], row0[k0 + 6], row1[k0 + 2], row1[k0 + 6], fk, sample->fy) * sample->weight;
+                    }
+                    if(*count) {
+                        luma[x] = sum[0] / 65280.;
+                        u[x] = sum[1] / 65280.;
+                        v[x] = sum[2] / 65280.;
+                    } else {
+                        luma[x] = 16;
+                        u[x] = v[x] = 128;
+                    }
+                }
+                UyvyImage::convertRow(luma.data(), u.data(), v.data(), panorama.getData() + y * width * 3, width);
+            }
+        });
+    }
+
+protected:
+    vector<Camera> cameras;
+    int width = 0, height = 0;
+    vector<Sample> samples; // by panorama pixel, then camera
+    vector<unsigned char> counts; // samples per panorama pixel
+    vector<uint32_t> rowStarts; // first sample of each row
+    vector<ofVec3f> axes[3]; // x, y and z of each camera in panorama space
+
+    // value * 256, fractions in 256ths
+    static unsigned int bilinear(int p00, int p10, int p01, int p11, int fx, int fy) {
+        unsigned int top = p00 * (256 - fx) + p10 * fx;
+        unsigned int bottom = p01 * (256 - fx) + p11 * fx;
+        return (top * (256 - fy) + bottom * fy + 128) >> 8;
+    }
+    static unsigned int bilinear(int p00, int p10, int p01, int p11, const Sample* sample) {
+        return bilinear(p00, p10, p01, p11, sample->fx, sample->fy);
+    }
+    void addSamples(int y, vector<Sample>& out) {
+        int n = cameras.size();
+        vector<float> margins(n), xs(n), ys(n), weights(n);
+        float lat = ofMap(y + .5, 0, height, 90, -90) * DEG_TO_RAD;
+        for(int x = 0; x < width; x++) {
+            // longitude 0 is straight along z
+            float lon = ofMap(x + .5, 0, width, -180, 180) * DEG_TO_RAD;
+            ofVec3f direction(cos(lat) * sin(lon), sin(lat), cos(lat) * cos(lon));
+            float best = -1;
+            for(int i = 0; i < n; i++) {
+                const Camera& camera = cameras[i];
+                ofVec3f local(direction.dot(axes[0][i]), direction.dot(axes[1][i]), direction.dot(axes[2][i]));
+                float phi = acos(ofClamp(local.z, -1, 1)) * RAD_TO_DEG;
+                float theta = atan2(local.y, local.x) * RAD_TO_DEG;
+                ofVec2f position = camera.fisheye.getPosition(phi, theta) - ofVec2f(.5, .5);
+                // how far inside the lens and the frame, in degrees
+                float degreesPerPixel = camera.fisheye.fov / 2. / camera.fisheye.radius;
+                float border = MIN(MIN(position.x, camera.width - 2 - position.x), MIN(position.y, camera.height - 2 - position.y));
+                margins[i] = MIN(camera.fisheye.fov / 2. - phi, border * degreesPerPixel);
+                xs[i] = position.x;
+                ys[i] = position.y;
+                best = MAX(best, margins[i]);
+            }
+            int count = 0;
+            if(best > 0) {
+                float total = 0;
+                for(int i = 0; i < n; i++) {
+                    weights[i] = margins[i] > 0 ? ofClamp(1 - (best - margins[i]) / blendDegrees, 0, 1) : 0;
+                    total += weights[i];
+                }
+                int remaining = 255;
+                int last = -1;
+                for(int i = 0; i < n; i++) {
+                    int weight = weights[i] * 255 / total + .5;
+                    if(weight == 0) {
+                        continue;
+                    }
+                    Sample sample;
+                    int x0 = floor(xs[i]), y0 = floor(ys[i]);
+                    sample.x = x0;
+                    sample.y = y0;
+                    sample.fx = MIN((int) ((xs[i] - x0) * 256 + .5), 255);
+                    sample.fy = MIN((int) ((ys[i] - y0) * 256 + .5), 255);
+                    sample.camera = i;
+                    sample.weight = MIN(weight, remaining);
+                    remaining -= sample.weight;
+                    out.push_back(sample);
+                    last = out.size() - 1;
+                    count++;
+                }
+                // rounding leftovers go to the last camera so the weights add up
+                out[last].weight += remaining;
+            }
+            counts[y * width + x] = count;
+        }
+    }
+
+    // a band of rows per worker
+    int getBands() const {
+        return workers.size() + 1;
+    }
+    void getRows(int band, int& y0, int& y1) const {
+        y0 = band * height / getBands();
+        y1 = (band + 1) * height / getBands();
+    }
+    // the calling thread takes band 0 and waits for the workers to finish the rest
+    void run(std::function<void(int)> work) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = work;
+            remaining = workers.size();
+            generation++;
+        }
+        started.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] {
+            return remaining == 0;
+        });
+    }
+    void startWorkers(int threads) {
+        if((int) workers.size() == threads - 1) {
+            return;
+        }
+        stopWorkers();
+        for(int band = 1; band < threads; band++) {
+            workers.push_back(std::thread([this, band] {
+                unsigned int seen = 0;
+                std::unique_lock<std::mutex> lock(mutex);
+                while(true) {
+                    started.wait(lock, [&] {
+                        return stopping || generation != seen;
+                    });
+                    if(stopping) {
+                        return;
+                    }
+                    seen = generation;
+                    std::function<void(int)> work = job;
+                    lock.unlock();
+                    work(band);
+                    lock.lock();
+                    if(--remaining == 0) {
+                        finished.notify_one();
+                    }
+                }
+            }));
+        }
+    }
+    void stopWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for(std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        stopping = false;
+    }
+
+    vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable started, finished;
+    std::function<void(int)> job;
+    unsigned int generation = 0;
+    int remaining = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,396 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Fisheye.h"
+#include "FisheyePanorama.h"
+#include "UyvyImage.h"
+#include <atomic>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// serves a small jpeg of the unwrapped panorama over http, for the operator
+// tablets. submit() only copies the camera frame when someone is watching and
+// the last one has been dealt with, everything else happens on the server's
+// own thread: unwrapping straight at preview size, encoding, and writing to
+// the clients without ever waiting on them.
+//   /stream     multipart mjpeg, ?fps= caps the rate for that client
+//   /frame.jpg  the latest frame
+//   /           a page showing the stream
+// each stream client only gets a new frame once the last one has drained, so
+// a slow client gets a lower frame rate, and after skipping a few frames in a
+// row a lower jpeg quality too. keeping up for a while earns the quality back.
+class PreviewServer : public ofThread {
+public:
+    int width = 1024; // of the preview panorama, the height follows the fisheye
+    float maxFps = 15;
+    int skipsBeforeDowngrade = 2;
+    int framesBeforeUpgrade = 30;
+    int sendBufferBytes = 16 * 1024;
+
+    ~PreviewServer() {
+        close();
+    }
+    bool setup(int port) {
+        close();
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(listener < 0 ||
+           ::bind(listener, (sockaddr*) &address, sizeof(address)) != 0 ||
+           listen(listener, 8) != 0 ||
+           pipe(wake) != 0) {
+            ofLogError("PreviewServer") << "can't listen on port " << port << ": " << strerror(errno);
+            close();
+            return false;
+        }
+        setNonBlocking(listener);
+        setNonBlocking(wake[0]);
+        setNonBlocking(wake[1]);
+        startThread();
+        return true;
+    }
+    void close() {
+        if(isThreadRunning()) {
+            stopThread();
+            notify();
+            waitForThread(false);
+        }
+        for(Client& client : clients) {
+            ::close(client.fd);
+        }
+        clients.clear();
+        clientCount = 0;
+        closeSocket(listener);
+        closeSocket(wake[0]);
+        closeSocket(wake[1]);
+    }
+    int getClientCount() const {
+        return clientCount;
+    }
+    // returns right away, and only copies when a frame is wanted
+    void submit(const Fisheye& fisheye, const UyvyImage& image) {
+        submit(fisheye, image.data, image.width, image.height, image.stride, true);
+    }
+    void submit(const Fisheye& fisheye, const ofPixels& pixels) {
+        int channels = pixels.getNumChannels();
+        submit(fisheye, pixels.getData(), pixels.getWidth(), pixels.getHeight(), pixels.getWidth() * channels, false, channels);
+    }
+
+protected:
+    struct Client {
+        int fd;
+        string request, output;
+        size_t sent = 0;
+        bool streaming = false, closeWhenSent = false;
+        float fps = 0;
+        int quality = OF_IMAGE_QUALITY_HIGH;
+        int skipped = 0, kept = 0;
+        float lastFrame = 0;
+    };
+
+    int listener = -1;
+    int wake[2] = {-1, -1};
+    std::atomic<int> clientCount{0};
+    float lastSubmit = 0;
+
+    // only touched while holding mutex
+    vector<unsigned char> pending;
+    int pendingWidth = 0, pendingHeight = 0, pendingStride = 0, pendingChannels = 0;
+    bool pendingUyvy = false, hasPending = false;
+    Fisheye pendingFisheye;
+
+    // only touched by the thread
+    vector<Client> clients;
+    vector<unsigned char> frame;
+    Fisheye frameFisheye;
+    ofPixels preview;
+    string latest; // jpeg of the newest preview, for /frame.jpg
+    map<int, string> encoded; // the newest preview at each quality in use
+
+    static void setNonBlocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+    static void closeSocket(int& fd) {
+        if(fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    void notify() {
+        if(wake[1] >= 0) {
+            char byte = 0;
+            ssize_t written = write(wake[1], &byte, 1);
+            (void) written;
+        }
+    }
+    void submit(const Fisheye& fisheye, const unsigned char* data, int w, int h, int stride, bool uyvy, int channels = 2) {
+        float now = ofGetElapsedTimef();
+        if(clientCount == 0 || now - lastSubmit < 1 / maxFps) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if(!lock.owns_lock() || hasPending) {
+            return;
+        }
+        lastSubmit = now;
+        pending.assign(data, data + h * stride);
+        pendingWidth = w;
+        pendingHeight = h;
+        pendingStride = stride;
+        pendingChannels = channels;
+        pendingUyvy = uyvy;
+        // just what the unwrap needs, not the meshes
+        pendingFisheye.offset = fisheye.offset;
+        pendingFisheye.radius = fisheye.radius;
+        pendingFisheye.fov = fisheye.fov;
+        hasPending = true;
+        lock.unlock();
+        notify();
+    }
+    void threadedFunction() {
+        while(isThreadRunning()) {
+            vector<pollfd> fds;
+            fds.push_back({wake[0], POLLIN, 0});
+            fds.push_back({listener, POLLIN, 0});
+            for(Client& client : clients) {
+                short events = POLLIN;
+                if(client.sent < client.output.size()) {
+                    events |= POLLOUT;
+                }
+                fds.push_back({client.fd, events, 0});
+            }
+            if(poll(fds.data(), fds.size(), 100) < 0) {
+                continue;
+            }
+            if(fds[0].revents & POLLIN) {
+                char bytes[64];
+                while(read(wake[0], bytes, sizeof(bytes)) > 0) {
+                }
+                if(takePending()) {
+                    updatePreview();
+                }
+            }
+            for(int i = 0; i < clients.size(); i++) {
+                short revents = fds[i + 2].revents;
+                if(revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                    clients[i].closeWhenSent = true;
+                    clients[i].output.clear();
+                    clients[i].sent = 0;
+                    continue;
+                }
+                if(revents & POLLIN) {
+                    receive(clients[i]);
+                }
+                if(revents & POLLOUT) {
+                    send(clients[i]);
+                }
+            }
+            if(fds[1].revents & POLLIN) {
+                accept();
+            }
+            removeClosed();
+        }
+    }
+    bool takePending() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!hasPending) {
+            return false;
+        }
+        frame.swap(pending);
+        frameFisheye.offset = pendingFisheye.offset;
+        frameFisheye.radius = pendingFisheye.radius;
+        frameFisheye.fov = pendingFisheye.fov;
+        int w = pendingWidth, h = pendingHeight, stride = pendingStride;
+        bool uyvy = pendingUyvy;
+        int channels = pendingChannels;
+        hasPending = false;
+        // unwrapping at preview size is the downsampling, same shape as FisheyePanorama
+        int height = MAX(1, (int) (width / TWO_PI));
+        if(uyvy) {
+            FisheyePanorama::unwrap(frameFisheye, UyvyImage(frame.data(), w, h, stride), preview, width, height);
+        } else {
+            ofPixels pixels;
+            pixels.setFromExternalPixels(frame.data(), w, h, channels);
+            FisheyePanorama::unwrap(frameFisheye, pixels, preview, width, height);
+        }
+        return true;
+    }
+    void updatePreview() {
+        encoded.clear();
+        latest.clear();
+        float now = ofGetElapsedTimef();
+        for(Client& client : clients) {
+            if(!client.streaming) {
+                continue;
+            }
+            if(client.fps > 0 && now - client.lastFrame < 1 / client.fps) {
+                continue;
+            }
+            if(client.sent < client.output.size()) {
+                // still sending the last one
+                client.kept = 0;
+                if(++client.skipped >= skipsBeforeDowngrade && client.quality < OF_IMAGE_QUALITY_WORST) {
+                    client.quality++;
+                    client.skipped = 0;
+                }
+                continue;
+            }
+            client.skipped = 0;
+            if(++client.kept >= framesBeforeUpgrade && client.quality > OF_IMAGE_QUALITY_HIGH) {
+                client.quality--;
+                client.kept = 0;
+            }
+            const string& jpeg = getJpeg(client.quality);
+            client.output = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " + ofToString(jpeg.size()) + "\r\n\r\n" + jpeg + "\r\n";
+            client.sent = 0;
+            client.lastFrame = now;
+            send(client);
+        }
+    }
+    const string& getJpeg(int quality) {
+        if(!encoded.count(quality)) {
+            ofBuffer buffer;
+            ofSaveImage(preview, buffer, OF_IMAGE_FORMAT_JPEG, (ofImageQualityType) quality);
+            encoded[quality] = string(buffer.getData(), buffer.size());
+        }
+        return encoded[quality];
+    }
+    void accept() {
+        while(true) {
+            int fd = ::accept(listener, nullptr, nullptr);
+            if(fd < 0) {
+                return;
+            }
+            setNonBlocking(fd);
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            // a small send buffer, or a slow client's backlog hides in the kernel instead of showing up in output
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBufferBytes, sizeof(sendBufferBytes));
+#ifdef SO_NOSIGPIPE
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+            Client client;
+            client.fd = fd;
+            clients.push_back(client);
+        }
+    }
+    void receive(Client& client) {
+        char bytes[1024];
+        ssize_t n;
+        while((n = recv(client.fd, bytes, sizeof(bytes), 0)) > 0) {
+            if(!client.streaming && !client.closeWhenSent) {
+                client.request.append(bytes, n);
+            }
+        }
+        if(n == 0) {
+            client.closeWhenSent = true;
+            client.output.clear();
+            client.sent = 0;
+            return;
+        }
+        size_t end = client.request.find("\r\n\r\n");
+        if(end != string::npos) {
+            respond(client, client.request.substr(0, end));
+            client.request.clear();
+        } else if(client.request.size() > 8192) {
+            reply(client, "431 Request Header Fields Too Large", "text/plain", "");
+        }
+    }
+    void respond(Client& client, const string& request) {
+        vector<string> words = ofSplitString(request.substr(0, request.find("\r\n")), " ");
+        if(words.size() < 2 || words[0] != "GET") {
+            reply(client, "405 Method Not Allowed", "text/plain", "");
+            return;
+        }
+        string path = words[1], query;
+        size_t question = path.find('?');
+        if(question != string::npos) {
+            query = path.substr(question + 1);
+            path = path.substr(0, question);
+        }
+        if(path == "/stream") {
+            client.streaming = true;
+            client.fps = MIN(getQueryFloat(query, "fps", maxFps), maxFps);
+            client.output = "HTTP/1.0 200 OK\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Access-Control-Allow-Origin: *\r\n"
+                "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+            client.sent = 0;
+            clientCount++;
+            send(client);
+        } else if(path == "/frame.jpg") {
+            if(!preview.isAllocated()) {
+                reply(client, "503 Service Unavailable", "text/plain", "no frames yet\n");
+            } else {
+                if(latest.empty()) {
+                    latest = getJpeg(OF_IMAGE_QUALITY_HIGH);
+                }
+                reply(client, "200 OK", "image/jpeg", latest);
+            }
+        } else if(path == "/") {
+            reply(client, "200 OK", "text/html",
+                  "<html><body style=\"margin: 0; background: black\"><img src=\"/stream\" style=\"width: 100%\"></body></html>\n");
+        } else {
+            reply(client, "404 Not Found", "text/plain", "");
+        }
+    }
+    void reply(Client& client, const string& status, const string& type, const string& body) {
+        client.output = "HTTP/1.0 " + status + "\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Content-Type: " + type + "\r\n"
+            "Content-Length: " + ofToString(body.size()) + "\r\n\r\n" + body;
+        client.sent = 0;
+        client.closeWhenSent = true;
+        send(client);
+    }
+    void send(Client& client) {
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags = MSG_NOSIGNAL;
+#endif
+        while(client.sent < client.output.size()) {
+            ssize_t n = ::send(client.fd, client.output.data() + client.sent, client.output.size() - client.sent, flags);
+            if(n <= 0) {
+                if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    client.closeWhenSent = true;
+                    client.output.clear();
+                    client.sent = 0;
+                }
+                return;
+            }
+            client.sent += n;
+        }
+        client.output.clear();
+        client.sent = 0;
+    }
+    void removeClosed() {
+        for(int i = clients.size() - 1; i >= 0; i--) {
+            Client& client = clients[i];
+            if(client.closeWhenSent && client.sent >= client.output.size()) {
+                if(client.streaming) {
+                    clientCount--;
+                }
+                ::close(client.fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+    }
+    static float getQueryFloat(const string& query, const string& key, float fallback) {
+        for(const string& pair : ofSplitString(query, "&")) {
+            vector<string> parts = ofSplitString(pair, "=");
+            if(parts.size() == 2 && parts[0] == key) {
+                return ofToFloat(parts[1]);
+            }
+        }
+        return fallback;
+    }
+};
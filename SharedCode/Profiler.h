@@ -0,0 +1,342 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(PROFILER_STEADY_CLOCK)
+#include <x86intrin.h>
+#define PROFILER_RDTSC
+#endif
+
+// times named stages with scoped timers, cheap enough to leave in everywhere:
+//   PROFILE_SCOPE("unwrap");
+// each thread writes its events into a ring of its own without locking, and
+// update(), once a frame on the main thread, drains them into rolling
+// histograms (p50/p99/max over the last one to two windows) and keeps the last
+// few seconds for saveTrace(), which writes chrome://tracing json.
+// the clock is the cpu's timestamp counter on x86, converted with a rate
+// measured against steady_clock, and steady_clock itself everywhere else.
+class Profiler {
+public:
+    struct Stats {
+        float p50 = 0, p99 = 0, max = 0; // milliseconds
+        int count = 0;
+    };
+
+    float windowSeconds = 1;
+    float traceSeconds = 10; // of events kept for saveTrace()
+
+    static Profiler& get() {
+        static Profiler profiler;
+        return profiler;
+    }
+    static uint64_t getTicks() {
+#ifdef PROFILER_RDTSC
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    class Scope {
+    public:
+        Scope(int stage) : stage(stage), start(getTicks()) {
+        }
+        ~Scope() {
+            Profiler::get().add(stage, start, getTicks());
+        }
+    protected:
+        int stage;
+        uint64_t start;
+    };
+
+    // the same name always gets the same stage
+    int getStage(const string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(int i = 0; i < stages.size(); i++) {
+            if(stages[i].name == name) {
+                return i;
+            }
+        }
+        if(stages.size() == maxStages) {
+            ofLogWarning("Profiler") << "too many stages, " << name << " is counted as " << stages.back().name;
+            return maxStages - 1;
+        }
+        stages.emplace_back();
+        stages.back().name = name;
+        return stages.size() - 1;
+    }
+    // never blocks, an event that doesn't fit because update() is behind is dropped
+    void add(int stage, uint64_t start, uint64_t end) {
+        ThreadBuffer& buffer = getThreadBuffer();
+        uint64_t written = buffer.written.load(std::memory_order_relaxed);
+        if(written - buffer.consumed.load(std::memory_order_acquire) >= eventsPerThread) {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Event& event = buffer.events[written % eventsPerThread];
+        event.stage = stage;
+        event.start = start;
+        event.end = end;
+        buffer.written.store(written + 1, std::memory_order_release);
+    }
+    // shows up in the trace instead of "thread n"
+    void setThreadName(const string& name) {
+        ThreadBuffer& buffer = getThreadBuffer();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.name = name;
+    }
+    // call once per frame from the main thread, also times the frame itself
+    void update() {
+        uint64_t now = getTicks();
+        if(lastUpdate) {
+            add(frameStage, lastUpdate, now);
+        }
+        lastUpdate = now;
+        calibrate(now);
+        ThreadBuffer& own = getThreadBuffer();
+        std::lock_guard<std::mutex> lock(mutex);
+        if(own.name.empty()) {
+            own.name = "main";
+        }
+        if(toSeconds(now - windowStart) > windowSeconds) {
+            current = 1 - current;
+            for(Stage& stage : stages) {
+                stage.windows[current].clear();
+            }
+            windowStart = now;
+        }
+        for(int i = 0; i < threads.size(); i++) {
+            ThreadBuffer& buffer = *threads[i];
+            uint64_t consumed = buffer.consumed.load(std::memory_order_relaxed);
+            uint64_t written = buffer.written.load(std::memory_order_acquire);
+            for(; consumed < written; consumed++) {
+                const Event& event = buffer.events[consumed % eventsPerThread];
+                uint64_t nanos = toNanos(event.end - event.start);
+                stages[event.stage].windows[current].add(nanos);
+                trace.push_back({event.stage, i, event.start, event.end});
+            }
+            buffer.consumed.store(consumed, std::memory_order_release);
+        }
+        uint64_t keep = traceSeconds * ticksPerNano * 1e9;
+        while(!trace.empty() && (now - trace.front().start > keep || trace.size() > maxTraceEvents)) {
+            trace.pop_front();
+        }
+    }
+    Stats getStats(const string& name) {
+        return getStats(getStage(name));
+    }
+    Stats getStats(int stage) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Histogram both = stages[stage].windows[0];
+        both.add(stages[stage].windows[1]);
+        Stats stats;
+        stats.count = both.total;
+        stats.p50 = both.getPercentile(.5) / 1e6;
+        stats.p99 = both.getPercentile(.99) / 1e6;
+        stats.max = both.max / 1e6;
+        return stats;
+    }
+    // one line per stage, for ofDrawBitmapStringHighlight()
+    string getSummary() {
+        vector<string> names;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(Stage& stage : stages) {
+                names.push_back(stage.name.substr(0, 12));
+            }
+        }
+        string summary = "stage          p50    p99    max ms";
+        for(int i = 0; i < names.size(); i++) {
+            Stats stats = getStats(i);
+            if(!stats.count) {
+                continue;
+            }
+            const string& name = names[i];
+            summary += "\n" + name + string(13 - name.size(), ' ') +
+                format(stats.p50) + format(stats.p99) + format(stats.max);
+        }
+        uint64_t dropped = getDropped();
+        if(dropped) {
+            summary += "\n" + ofToString(dropped) + " events dropped";
+        }
+        return summary;
+    }
+    uint64_t getDropped() {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t dropped = 0;
+        for(auto& buffer : threads) {
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+    // the last traceSeconds of events, open in chrome://tracing or perfetto
+    bool saveTrace(const string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(ofToDataPath(path).c_str());
+        if(!out) {
+            ofLogError("Profiler") << "can't write " << path;
+            return false;
+        }
+        // threads are drained one after another, so the trace is only roughly in order
+        uint64_t origin = trace.empty() ? 0 : trace.front().start;
+        for(const TraceEvent& event : trace) {
+            origin = MIN(origin, event.start);
+        }
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        for(int i = 0; i < threads.size(); i++) {
+            string name = threads[i]->name.empty() ? "thread " + ofToString(i) : threads[i]->name;
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"" << escape(name) << "\"}},\n";
+        }
+        out << std::fixed << std::setprecision(3);
+        for(int i = 0; i < trace.size(); i++) {
+            const TraceEvent& event = trace[i];
+            out << "{\"name\":\"" << escape(stages[event.stage].name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+                << ",\"ts\":" << toNanos(event.start - origin) / 1e3
+                << ",\"dur\":" << toNanos(event.end - event.start) / 1e3 << "}"
+                << (i + 1 < trace.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+        ofLogNotice("Profiler") << "saved " << trace.size() << " events to " << path;
+        return true;
+    }
+
+protected:
+    static const int maxStages = 64;
+    static const int eventsPerThread = 8192;
+    static const int maxTraceEvents = 1 << 20;
+    static const int bucketsPerOctave = 8;
+    static const int buckets = 1 + 24 * bucketsPerOctave; // 1us to 16s, and everything under
+
+    struct Event {
+        int stage;
+        uint64_t start, end;
+    };
+    struct ThreadBuffer {
+        Event events[eventsPerThread];
+        std::atomic<uint64_t> written{0}, consumed{0}, dropped{0};
+        string name;
+    };
+    struct TraceEvent {
+        int stage, thread;
+        uint64_t start, end;
+    };
+    // log spaced, so percentiles are good to about 9%
+    struct Histogram {
+        uint32_t counts[buckets];
+        uint32_t total;
+        uint64_t max;
+        Histogram() {
+            clear();
+        }
+        void clear() {
+            memset(counts, 0, sizeof(counts));
+            total = 0;
+            max = 0;
+        }
+        void add(uint64_t nanos) {
+            int bucket = nanos < 1000 ? 0 : MIN(buckets - 1, 1 + (int) (log2(nanos / 1000.) * bucketsPerOctave));
+            counts[bucket]++;
+            total++;
+            max = MAX(max, nanos);
+        }
+        void add(const Histogram& other) {
+            for(int i = 0; i < buckets; i++) {
+                counts[i] += other.counts[i];
+            }
+            total += other.total;
+            max = MAX(max, other.max);
+        }
+        // the top of the bucket the percentile falls in
+        double getPercentile(float percentile) const {
+            uint64_t target = ceil(percentile * total), seen = 0;
+            for(int i = 0; i < buckets; i++) {
+                seen += counts[i];
+                if(seen >= target && seen > 0) {
+                    return MIN(1000 * pow(2., (double) i / bucketsPerOctave), (double) max);
+                }
+            }
+            return max;
+        }
+    };
+    struct Stage {
+        string name;
+        Histogram windows[2];
+    };
+
+    std::mutex mutex;
+    vector<Stage> stages;
+    vector<unique_ptr<ThreadBuffer>> threads;
+    deque<TraceEvent> trace;
+    int current = 0;
+    uint64_t windowStart = 0;
+    int frameStage = 0;
+    uint64_t lastUpdate = 0;
+
+    // ticks to time
+    double ticksPerNano = 1;
+    uint64_t originTicks = 0;
+    std::chrono::steady_clock::time_point originTime;
+
+    Profiler() {
+        frameStage = getStage("frame");
+        originTime = std::chrono::steady_clock::now();
+        originTicks = getTicks();
+#ifdef PROFILER_RDTSC
+        // a first guess, update() refines it as time goes on
+        while(std::chrono::steady_clock::now() - originTime < std::chrono::milliseconds(2)) {
+        }
+        calibrate(getTicks());
+#else
+        ticksPerNano = (double) std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num / 1e9;
+#endif
+        windowStart = getTicks();
+    }
+    void calibrate(uint64_t now) {
+#ifdef PROFILER_RDTSC
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - originTime).count();
+        if(nanos > 0) {
+            ticksPerNano = (now - originTicks) / nanos;
+        }
+#endif
+    }
+    uint64_t toNanos(uint64_t ticks) const {
+        return ticks / ticksPerNano;
+    }
+    float toSeconds(uint64_t ticks) const {
+        return ticks / ticksPerNano / 1e9;
+    }
+    ThreadBuffer& getThreadBuffer() {
+        static thread_local ThreadBuffer* buffer = nullptr;
+        if(!buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.emplace_back(new ThreadBuffer());
+            buffer = threads.back().get();
+        }
+        return *buffer;
+    }
+    static string format(float milliseconds) {
+        string text = ofToString(milliseconds, milliseconds < 10 ? 2 : 1);
+        return string(MAX(0, 7 - (int) text.size()), ' ') + text;
+    }
+    static string escape(const string& text) {
+        string escaped;
+        for(char c : text) {
+            if(c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// times the rest of the enclosing block as the named stage
+#define PROFILE_SCOPE(name) \
+    static const int PROFILE_CONCAT(profileStage, __LINE__) = Profiler::get().getStage(name); \
+    Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileStage, __LINE__))
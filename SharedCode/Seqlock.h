@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+
+// single writer, many reader latest-value slot. the writer never waits, and
+// readers retry if they raced a write, so a fast producer thread can keep
+// overwriting while the render thread reads whatever is newest in O(1).
+template <class T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied byte by byte");
+    std::atomic<unsigned int> sequence;
+    T value;
+public:
+    Seqlock() : sequence(0), value() {
+    }
+    // only ever call from one thread
+    void store(const T& next) {
+        unsigned int start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value = next;
+        sequence.store(start + 2, std::memory_order_release);
+    }
+    T load() const {
+        T result;
+        read(result);
+        return result;
+    }
+    // even, and increases by 2 with every store
+    unsigned int getSequence() const {
+        return sequence.load(std::memory_order_acquire) & ~1u;
+    }
+    // copies out the value if it changed since lastSequence, and updates lastSequence
+    bool loadIfNewer(T& result, unsigned int& lastSequence) const {
+        if(getSequence() == lastSequence) {
+            return false;
+        }
+        lastSequence = read(result);
+        return true;
+    }
+private:
+    unsigned int read(T& result) const {
+        unsigned int before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            result = value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while((before & 1) || before != after);
+        return before;
+    }
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "ofMain.h"
+#include "UyvyImage.h"
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a ring of video frames in posix shared memory. one capture process publishes
+// each frame once, and any number of local viewers map the ring read only and
+// use the newest frame in place, without copying it or going through the gpu.
+//
+// each slot is stamped with its frame sequence once the pixels are written, and
+// zeroed before they are overwritten. a viewer reads the newest sequence, checks
+// the slot still has it, uses the pixels, then checks again: the writer only
+// gets back to that slot after slotCount - 1 more frames.
+
+enum SharedFrameFormat {
+    SHARED_FRAME_UYVY = 2, // packed 4:2:2 straight from the capture card
+    SHARED_FRAME_RGB = 3,
+    SHARED_FRAME_RGBA = 4
+};
+
+struct SharedFrameInfo {
+    uint64_t sequence; // starts at 1
+    uint64_t timestampMicros; // steady clock, comparable across local processes
+    uint32_t format; // SharedFrameFormat, which is also the bytes per pixel
+    uint32_t width, height;
+    uint32_t stride; // bytes per row
+};
+
+struct SharedFrameSlot {
+    std::atomic<uint64_t> sequence; // 0 while the slot is being written
+    SharedFrameInfo info;
+};
+
+struct SharedFrameRingHeader {
+    static const uint32_t magicNumber = 0x48534652; // HSFR
+    static const uint32_t currentVersion = 1;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotBytes; // pixel bytes per slot
+    std::atomic<uint64_t> latest; // newest complete frame, 0 before the first
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared frame sequences must be lock free to work across processes");
+
+class SharedFrameRing {
+public:
+    static string getDefaultName() {
+        return "/highsight-camera";
+    }
+    static uint64_t getTimestampMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+protected:
+    string name;
+    unsigned char* mapping = nullptr;
+    size_t mappingBytes = 0;
+
+    static size_t getSlotsOffset() {
+        return (sizeof(SharedFrameRingHeader) + 63) & ~(size_t) 63;
+    }
+    static size_t getPixelsOffset(uint32_t slotCount) {
+        return (getSlotsOffset() + slotCount * sizeof(SharedFrameSlot) + 4095) & ~(size_t) 4095;
+    }
+    SharedFrameRingHeader& header() const {
+        return *(SharedFrameRingHeader*) mapping;
+    }
+    SharedFrameSlot& slot(uint64_t sequence) const {
+        SharedFrameSlot* slots = (SharedFrameSlot*) (mapping + getSlotsOffset());
+        return slots[sequence % header().slotCount];
+    }
+    unsigned char* pixels(uint64_t sequence) const {
+        return mapping + getPixelsOffset(header().slotCount) + (sequence % header().slotCount) * (size_t) header().slotBytes;
+    }
+    void unmap() {
+        if(mapping) {
+            munmap(mapping, mappingBytes);
+            mapping = nullptr;
+            mappingBytes = 0;
+        }
+    }
+public:
+    ~SharedFrameRing() {
+        unmap();
+    }
+    bool isMapped() const {
+        return mapping != nullptr;
+    }
+};
+
+// the capture side, only one per ring name
+class SharedFramePublisher : public SharedFrameRing {
+protected:
+    uint64_t sequence = 0;
+    bool writing = false;
+public:
+    ~SharedFramePublisher() {
+        close();
+    }
+    // maxBytes is the largest frame that will be published, slots is how many
+    // frames a viewer has to finish with the newest one before it is overwritten
+    bool setup(string name, size_t maxBytes, int slots = 3) {
+        close();
+        this->name = name;
+        // start a fresh object, so viewers still mapping an old one notice and reopen
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(fd < 0) {
+            ofLogError("SharedFramePublisher") << "can't create " << name << ": " << strerror(errno);
+            return false;
+        }
+        mappingBytes = getPixelsOffset(slots) + slots * maxBytes;
+        if(ftruncate(fd, mappingBytes) != 0) {
+            ofLogError("SharedFramePublisher") << "can't size " << name << ": " << strerror(errno);
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        void* result = mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(result == MAP_FAILED) {
+            ofLogError("SharedFramePublisher") << "can't map " << name << ": " << strerror(errno);
+            mappingBytes = 0;
+            shm_unlink(name.c_str());
+            return false;
+        }
+        mapping = (unsigned char*) result;
+        // ftruncate zero fills, so every slot and latest start out empty
+        SharedFrameRingHeader& ring = header();
+        ring.slotCount = slots;
+        ring.slotBytes = maxBytes;
+        ring.version = SharedFrameRingHeader::currentVersion;
+        std::atomic_thread_fence(std::memory_order_release);
+        ring.magic = SharedFrameRingHeader::magicNumber;
+        sequence = 0;
+        return true;
+    }
+    void close() {
+        if(isMapped()) {
+            unmap();
+            shm_unlink(name.c_str());
+        }
+    }
+    // write straight into the ring: beginFrame(), fill it, then endFrame()
+    unsigned char* beginFrame() {
+        SharedFrameSlot& next = slot(sequence + 1);
+        next.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        writing = true;
+        return pixels(sequence + 1);
+    }
+    void endFrame(SharedFrameFormat format, int width, int height, int stride, uint64_t timestampMicros = 0) {
+        if(!writing) {
+            return;
+        }
+        writing = false;
+        sequence++;
+        SharedFrameSlot& current = slot(sequence);
+        current.info.sequence = sequence;
+        current.info.timestampMicros = timestampMicros ? timestampMicros : getTimestampMicros();
+        current.info.format = format;
+        current.info.width = width;
+        current.info.height = height;
+        current.info.stride = stride;
+        current.sequence.store(sequence, std::memory_order_release);
+        header().latest.store(sequence, std::memory_order_release);
+    }
+    // copies tightly packed pixels in, for sources that don't hand out their buffer
+    bool publish(const unsigned char* data, SharedFrameFormat format, int width, int height, uint64_t timestampMicros = 0) {
+        size_t bytes = (size_t) width * height * format;
+        if(!isMapped() || bytes > header().slotBytes) {
+            return false;
+        }
+        memcpy(beginFrame(), data, bytes);
+        endFrame(format, width, height, width * format, timestampMicros);
+        return true;
+    }
+    bool publish(const ofPixels& pixels, uint64_t timestampMicros = 0) {
+        return publish(pixels.getData(), (SharedFrameFormat) pixels.getNumChannels(), pixels.getWidth(), pixels.getHeight(), timestampMicros);
+    }
+    uint64_t getSequence() const {
+        return sequence;
+    }
+};
+
+// the viewing side, maps the ring read only
+class SharedFrameViewer : public SharedFrameRing {
+protected:
+    SharedFrameInfo info;
+    const unsigned char* data = nullptr;
+    uint64_t lastNewFrame = 0;
+    uint64_t torn = 0, skipped = 0;
+public:
+    float reopenSeconds = 1; // how long without frames before checking for a restarted publisher
+
+    SharedFrameViewer() {
+        memset(&info, 0, sizeof(info));
+    }
+    // succeeds once the publisher has created the ring, call again until it does
+    bool setup(string name) {
+        unmap();
+        this->name = name;
+        data = nullptr;
+        info.sequence = 0;
+        lastNewFrame = getTimestampMicros();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat status;
+        if(fstat(fd, &status) != 0 || status.st_size < (off_t) getPixelsOffset(0)) {
+            ::close(fd);
+            return false;
+        }
+        void* result = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(result == MAP_FAILED) {
+            return false;
+        }
+        mapping = (unsigned char*) result;
+        mappingBytes = status.st_size;
+        const SharedFrameRingHeader& ring = header();
+        if(ring.magic != SharedFrameRingHeader::magicNumber ||
+           ring.version != SharedFrameRingHeader::currentVersion ||
+           ring.slotCount == 0 ||
+           getPixelsOffset(ring.slotCount) + ring.slotCount * (size_t) ring.slotBytes > mappingBytes) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+    // true if there is a newer frame than last time. getPixels() then points
+    // into the ring, and stays good as long as isValid() says so.
+    bool update() {
+        if(getTimestampMicros() - lastNewFrame > reopenSeconds * 1000000) {
+            // not there yet, or quiet long enough that the publisher might have restarted
+            setup(name);
+        }
+        if(!isMapped()) {
+            return false;
+        }
+        uint64_t latest = header().latest.load(std::memory_order_acquire);
+        if(latest == 0 || latest == info.sequence) {
+            return false;
+        }
+        const SharedFrameSlot& current = slot(latest);
+        if(current.sequence.load(std::memory_order_acquire) != latest) {
+            // lapped between reading latest and the slot, catch the next one
+            return false;
+        }
+        SharedFrameInfo next = current.info;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(current.sequence.load(std::memory_order_relaxed) != latest ||
+           (size_t) next.stride * next.height > header().slotBytes) {
+            return false;
+        }
+        if(info.sequence && latest > info.sequence + 1) {
+            skipped += latest - info.sequence - 1;
+        }
+        info = next;
+        data = pixels(latest);
+        lastNewFrame = getTimestampMicros();
+        return true;
+    }
+    // call after using getPixels(), false means the writer lapped us and what was read may be torn
+    bool isValid() const {
+        if(!data) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot(info.sequence).sequence.load(std::memory_order_relaxed) == info.sequence;
+    }
+    // uploads the newest frame if there is one, true if the texture changed.
+    // uyvy goes up unconverted as rgba at half width, for FisheyePanorama::setUyvy().
+    bool update(ofTexture& texture) {
+        if(!update()) {
+            return false;
+        }
+        int glFormat = info.format == SHARED_FRAME_RGB ? GL_RGB : GL_RGBA;
+        int texels = info.format == SHARED_FRAME_UYVY ? info.width / 2 : info.width;
+        int bytesPerTexel = info.format == SHARED_FRAME_UYVY ? 4 : info.format;
+        if(!texture.isAllocated() || texture.getWidth() != texels || texture.getHeight() != info.height) {
+            texture.allocate(texels, info.height, glFormat);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, info.stride / bytesPerTexel);
+        texture.loadData(data, texels, info.height, glFormat);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if(!isValid()) {
+            torn++;
+        }
+        return true;
+    }
+    // the newest frame as rgb at preview size, only converting the pixels that are kept
+    bool update(ofPixels& preview, int width, int height) {
+        if(!update()) {
+            return false;
+        }
+        if(info.format == SHARED_FRAME_UYVY) {
+            getUyvyImage().resizeToRgb(preview, width, height);
+        } else {
+            if(preview.getWidth() != width || preview.getHeight() != height || preview.getNumChannels() != 3) {
+                preview.allocate(width, height, 3);
+            }
+            unsigned char* out = preview.getData();
+            for(int j = 0; j < height; j++) {
+                const unsigned char* row = data + (j * info.height / height) * info.stride;
+                for(int i = 0; i < width; i++) {
+                    const unsigned char* in = row + (i * info.width / width) * info.format;
+                    *out++ = in[0];
+                    *out++ = in[1];
+                    *out++ = in[2];
+                }
+            }
+        }
+        if(!isValid()) {
+            torn++;
+        }
+        return true;
+    }
+    UyvyImage getUyvyImage() const {
+        return UyvyImage(data, info.width, info.height, info.stride);
+    }
+    const unsigned char* getPixels() const {
+        return data;
+    }
+    const SharedFrameInfo& getInfo() const {
+        return info;
+    }
+    // frames the publisher wrote that this viewer never saw
+    uint64_t getSkipped() const {
+        return skipped;
+    }
+    // uploads that were overwritten while being read
+    uint64_t getTorn() const {
+        return torn;
+    }
+};
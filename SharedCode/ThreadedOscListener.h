@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ofMain.h"
+#include "osc/OscPacketListener.h"
+#include "ip/UdpSocket.h"
+#include "Profiler.h"
+
+// receives osc on its own thread and hands each message to ProcessMessage
+// while it still points into the receive buffer. unlike ofxOscReceiver there is
+// no ofxOscMessage copy and no queue for the render thread to drain, so
+// subclasses should parse straight into something like a Seqlock.
+class ThreadedOscListener : public osc::OscPacketListener, public ofThread {
+protected:
+    unique_ptr<UdpListeningReceiveSocket> socket;
+    std::atomic<unsigned int> malformed;
+public:
+    ThreadedOscListener() : malformed(0) {
+    }
+    virtual ~ThreadedOscListener() {
+        stop();
+    }
+    void setup(int port) {
+        stop();
+        socket.reset(new UdpListeningReceiveSocket(IpEndpointName(IpEndpointName::ANY_ADDRESS, port), this));
+        startThread();
+    }
+    void stop() {
+        if(socket) {
+            socket->AsynchronousBreak();
+            waitForThread();
+            socket.reset();
+        }
+    }
+    unsigned int getMalformed() const {
+        return malformed;
+    }
+protected:
+    void threadedFunction() {
+        Profiler::get().setThreadName("osc receive");
+        socket->Run();
+    }
+    void ProcessPacket(const char* data, int size, const IpEndpointName& remoteEndpoint) {
+        PROFILE_SCOPE("osc receive");
+        try {
+            osc::OscPacketListener::ProcessPacket(data, size, remoteEndpoint);
+        } catch(osc::Exception& e) {
+            // a bad packet shouldn't take the receive thread down with it
+            malformed++;
+        }
+    }
+    static string getRemoteIp(const IpEndpointName& remoteEndpoint) {
+        char address[IpEndpointName::ADDRESS_STRING_LENGTH];
+        remoteEndpoint.AddressAsString(address);
+        return address;
+    }
+    static string argToString(const osc::ReceivedMessageArgument& arg) {
+        if(arg.IsString()) return arg.AsStringUnchecked();
+        if(arg.IsInt32()) return ofToString(arg.AsInt32Unchecked());
+        if(arg.IsFloat()) return ofToString(arg.AsFloatUnchecked());
+        if(arg.IsInt64()) return ofToString(arg.AsInt64Unchecked());
+        if(arg.IsDouble()) return ofToString(arg.AsDoubleUnchecked());
+        return "";
+    }
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "ofMain.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// a view of packed 4:2:2 video as it comes off the capture card: U Y0 V Y1 for
+// every pair of pixels, bt.709 limited range. luma is full resolution, chroma
+// is half resolution horizontally and sited on the even pixels. sampling stays
+// in yuv, and convertRow() turns just the pixels that are kept into rgb.
+class UyvyImage {
+public:
+    const unsigned char* data = nullptr;
+    int width = 0, height = 0;
+    int stride = 0; // bytes per row
+
+    UyvyImage() {
+    }
+    UyvyImage(const unsigned char* data, int width, int height, int stride = 0)
+    : data(data), width(width), height(height), stride(stride ? stride : width * 2) {
+    }
+    int getWidth() const {
+        return width;
+    }
+    int getHeight() const {
+        return height;
+    }
+    unsigned char getLuma(int x, int y) const {
+        return data[y * stride + x * 2 + 1];
+    }
+    static int clamp(int i, int max) {
+        return i < 0 ? 0 : i > max ? max : i;
+    }
+    // chroma pair k covers pixels 2k and 2k + 1
+    unsigned char getU(int k, int y) const {
+        return data[y * stride + k * 4];
+    }
+    unsigned char getV(int k, int y) const {
+        return data[y * stride + k * 4 + 2];
+    }
+    // bilinear at x, y in pixels, with pixel centers on the integers. clamps to the edge.
+    void sampleBilinear(float x, float y, float& luma, float& u, float& v) const {
+        int y0 = floor(y);
+        float fy = y - y0;
+        const unsigned char* row0 = data + clamp(y0, height - 1) * stride;
+        const unsigned char* row1 = data + clamp(y0 + 1, height - 1) * stride;
+
+        int x0 = floor(x);
+        float fx = x - x0;
+        int x1 = clamp(x0 + 1, width - 1) * 2 + 1;
+        x0 = clamp(x0, width - 1) * 2 + 1;
+        float top = row0[x0] + (row0[x1] - row0[x0]) * fx;
+        float bottom = row1[x0] + (row1[x1] - row1[x0]) * fx;
+        luma = top + (bottom - top) * fy;
+
+        float cx = x / 2;
+        int k0 = floor(cx);
+        float fk = cx - k0;
+        int k1 = clamp(k0 + 1, width / 2 - 1) * 4;
+        k0 = clamp(k0, width / 2 - 1) * 4;
+        top = row0[k0] + (row0[k1] - row0[k0]) * fk;
+        bottom = row1[k0] + (row1[k1] - row1[k0]) * fk;
+        u = top + (bottom - top) * fy;
+        top = row0[k0 + 2] + (row0[k1 + 2] - row0[k0 + 2]) * fk;
+        bottom = row1[k0 + 2] + (row1[k1 + 2] - row1[k0 + 2]) * fk;
+        v = top + (bottom - top) * fy;
+    }
+    // nearest neighbour rgb copy at any size, for previews
+    void resizeToRgb(ofPixels& rgb, int outWidth, int outHeight) const {
+        if(rgb.getWidth() != outWidth || rgb.getHeight() != outHeight || rgb.getNumChannels() != 3) {
+            rgb.allocate(outWidth, outHeight, 3);
+        }
+        vector<float> luma(outWidth), u(outWidth), v(outWidth);
+        for(int j = 0; j < outHeight; j++) {
+            int y = (j * height) / outHeight;
+            for(int i = 0; i < outWidth; i++) {
+                int x = (i * width) / outWidth;
+                luma[i] = getLuma(x, y);
+                u[i] = getU(x / 2, y);
+                v[i] = getV(x / 2, y);
+            }
+            convertRow(luma.data(), u.data(), v.data(), rgb.getData() + j * outWidth * 3, outWidth);
+        }
+    }
+
+    // bt.709 limited range to rgb, n pixels into packed rgb
+    static void convertRow(const float* luma, const float* u, const float* v, unsigned char* rgb, int n) {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128 lumaOffset = _mm_set1_ps(16), chromaOffset = _mm_set1_ps(128);
+        const __m128 lumaScale = _mm_set1_ps(1.1644f);
+        const __m128 rv = _mm_set1_ps(1.7927f), gu = _mm_set1_ps(-0.2132f), gv = _mm_set1_ps(-0.5329f), bu = _mm_set1_ps(2.1124f);
+        for(; i + 4 <= n; i += 4) {
+            __m128 yy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(luma + i), lumaOffset), lumaScale);
+            __m128 uu = _mm_sub_ps(_mm_loadu_ps(u + i), chromaOffset);
+            __m128 vv = _mm_sub_ps(_mm_loadu_ps(v + i), chromaOffset);
+            __m128 r = _mm_add_ps(yy, _mm_mul_ps(rv, vv));
+            __m128 g = _mm_add_ps(yy, _mm_add_ps(_mm_mul_ps(gu, uu), _mm_mul_ps(gv, vv)));
+            __m128 b = _mm_add_ps(yy, _mm_mul_ps(bu, uu));
+            // round, then saturate down to bytes: r0-3 g0-3 b0-3 in one register
+            __m128i rg = _mm_packs_epi32(_mm_cvtps_epi32(r), _mm_cvtps_epi32(g));
+            __m128i bb = _mm_packs_epi32(_mm_cvtps_epi32(b), _mm_setzero_si128());
+            unsigned char bytes[16];
+            _mm_storeu_si128((__m128i*) bytes, _mm_packus_epi16(rg, bb));
+            unsigned char* out = rgb + i * 3;
+            for(int k = 0; k < 4; k++) {
+                *out++ = bytes[k];
+                *out++ = bytes[4 + k];
+                *out++ = bytes[8 + k];
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t lumaOffset = vdupq_n_f32(16), chromaOffset = vdupq_n_f32(128);
+        for(; i + 4 <= n; i += 4) {
+            float32x4_t yy = vmulq_n_f32(vsubq_f32(vld1q_f32(luma + i), lumaOffset), 1.1644f);
+            float32x4_t uu = vsubq_f32(vld1q_f32(u + i), chromaOffset);
+            float32x4_t vv = vsubq_f32(vld1q_f32(v + i), chromaOffset);
+            float32x4_t r = vmlaq_n_f32(yy, vv, 1.7927f);
+            float32x4_t g = vmlaq_n_f32(vmlaq_n_f32(yy, uu, -0.2132f), vv, -0.5329f);
+            float32x4_t b = vmlaq_n_f32(yy, uu, 2.1124f);
+            uint16x4_t r16 = vqmovun_s32(vcvtnq_s32_f32(r));
+            uint16x4_t g16 = vqmovun_s32(vcvtnq_s32_f32(g));
+            uint16x4_t b16 = vqmovun_s32(vcvtnq_s32_f32(b));
+            uint8x8_t rg8 = vqmovn_u16(vcombine_u16(r16, g16));
+            uint8x8_t bb8 = vqmovn_u16(vcombine_u16(b16, b16));
+            unsigned char bytes[16];
+            vst1_u8(bytes, rg8);
+            vst1_u8(bytes + 8, bb8);
+            unsigned char* out = rgb + i * 3;
+            for(int k = 0; k < 4; k++) {
+                *out++ = bytes[k];
+                *out++ = bytes[4 + k];
+                *out++ = bytes[8 + k];
+            }
+        }
+#endif
+        for(; i < n; i++) {
+            float yy = (luma[i] - 16) * 1.1644f;
+            float uu = u[i] - 128, vv = v[i] - 128;
+            unsigned char* out = rgb + i * 3;
+            out[0] = ofClamp(nearbyintf(yy + 1.7927f * vv), 0, 255);
+            out[1] = ofClamp(nearbyintf(yy - 0.2132f * uu - 0.5329f * vv), 0, 255);
+            out[2] = ofClamp(nearbyintf(yy + 2.1124f * uu), 0, 255);
+        }
+    }
+};
@@ -0,0 +1,82 @@
+// checks FisheyePanorama's cpu unwrap without a headset, camera or window:
+// draws a smooth synthetic fisheye frame, unwraps it and compares every
+// reprojected direction against a direct lookup with FisheyePanorama::verify().
+//
+// build: g++ -O2 -std=c++11 -Imock -I.. fisheye_verify.cpp -o fisheye_verify
+// run:   ./fisheye_verify [-radius px] [-fov degrees] [-waves n] [-steps n] [-limit levels] [-benchmark]
+//
+// exits 1 if the mean error is over -limit, 1 level by default. -waves sets
+// how many cycles the pattern has around the circle, more is less smooth.
+// -benchmark also times the full and view dependent unwraps of the frame.
+
+#include "ofMain.h"
+#include "FisheyePanorama.h"
+
+// a different smooth pattern in each channel: rings, spokes and a diagonal
+// gradient, black outside the circle like the real camera
+void drawSyntheticFrame(const Fisheye& fisheye, ofPixels& frame, int waves) {
+    frame.allocate(fisheye.width, fisheye.height, 3);
+    unsigned char* out = frame.getData();
+    for(int y = 0; y < frame.getHeight(); y++) {
+        for(int x = 0; x < frame.getWidth(); x++) {
+            ofVec2f position = ofVec2f(x + .5, y + .5) - fisheye.offset;
+            float r = position.length() / fisheye.radius;
+            float theta = atan2(position.y, position.x);
+            if(r > 1) {
+                out[0] = out[1] = out[2] = 0;
+            } else {
+                out[0] = 127.5 + 127.5 * cos(r * waves * PI);
+                out[1] = 127.5 + 127.5 * sin(theta * waves);
+                out[2] = ofMap(x + y, 0, frame.getWidth() + frame.getHeight(), 0, 255);
+            }
+            out += 3;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    Fisheye fisheye;
+    int waves = 8, steps = 64;
+    float limit = 1;
+    bool benchmark = false;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "-radius" && hasValue) {
+            fisheye.radius = atof(argv[++i]);
+        } else if(arg == "-fov" && hasValue) {
+            fisheye.fov = atof(argv[++i]);
+        } else if(arg == "-waves" && hasValue) {
+            waves = atoi(argv[++i]);
+        } else if(arg == "-steps" && hasValue) {
+            steps = atoi(argv[++i]);
+        } else if(arg == "-limit" && hasValue) {
+            limit = atof(argv[++i]);
+        } else if(arg == "-benchmark") {
+            benchmark = true;
+        } else {
+            cerr << "usage: " << argv[0] << " [-radius px] [-fov degrees] [-waves n] [-steps n] [-limit levels] [-benchmark]" << endl;
+            return 2;
+        }
+    }
+    fisheye.setup();
+    ofPixels frame;
+    drawSyntheticFrame(fisheye, frame, waves);
+
+    float maxError;
+    float meanError = FisheyePanorama::verify(fisheye, frame, maxError, steps);
+    cout << "panorama reprojection error over " << steps << "x" << steps << " directions: " <<
+        ofToString(meanError, 3) << " mean, " << ofToString(maxError, 3) << " max" << endl;
+
+    if(benchmark) {
+        FisheyePanorama panorama;
+        panorama.setup(fisheye);
+        panorama.benchmark(fisheye, frame);
+    }
+
+    if(meanError > limit) {
+        cout << "failed, mean error is over " << limit << endl;
+        return 1;
+    }
+    return 0;
+}
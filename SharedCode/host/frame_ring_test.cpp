@@ -0,0 +1,177 @@
+// runs a synthetic publisher and a viewer of SharedFrameRing.h in two
+// processes, the way UnwrapLive and the headset share camera frames, and
+// checks what the viewer sees:
+//
+// - steady: frames at a camera like rate, every one should arrive whole and
+//   in order, with none flagged and none skipped
+// - flood: frames as fast as they can be written while the viewer reads
+//   each one slowly, so the writer laps it. every read that doesn't match
+//   the frame it claims to be has to have been flagged by isValid()
+//
+// and after each run, that the publisher unlinked the ring when it exited.
+//
+// build: g++ -O2 -std=c++11 -Imock -I.. frame_ring_test.cpp -o frame_ring_test -lrt
+// run:   ./frame_ring_test [-width px] [-height px] [-slots n] [-frames n] [-fps n]
+//
+// exits 1 if any check fails.
+
+#include "ofMain.h"
+#include "SharedFrameRing.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+int width = 640, height = 360, slots = 3, frames = 300;
+float fps = 60;
+
+// every byte of a row is the same, and differs from the rows of the frames
+// that will overwrite this one
+unsigned char getPattern(uint64_t sequence, int y) {
+    return (sequence * 13 + y) & 0xff;
+}
+
+// the child process, publishes frames then exits, which unlinks the ring
+void publish(string name, float fps) {
+    SharedFramePublisher publisher;
+    if(!publisher.setup(name, width * height * 3, slots)) {
+        _exit(1);
+    }
+    uint64_t start = SharedFrameRing::getTimestampMicros();
+    for(int i = 0; i < frames; i++) {
+        if(fps > 0) {
+            uint64_t due = start + i * 1000000 / fps;
+            uint64_t now = SharedFrameRing::getTimestampMicros();
+            if(due > now) {
+                usleep(due - now);
+            }
+        }
+        unsigned char* pixels = publisher.beginFrame();
+        for(int y = 0; y < height; y++) {
+            memset(pixels + y * width * 3, getPattern(publisher.getSequence() + 1, y), width * 3);
+        }
+        publisher.endFrame(SHARED_FRAME_RGB, width, height, width * 3);
+    }
+    publisher.close();
+    _exit(0);
+}
+
+struct Results {
+    int reads = 0, flagged = 0, flaggedTorn = 0, unflaggedTorn = 0, outOfOrder = 0;
+    uint64_t last = 0, skipped = 0;
+};
+
+// true if the frame is what its sequence says, optionally pausing between
+// rows so a fast publisher gets a chance to overwrite it
+bool isWhole(const SharedFrameViewer& viewer, bool slow) {
+    const SharedFrameInfo& info = viewer.getInfo();
+    const unsigned char* pixels = viewer.getPixels();
+    bool whole = (int) info.width == width && (int) info.height == height && info.format == SHARED_FRAME_RGB;
+    for(int y = 0; whole && y < height; y++) {
+        const unsigned char* row = pixels + y * info.stride;
+        unsigned char expected = getPattern(info.sequence, y);
+        for(int x = 0; x < width * 3; x++) {
+            if(row[x] != expected) {
+                whole = false;
+                break;
+            }
+        }
+        if(slow && y % 16 == 0) {
+            usleep(20);
+        }
+    }
+    return whole;
+}
+
+bool run(string label, float fps, bool slowViewer) {
+    string name = "/highsight-test-" + ofToString(getpid());
+    pid_t child = fork();
+    if(child == 0) {
+        publish(name, fps);
+    }
+    SharedFrameViewer viewer;
+    Results results;
+    bool publisherRunning = true;
+    int status = 0;
+    while(true) {
+        if(publisherRunning && waitpid(child, &status, WNOHANG) == child) {
+            publisherRunning = false;
+        }
+        if(!viewer.isMapped() && !viewer.setup(name)) {
+            if(!publisherRunning) {
+                break;
+            }
+            usleep(100);
+            continue;
+        }
+        if(viewer.update()) {
+            const SharedFrameInfo& info = viewer.getInfo();
+            results.reads++;
+            if(info.sequence <= results.last) {
+                results.outOfOrder++;
+            }
+            results.last = info.sequence;
+            bool whole = isWhole(viewer, slowViewer);
+            if(!viewer.isValid()) {
+                results.flagged++;
+                results.flaggedTorn += !whole;
+            } else if(!whole) {
+                results.unflaggedTorn++;
+            }
+        } else if(!publisherRunning) {
+            // nothing newer is coming
+            break;
+        } else {
+            usleep(200);
+        }
+    }
+    results.skipped = viewer.getSkipped();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    bool unlinked = fd < 0 && errno == ENOENT;
+    if(fd >= 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+    }
+
+    bool published = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    cout << label << ": " << frames << " frames of " << width << "x" << height << " rgb in " << slots << " slots, " <<
+        results.reads << " read, " << results.skipped << " skipped, " <<
+        results.flagged << " flagged (" << results.flaggedTorn << " of them torn), " <<
+        results.unflaggedTorn << " torn but not flagged, " << results.outOfOrder << " out of order, " <<
+        "last " << results.last << ", ring " << (unlinked ? "unlinked" : "still there") << endl;
+
+    bool ok = published && unlinked && results.unflaggedTorn == 0 && results.outOfOrder == 0 && results.last == (uint64_t) frames;
+    if(!slowViewer) {
+        // at a camera rate the viewer should see everything, untouched
+        ok = ok && results.flagged == 0 && results.skipped == 0 && results.reads == frames;
+    } else if(results.flagged == 0) {
+        cout << label << ": the publisher never lapped the viewer, try more -frames" << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "-width" && hasValue) {
+            width = atoi(argv[++i]);
+        } else if(arg == "-height" && hasValue) {
+            height = atoi(argv[++i]);
+        } else if(arg == "-slots" && hasValue) {
+            slots = atoi(argv[++i]);
+        } else if(arg == "-frames" && hasValue) {
+            frames = atoi(argv[++i]);
+        } else if(arg == "-fps" && hasValue) {
+            fps = atof(argv[++i]);
+        } else {
+            cerr << "usage: " << argv[0] << " [-width px] [-height px] [-slots n] [-frames n] [-fps n]" << endl;
+            return 2;
+        }
+    }
+    bool ok = run("steady", fps, false);
+    ok = run("flood", 0, true) && ok;
+    cout << (ok ? "passed" : "failed") << endl;
+    return ok ? 0 : 1;
+}
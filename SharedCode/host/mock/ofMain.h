@@ -0,0 +1,295 @@
+#pragma once
+
+// just enough of openFrameworks for the SharedCode headers to build as plain
+// command line programs on a desktop, with no window or gl. the math and the
+// pixels are real, drawing and textures do nothing.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+using namespace std;
+
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif
+#ifndef TWO_PI
+#define TWO_PI 6.28318530717958647693
+#endif
+#ifndef HALF_PI
+#define HALF_PI 1.57079632679489661923
+#endif
+#define DEG_TO_RAD (PI / 180.0)
+#define RAD_TO_DEG (180.0 / PI)
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#define GL_RGB 0x1907
+#define GL_RGBA 0x1908
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+inline void glPixelStorei(int, int) {}
+
+enum {
+    OF_KEY_LEFT = 356,
+    OF_KEY_UP,
+    OF_KEY_RIGHT,
+    OF_KEY_DOWN
+};
+
+inline float ofClamp(float value, float min, float max) {
+    return value < min ? min : value > max ? max : value;
+}
+inline float ofMap(float value, float inputMin, float inputMax, float outputMin, float outputMax, bool clamp = false) {
+    float result = outputMin + (value - inputMin) / (inputMax - inputMin) * (outputMax - outputMin);
+    return clamp ? ofClamp(result, MIN(outputMin, outputMax), MAX(outputMin, outputMax)) : result;
+}
+inline float ofLerp(float start, float stop, float amount) {
+    return start + (stop - start) * amount;
+}
+inline float ofGetElapsedTimef() {
+    static chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    return chrono::duration<float>(chrono::steady_clock::now() - start).count();
+}
+template <class T>
+string ofToString(const T& value) {
+    ostringstream out;
+    out << value;
+    return out.str();
+}
+template <class T>
+string ofToString(const T& value, int precision) {
+    ostringstream out;
+    out << fixed << setprecision(precision) << value;
+    return out.str();
+}
+
+// a line to stderr, with the module in front like ofLog does
+class ofLog {
+protected:
+    ostringstream line;
+public:
+    ofLog() {}
+    ofLog(const string& module) {
+        line << "[" << module << "] ";
+    }
+    ~ofLog() {
+        cerr << line.str() << endl;
+    }
+    template <class T>
+    ofLog& operator<<(const T& value) {
+        line << value;
+        return *this;
+    }
+};
+class ofLogVerbose : public ofLog { public: ofLogVerbose(const string& module = "") : ofLog(module) {} };
+class ofLogNotice : public ofLog { public: ofLogNotice(const string& module = "") : ofLog(module) {} };
+class ofLogWarning : public ofLog { public: ofLogWarning(const string& module = "") : ofLog(module) {} };
+class ofLogError : public ofLog { public: ofLogError(const string& module = "") : ofLog(module) {} };
+
+class ofVec2f {
+public:
+    float x = 0, y = 0;
+    ofVec2f() {}
+    ofVec2f(float x, float y) : x(x), y(y) {}
+    void set(float x, float y) {
+        this->x = x;
+        this->y = y;
+    }
+    ofVec2f operator+(const ofVec2f& v) const { return ofVec2f(x + v.x, y + v.y); }
+    ofVec2f operator-(const ofVec2f& v) const { return ofVec2f(x - v.x, y - v.y); }
+    ofVec2f operator*(float f) const { return ofVec2f(x * f, y * f); }
+    ofVec2f operator/(float f) const { return ofVec2f(x / f, y / f); }
+    ofVec2f& operator+=(const ofVec2f& v) { x += v.x; y += v.y; return *this; }
+    ofVec2f& operator-=(const ofVec2f& v) { x -= v.x; y -= v.y; return *this; }
+    ofVec2f& operator*=(float f) { x *= f; y *= f; return *this; }
+    float length() const { return sqrt(x * x + y * y); }
+    float distance(const ofVec2f& v) const { return (*this - v).length(); }
+};
+inline ostream& operator<<(ostream& out, const ofVec2f& v) {
+    return out << v.x << ", " << v.y;
+}
+
+class ofVec3f {
+public:
+    float x = 0, y = 0, z = 0;
+    ofVec3f() {}
+    ofVec3f(float x, float y, float z = 0) : x(x), y(y), z(z) {}
+    ofVec3f(const ofVec2f& v) : x(v.x), y(v.y) {}
+    void set(float x, float y, float z) {
+        this->x = x;
+        this->y = y;
+        this->z = z;
+    }
+    ofVec3f operator+(const ofVec3f& v) const { return ofVec3f(x + v.x, y + v.y, z + v.z); }
+    ofVec3f operator-(const ofVec3f& v) const { return ofVec3f(x - v.x, y - v.y, z - v.z); }
+    ofVec3f operator-() const { return ofVec3f(-x, -y, -z); }
+    ofVec3f operator*(float f) const { return ofVec3f(x * f, y * f, z * f); }
+    ofVec3f operator/(float f) const { return ofVec3f(x / f, y / f, z / f); }
+    ofVec3f& operator+=(const ofVec3f& v) { x += v.x; y += v.y; z += v.z; return *this; }
+    ofVec3f& operator-=(const ofVec3f& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    ofVec3f& operator*=(float f) { x *= f; y *= f; z *= f; return *this; }
+    float length() const { return sqrt(x * x + y * y + z * z); }
+    float distance(const ofVec3f& v) const { return (*this - v).length(); }
+    float dot(const ofVec3f& v) const { return x * v.x + y * v.y + z * v.z; }
+    ofVec3f getCrossed(const ofVec3f& v) const { return ofVec3f(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x); }
+    ofVec3f getNormalized() const {
+        float l = length();
+        return l > 0 ? *this / l : *this;
+    }
+    ofVec3f& normalize() {
+        return *this = getNormalized();
+    }
+    // degrees about an axis, right handed like ofVec3f
+    ofVec3f getRotated(float angle, const ofVec3f& axis) const {
+        ofVec3f k = axis.getNormalized();
+        float c = cos(angle * DEG_TO_RAD), s = sin(angle * DEG_TO_RAD);
+        return *this * c + k.getCrossed(*this) * s + k * (k.dot(*this) * (1 - c));
+    }
+    ofVec3f& rotate(float angle, const ofVec3f& axis) {
+        return *this = getRotated(angle, axis);
+    }
+};
+inline ostream& operator<<(ostream& out, const ofVec3f& v) {
+    return out << v.x << ", " << v.y << ", " << v.z;
+}
+
+class ofColor {
+public:
+    static const ofColor white, black;
+    unsigned char r = 0, g = 0, b = 0, a = 255;
+    ofColor() {}
+    ofColor(int gray, int alpha = 255) : r(gray), g(gray), b(gray), a(alpha) {}
+    ofColor(int r, int g, int b, int a = 255) : r(r), g(g), b(b), a(a) {}
+};
+const ofColor ofColor::white(255), ofColor::black(0);
+
+// always 8 bit, packed rows
+class ofPixels {
+protected:
+    vector<unsigned char> data;
+    int width = 0, height = 0, channels = 0;
+public:
+    void allocate(int width, int height, int channels) {
+        this->width = width;
+        this->height = height;
+        this->channels = channels;
+        data.assign((size_t) width * height * channels, 0);
+    }
+    void setFromPixels(const unsigned char* pixels, int width, int height, int channels) {
+        allocate(width, height, channels);
+        memcpy(data.data(), pixels, data.size());
+    }
+    unsigned char* getData() { return data.data(); }
+    const unsigned char* getData() const { return data.data(); }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getNumChannels() const { return channels; }
+    bool isAllocated() const { return !data.empty(); }
+    size_t size() const { return data.size(); }
+};
+
+class ofTexture {
+protected:
+    float width = 0, height = 0;
+public:
+    void allocate(int width, int height, int) {
+        this->width = width;
+        this->height = height;
+    }
+    bool isAllocated() const { return width > 0; }
+    float getWidth() const { return width; }
+    float getHeight() const { return height; }
+    void loadData(const unsigned char*, int, int, int) {}
+    void loadData(const ofPixels&) {}
+    void bind() {}
+    void unbind() {}
+    void draw(float, float) {}
+    void draw(float, float, float, float) {}
+};
+
+enum ofPrimitiveMode {
+    OF_PRIMITIVE_TRIANGLES,
+    OF_PRIMITIVE_TRIANGLE_STRIP
+};
+
+class ofMesh {
+public:
+    vector<ofVec3f> vertices;
+    vector<ofVec2f> texCoords;
+    vector<unsigned int> indices;
+    void setMode(ofPrimitiveMode) {}
+    void addVertex(const ofVec3f& v) { vertices.push_back(v); }
+    void addTexCoord(const ofVec2f& t) { texCoords.push_back(t); }
+    void addTriangle(unsigned int a, unsigned int b, unsigned int c) {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+    void setVertex(int i, const ofVec3f& v) { vertices[i] = v; }
+    void setTexCoord(int i, const ofVec2f& t) { texCoords[i] = t; }
+    int getNumVertices() const { return vertices.size(); }
+    void draw() {}
+    void drawFaces() {}
+    void drawWireframe() {}
+};
+
+// columns x rows vertices, which is all Fisheye uses it for
+class ofPlanePrimitive {
+protected:
+    int columns, rows;
+public:
+    ofPlanePrimitive(float, float, int columns, int rows) : columns(columns), rows(rows) {}
+    ofMesh getMesh() const {
+        ofMesh mesh;
+        mesh.vertices.resize(columns * rows);
+        mesh.texCoords.resize(columns * rows);
+        return mesh;
+    }
+};
+
+class ofFbo {
+protected:
+    ofTexture texture;
+public:
+    void allocate(int width, int height, int format = GL_RGBA) { texture.allocate(width, height, format); }
+    bool isAllocated() const { return texture.isAllocated(); }
+    ofTexture& getTexture() { return texture; }
+    void begin() {}
+    void end() {}
+    void draw(float, float) {}
+};
+
+class ofShader {
+public:
+    bool isLoaded() const { return false; }
+    bool setupShaderFromSource(int, const string&) { return false; }
+    void bindDefaults() {}
+    bool linkProgram() { return false; }
+    void begin() {}
+    void end() {}
+    void setUniformTexture(const string&, const ofTexture&, int) {}
+};
+
+inline void ofPushStyle() {}
+inline void ofPopStyle() {}
+inline void ofPushMatrix() {}
+inline void ofPopMatrix() {}
+inline void ofSetColor(const ofColor&) {}
+inline void ofSetColor(int, int = 255, int = 255, int = 255) {}
+inline void ofRotateX(float) {}
+inline void ofRotateY(float) {}
+inline void ofRotateZ(float) {}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Rig.h"
+
+// scales eye velocity so that no cable goes faster or accelerates harder than
+// the winches allow. cable speeds are J * v where each row of the Nx3 jacobian
+// J is the unit vector from a pillar to its eye attach point. the speed limit
+// is checked at the current pose and a few ticks ahead along the same velocity,
+// so we start slowing down before a cable hits its limit instead of after.
+class CableLimiter {
+public:
+    float maxSpeedCps = 30;
+    float maxAccelCps2 = 100;
+    int lookaheadTicks = 4;
+    
+    ofVec3f previousVelocity;
+    float speedScale = 1, accelScale = 1;
+    
+    void setup(ofXml& config, string address = "") {
+        maxSpeedCps = config.getFloatValue(address + "maxSpeed");
+        maxAccelCps2 = config.getFloatValue(address + "maxAccel");
+        lookaheadTicks = config.getIntValue(address + "lookaheadTicks");
+    }
+    void reset() {
+        previousVelocity = ofVec3f();
+        speedScale = 1;
+        accelScale = 1;
+    }
+    float getMaxCableSpeed(const Rig& rig, ofVec3f eyePosition, ofVec3f velocity) const {
+        float maxCableSpeed = 0;
+        for(int i = 0; i < rig.size(); i++) {
+            float cableSpeed = fabsf(rig.getJacobian(i, eyePosition).dot(velocity));
+            maxCableSpeed = MAX(maxCableSpeed, cableSpeed);
+        }
+        return maxCableSpeed;
+    }
+    // the fastest the eye can go in this direction before some cable is at maxSpeed
+    float getMaxEyeSpeed(const Rig& rig, ofVec3f eyePosition, ofVec3f direction) const {
+        float cableSpeed = getMaxCableSpeed(rig, eyePosition, direction.getNormalized());
+        return cableSpeed > 0 ? maxSpeedCps / cableSpeed : numeric_limits<float>::max();
+    }
+    // velocity in cm/s, dt in seconds. returns the velocity to actually use.
+    ofVec3f limit(const Rig& rig, ofVec3f eyePosition, ofVec3f velocity, float dt) {
+        // speed: worst cable over the lookahead window
+        speedScale = 1;
+        for(int tick = 0; tick <= lookaheadTicks; tick++) {
+            ofVec3f position = eyePosition + velocity * (tick * dt);
+            float cableSpeed = getMaxCableSpeed(rig, position, velocity);
+            if(cableSpeed * speedScale > maxSpeedCps) {
+                speedScale = maxSpeedCps / cableSpeed;
+            }
+        }
+        velocity *= speedScale;
+        
+        // acceleration: move from the previous velocity towards the new one only
+        // as far as the hardest pulled cable allows this tick
+        ofVec3f change = velocity - previousVelocity;
+        float cableChange = getMaxCableSpeed(rig, eyePosition, change);
+        float maxCableChange = maxAccelCps2 * dt;
+        accelScale = 1;
+        if(cableChange > maxCableChange) {
+            accelScale = maxCableChange / cableChange;
+        }
+        return previousVelocity + change * accelScale;
+    }
+    // call with the velocity that was actually applied after clamping
+    void setPreviousVelocity(ofVec3f velocity) {
+        previousVelocity = velocity;
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "ofMain.h"
+
+// tracks the cm -> encoder units calibration of one motor while it runs.
+// whenever the motor has settled on its commanded length, the reported encoder
+// position is fed into a two parameter recursive least squares fit of
+//   units = slope * (cm - refPointCm) + offset
+// where slope = -unitsPerCm and offset = refPointUnits, same as Motor::cmToUnits.
+// each sample is O(1). a sudden jump in the residual is reported as slip,
+// a slow walk of the fitted offset away from config.xml is reported as drift.
+// slip clears after a run of good samples and drift once the fit walks back,
+// so one bad stretch doesn't hold the rig forever. this only watches, the fit
+// is not fed back into Rig's unitsPerCm or refPointUnits.
+class CalibrationTracker {
+public:
+    static float forgetting; // rls forgetting factor, close to 1
+    static float stillSpeedCps; // below this commanded and reported speed we trust the sample
+    static float slipThresholdCm; // residual that counts as slip
+    static int slipSamples; // consecutive slipping samples before raising the alarm
+    static int slipClearSamples; // consecutive good samples before clearing it again
+    static float driftThresholdCm; // fitted offset change that counts as drift
+    static float maxCovariance; // keeps the covariance from winding up while the eye hovers
+
+    float refPointCm = 0;
+    float unitsPerCmSetup = 0, refPointUnitsSetup = 0;
+    float theta[2]; // slope, offset
+    float P[2][2];
+    float residualCm = 0;
+    int samples = 0;
+    int slipCount = 0, goodCount = 0;
+    bool slip = false, drift = false;
+
+    void setup(float unitsPerCm, float refPointCm, float refPointUnits) {
+        this->refPointCm = refPointCm;
+        unitsPerCmSetup = unitsPerCm;
+        refPointUnitsSetup = refPointUnits;
+        reset();
+    }
+    void reset() {
+        theta[0] = -unitsPerCmSetup;
+        theta[1] = refPointUnitsSetup;
+        // trust the configured offset less than the configured slope
+        P[0][0] = 1, P[0][1] = 0;
+        P[1][0] = 0, P[1][1] = 100 * 100;
+        residualCm = 0;
+        samples = 0;
+        slipCount = 0;
+        goodCount = 0;
+        slip = false;
+        drift = false;
+    }
+    // a fit saved before a restart, the alarms start over
+    void restore(const float theta[2], const float P[2][2], int samples) {
+        reset();
+        this->theta[0] = theta[0];
+        this->theta[1] = theta[1];
+        memcpy(this->P, P, sizeof(this->P));
+        this->samples = samples;
+    }
+    // returns true if this sample raised a new alarm
+    bool update(float commandedCm, float commandedSpeedCps, float reportedUnits, float reportedSpeedCps) {
+        if(fabsf(commandedSpeedCps) > stillSpeedCps || fabsf(reportedSpeedCps) > stillSpeedCps) {
+            return false;
+        }
+        bool alarmBefore = getAlarm();
+        float x0 = commandedCm - refPointCm, x1 = 1;
+        float predicted = theta[0] * x0 + theta[1] * x1;
+        float error = reportedUnits - predicted;
+        residualCm = error / getUnitsPerCm();
+
+        if(samples > 0 && fabsf(residualCm) > slipThresholdCm) {
+            // don't let a slipping cable drag the fit along with it
+            goodCount = 0;
+            if(++slipCount >= slipSamples) {
+                slip = true;
+            }
+            return getAlarm() && !alarmBefore;
+        }
+        slipCount = 0;
+        if(slip && ++goodCount >= slipClearSamples) {
+            slip = false;
+            goodCount = 0;
+        }
+
+        // k = P x / (lambda + x' P x)
+        float Px0 = P[0][0] * x0 + P[0][1] * x1;
+        float Px1 = P[1][0] * x0 + P[1][1] * x1;
+        float denominator = forgetting + x0 * Px0 + x1 * Px1;
+        float k0 = Px0 / denominator, k1 = Px1 / denominator;
+        theta[0] += k0 * error;
+        theta[1] += k1 * error;
+        // P = (P - k x' P) / lambda
+        float P00 = (P[0][0] - k0 * Px0) / forgetting;
+        float P01 = (P[0][1] - k0 * Px1) / forgetting;
+        float P11 = (P[1][1] - k1 * Px1) / forgetting;
+        float trace = P00 + P11;
+        if(trace > maxCovariance) {
+            float scale = maxCovariance / trace;
+            P00 *= scale, P01 *= scale, P11 *= scale;
+        }
+        P[0][0] = P00, P[0][1] = P01;
+        P[1][0] = P01, P[1][1] = P11;
+        samples++;
+
+        drift = fabsf(getDriftCm()) > driftThresholdCm;
+        return getAlarm() && !alarmBefore;
+    }
+    float getUnitsPerCm() const {
+        return -theta[0];
+    }
+    float getRefPointUnits() const {
+        return theta[1];
+    }
+    // how far the fitted zero has moved from config.xml, in cm of cable
+    float getDriftCm() const {
+        return (getRefPointUnits() - refPointUnitsSetup) / unitsPerCmSetup;
+    }
+    bool getAlarm() const {
+        return slip || drift;
+    }
+    string getDescription() const {
+        string description = "  fit: " + ofToString(getUnitsPerCm(), 2) + " units/cm, " +
+            ofToString(getDriftCm(), 1) + "cm drift (" + ofToString(samples) + ")";
+        if(slip) {
+            description += " SLIP";
+        }
+        if(drift) {
+            description += " DRIFT";
+        }
+        return description;
+    }
+};
+
+float CalibrationTracker::forgetting = 0.999;
+float CalibrationTracker::stillSpeedCps = 0.5;
+float CalibrationTracker::slipThresholdCm = 3;
+int CalibrationTracker::slipSamples = 5;
+int CalibrationTracker::slipClearSamples = 20;
+float CalibrationTracker::driftThresholdCm = 5;
+float CalibrationTracker::maxCovariance = 100 * 100;
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxOsc.h"
+#include "Rig.h"
+#include "OscBundleSender.h"
+
+// homes every winch at once instead of one /home at a time. each motor runs
+// out to its endstop fast, then homes again slowly from just off the switch so
+// the zero is as good as a slow home. the approach speeds follow the cable
+// jacobian so the eye sinks straight down to the floor instead of swinging
+// towards whichever cable is slowest. homed motors hold at their zero while the
+// rest finish, nothing reels in until every cable has a zero, then all the
+// slack is taken up so every cable comes tight at the same moment, and the eye
+// is lifted back to where it started along the kinematics. if any motor stops
+// homing, faults or goes quiet, everything is stopped so no cable keeps paying
+// out or pulling on its own.
+class HomingSequence {
+public:
+    enum Phase {
+        IDLE,
+        HOMING, // approach and touch, per motor
+        TAKEUP, // reel in the slack together until the eye is about to lift
+        LIFT, // the eye back up to its start position
+        DONE,
+        FAILED
+    };
+
+    float approachSpeedCps = 15;
+    float touchSpeedCps = 2;
+    float takeUpSpeedCps = 20;
+    float liftSpeedCps = 10;
+    float restHeightCm = 0; // where the eye sits once the cables are slack
+    float approachTimeoutSeconds = 90;
+    float touchTimeoutSeconds = 20;
+    float resendSeconds = 1; // /home again if the motor hasn't started by then
+
+    void setup(ofXml& config, string address = "") {
+        approachSpeedCps = config.getFloatValue(address + "approachSpeed");
+        touchSpeedCps = config.getFloatValue(address + "touchSpeed");
+        takeUpSpeedCps = config.getFloatValue(address + "takeUpSpeed");
+        liftSpeedCps = config.getFloatValue(address + "liftSpeed");
+        restHeightCm = config.getFloatValue(address + "restHeight");
+        approachTimeoutSeconds = config.getFloatValue(address + "approachTimeoutSeconds");
+        touchTimeoutSeconds = config.getFloatValue(address + "touchTimeoutSeconds");
+    }
+    // eyePosition is where the eye is now, as far as we know, and where it ends up again
+    void start(const Rig& rig, ofVec3f eyePosition) {
+        float now = ofGetElapsedTimef();
+        target = eyePosition;
+        rest = ofVec3f(eyePosition.x, eyePosition.y, restHeightCm);
+        startTime = phaseStart = now;
+        failure.clear();
+
+        // cable speeds for the eye going straight down, the fastest one at the approach speed
+        int n = rig.size();
+        vector<float> rates(n);
+        float maxRate = 0;
+        for(int i = 0; i < n; i++) {
+            rates[i] = rig.getJacobian(i, eyePosition).dot(ofVec3f(0, 0, -1));
+            maxRate = MAX(maxRate, rates[i]);
+        }
+        winches.assign(n, Winch());
+        for(int i = 0; i < n; i++) {
+            Winch& winch = winches[i];
+            float scale = maxRate > 0 ? rates[i] / maxRate : 1;
+            winch.approachSpeedCps = MAX(touchSpeedCps, approachSpeedCps * scale);
+            winch.startUnits = rig.motors[i].status.encoder0Pos;
+            setWinchPhase(winch, APPROACH, now);
+        }
+        setPhase(HOMING, now);
+        ofLogNotice("HomingSequence") << "homing " << n << " motors";
+    }
+    bool isActive() const {
+        return phase == HOMING || phase == TAKEUP || phase == LIFT;
+    }
+    bool isDone() const {
+        return phase == DONE;
+    }
+    Phase getPhase() const {
+        return phase;
+    }
+    // the eye position the rig is left at when done
+    ofVec3f getTarget() const {
+        return target;
+    }
+    // once per tick after the motor status is in. sends /home and /stop on send,
+    // and sets the commanded cable lengths in rig for the /go that follows.
+    void update(Rig& rig, OscBundleSender& send, float dt) {
+        if(!isActive()) {
+            return;
+        }
+        float now = ofGetElapsedTimef();
+        if(phase == HOMING) {
+            updateHoming(rig, send, now);
+        } else {
+            for(int i = 0; i < rig.size(); i++) {
+                if(!checkHomed(rig, send, i)) {
+                    break;
+                }
+            }
+        }
+        if(phase == HOMING) {
+            // homed motors hold at their zero, the others ignore /go until they are homed
+            for(int i = 0; i < rig.size(); i++) {
+                rig.setLengthCm(i, rig.unitsToCm(i, 0), dt);
+            }
+            if(isAllHomed()) {
+                for(int i = 0; i < rig.size(); i++) {
+                    winches[i].zeroCm = rig.unitsToCm(i, 0);
+                }
+                setPhase(TAKEUP, now);
+                // every cable travels for the same time, the longest one at the take up speed
+                float longest = 0;
+                for(int i = 0; i < rig.size(); i++) {
+                    longest = MAX(longest, fabsf(rig.getLengthCm(i, rest) - winches[i].zeroCm));
+                }
+                phaseDuration = longest / takeUpSpeedCps;
+            }
+        }
+        if(phase == TAKEUP) {
+            float t = getPhaseProgress(now);
+            for(int i = 0; i < rig.size(); i++) {
+                rig.setLengthCm(i, ofLerp(winches[i].zeroCm, rig.getLengthCm(i, rest), t), dt);
+            }
+            if(t == 1) {
+                setPhase(LIFT, now);
+                phaseDuration = rest.distance(target) / liftSpeedCps;
+            }
+        }
+        if(phase == LIFT) {
+            float t = getPhaseProgress(now);
+            rig.update(rest.getInterpolated(target, t), dt);
+            if(t == 1) {
+                setPhase(DONE, now);
+                string summary = "homed " + ofToString(rig.size()) + " motors in " + ofToString(now - startTime, 1) + "s:";
+                for(int i = 0; i < rig.size(); i++) {
+                    summary += " " + rig.motors[i].name + " " + ofToString(winches[i].homedTime - startTime, 1) + "s";
+                }
+                ofLogNotice("HomingSequence") << summary;
+                ofFile file;
+                file.open("homing.log", ofFile::Append);
+                file << ofGetTimestampString() << "\t" << summary << "\n";
+            }
+        }
+    }
+    string getDescription(const Rig& rig) const {
+        float now = ofGetElapsedTimef();
+        string description;
+        if(phase == IDLE) {
+            return "";
+        } else if(phase == HOMING) {
+            description = "homing, " + ofToString(now - startTime, 0) + "s\n";
+            for(int i = 0; i < rig.size(); i++) {
+                const Winch& winch = winches[i];
+                float outCm = fabsf(rig.motors[i].status.encoder0Pos - winch.startUnits) / rig.unitsPerCm[i];
+                description += "  " + rig.motors[i].name + ": ";
+                if(winch.phase == APPROACH) {
+                    description += "approach at " + ofToString(winch.approachSpeedCps, 1) + "cm/s, " + ofToString(roundf(outCm)) + "cm out";
+                } else if(winch.phase == TOUCH) {
+                    description += "touch at " + ofToString(touchSpeedCps, 1) + "cm/s";
+                } else {
+                    description += "homed in " + ofToString(winch.homedTime - startTime, 1) + "s";
+                }
+                if(winch.phase != HOMED) {
+                    description += ", " + ofToString(now - winch.phaseStart, 0) + "s";
+                }
+                description += "\n";
+            }
+        } else if(phase == TAKEUP) {
+            description = "homing, taking up slack " + ofToString(roundf(100 * getPhaseProgress(now))) + "%\n";
+        } else if(phase == LIFT) {
+            description = "homing, lifting " + ofToString(roundf(100 * getPhaseProgress(now))) + "%\n";
+        } else if(phase == DONE) {
+            description = "homed in " + ofToString(phaseStart - startTime, 1) + "s\n";
+        } else if(phase == FAILED) {
+            description = "homing failed: " + failure + "\n";
+        }
+        return description;
+    }
+
+protected:
+    enum WinchPhase {
+        APPROACH,
+        TOUCH,
+        HOMED
+    };
+    struct Winch {
+        WinchPhase phase = APPROACH;
+        float approachSpeedCps = 0;
+        float phaseStart = 0;
+        float commandTime = 0; // last /home, 0 to send one now
+        bool started = false; // seen HOMING or HOMINGBACKOFF since the last /home
+        float startUnits = 0;
+        float homedTime = 0;
+        float zeroCm = 0;
+    };
+    vector<Winch> winches;
+    Phase phase = IDLE;
+    float startTime = 0, phaseStart = 0, phaseDuration = 0;
+    ofVec3f target, rest;
+    string failure;
+
+    void setPhase(Phase phase, float now) {
+        this->phase = phase;
+        phaseStart = now;
+        phaseDuration = 0;
+    }
+    void setWinchPhase(Winch& winch, WinchPhase phase, float now) {
+        winch.phase = phase;
+        winch.phaseStart = now;
+        winch.commandTime = 0;
+        winch.started = false;
+    }
+    float getPhaseProgress(float now) const {
+        return phaseDuration > 0 ? ofClamp((now - phaseStart) / phaseDuration, 0, 1) : 1;
+    }
+    bool isAllHomed() const {
+        for(const Winch& winch : winches) {
+            if(winch.phase != HOMED) {
+                return false;
+            }
+        }
+        return true;
+    }
+    void updateHoming(Rig& rig, OscBundleSender& send, float now) {
+        for(int i = 0; i < rig.size() && phase == HOMING; i++) {
+            Winch& winch = winches[i];
+            if(winch.phase == HOMED) {
+                checkHomed(rig, send, i);
+                continue;
+            }
+            const Motor& motor = rig.motors[i];
+            const string& state = motor.status.statusMessage;
+            float timeout = winch.phase == APPROACH ? approachTimeoutSeconds : touchTimeoutSeconds;
+            if(motor.timedOut) {
+                fail(send, motor.name + " timed out");
+            } else if(now - winch.phaseStart > timeout) {
+                fail(send, motor.name + " didn't find home in " + ofToString(timeout, 0) + "s");
+            } else if(state == "HOMING" || state == "HOMINGBACKOFF") {
+                winch.started = true;
+            } else if(winch.started && state == "OK") {
+                if(winch.phase == APPROACH) {
+                    // a few mm off the switch now, go back in slowly for the real zero
+                    setWinchPhase(winch, TOUCH, now);
+                } else {
+                    setWinchPhase(winch, HOMED, now);
+                    winch.homedTime = now;
+                    ofLogNotice("HomingSequence") << motor.name << " homed in " << (now - startTime) << "s";
+                }
+            } else if(winch.started) {
+                fail(send, motor.name + " stopped homing as " + state);
+            } else if(winch.commandTime == 0 || now - winch.commandTime > resendSeconds) {
+                // the /home may have been lost, the firmware ignores a repeat while HOMING
+                winch.commandTime = now;
+                if(state == "MOTOROFF" || state == "NOTHOMED-OFF") {
+                    // /home is ignored while the power is off
+                    ofxOscMessage power;
+                    power.setAddress("/motor");
+                    power.addIntArg(i);
+                    power.addIntArg(1);
+                    send.add(power);
+                }
+                ofxOscMessage msg;
+                msg.setAddress("/home");
+                msg.addIntArg(i);
+                msg.addFloatArg(winch.phase == APPROACH ? winch.approachSpeedCps : touchSpeedCps);
+                send.add(msg);
+            }
+        }
+    }
+    // once homed a motor has to stay OK, false if it didn't and everything was stopped
+    bool checkHomed(const Rig& rig, OscBundleSender& send, int i) {
+        const Motor& motor = rig.motors[i];
+        if(motor.timedOut) {
+            fail(send, motor.name + " timed out");
+            return false;
+        }
+        if(motor.status.statusMessage != "OK") {
+            fail(send, motor.name + " went " + motor.status.statusMessage + " after homing");
+            return false;
+        }
+        return true;
+    }
+    void fail(OscBundleSender& send, string reason) {
+        failure = reason;
+        setPhase(FAILED, ofGetElapsedTimef());
+        ofLogError("HomingSequence") << reason << ", stopping all motors";
+        // homing motors go back to NOTHOMED, homed ones to STOPPED
+        ofxOscMessage msg;
+        msg.setAddress("/stop");
+        send.add(msg);
+    }
+};
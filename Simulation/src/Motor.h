@@ -1,94 +1,115 @@
 #pragma once
 
 #include "ofMain.h"
+#include "CalibrationTracker.h"
+#include "MotorStatusReceiver.h"
+#include "TimerWheel.h"
 
+// what we know about one motor controller from its /status messages.
+// geometry and commanded lengths live in Rig.
 class Motor {
 public:
     static float statusTimeoutSeconds;
     
     string name;
     int id = 0;
-    float unitsPerCm = 0;
-    float refPointCm = 0;
-    float refPointUnits = 0;
     
     struct Status {
         string statusMessage = "OK";
         float encoder0Pos = 0;
         float currentSpeed = 0;
         int rebootSeconds = 0;
+        int encoderErrors = 0;
+        unsigned int received = 0, dropped = 0, outOfOrder = 0;
+        MotorLoopTiming timing = MotorLoopTiming();
+        double sampleTime = 0, arrivalClock = 0;
+        MotorClockEstimate clock = MotorClockEstimate();
     } status;
     float lastMessageTime = 0;
+    unsigned int statusSequence = 0;
+    TimerWheel::Timer statusTimer;
+    bool timedOut = false;
+    CalibrationTracker calibration;
     
-    ofVec3f eyeAttach, pillarAttach;
-    float prevLength, lengthSpeedCps;
-    Motor() : prevLength(0), lengthSpeedCps(0) {
-    }
-    void setup(string name, ofXml& xml, string address = "") {
+    void setup(string name, int id, float unitsPerCm, float refPointCm, float refPointUnits) {
         this->name = name;
-        id = xml.getIntValue(address + "id");
-        unitsPerCm = xml.getFloatValue(address + "unitsPerCm");
-        refPointCm = xml.getFloatValue(address + "refPoint/cm");
-        refPointUnits = xml.getFloatValue(address + "refPoint/units");
+        this->id = id;
+        calibration.setup(unitsPerCm, refPointCm, refPointUnits);
+        statusTimer.setCallback([this] {
+            timedOut = true;
+        });
+    }
+    float getTimeoutDuration() const {
+        return ofGetElapsedTimef() - lastMessageTime;
     }
-    void update(ofVec3f eyePosition) {
-        ofVec3f start = eyePosition + eyeAttach;
-        float curLength = (pillarAttach - start).length();
-        if(prevLength > 0) {
-            lengthSpeedCps = (curLength - prevLength) * ofGetTargetFrameRate();
+    void setStatus(const MotorStatusSample& sample, TimerWheel& timers) {
+        lastMessageTime = sample.arrivalTime;
+        timedOut = false;
+        timers.arm(statusTimer, 1000 * statusTimeoutSeconds);
+        status.statusMessage = sample.statusMessage;
+        status.encoder0Pos = sample.encoder0Pos;
+        status.currentSpeed = sample.currentSpeed;
+        status.rebootSeconds = sample.rebootSeconds;
+        if(sample.encoderErrors > status.encoderErrors) {
+            ofLogWarning("Motor") << name << " missed " << (sample.encoderErrors - status.encoderErrors) << " encoder edges";
         }
-        prevLength = curLength;
+        status.encoderErrors = sample.encoderErrors;
+        status.received = sample.received;
+        status.dropped = sample.dropped;
+        status.outOfOrder = sample.outOfOrder;
+        status.timing = sample.timing;
+        status.sampleTime = sample.sampleTime;
+        status.arrivalClock = sample.arrivalClock;
+        status.clock = sample.clock;
     }
-    ofVec3f getFloorDrop() const {
-        ofVec3f floorDrop = pillarAttach;
-        floorDrop.z = 0;
-        return floorDrop;
+    // called for every new /status sample, after status has been filled in
+    void updateCalibration(float commandedCm, float commandedSpeedCps) {
+        if(status.statusMessage != "OK") {
+            // homing moves the zero on purpose, start the fit over
+            if(status.statusMessage == "HOMING" || status.statusMessage == "HOMINGBACKOFF") {
+                calibration.reset();
+            }
+            return;
+        }
+        if(calibration.update(commandedCm, commandedSpeedCps, status.encoder0Pos, status.currentSpeed)) {
+            ofLogWarning("Motor") << name << " calibration alarm:" << calibration.getDescription();
+        }
     }
-    float getTimeoutDuration() const {
-        return ofGetElapsedTimef() - lastMessageTime;
+    // how long the firmware's loop takes against the control tick it has to keep up with
+    string getTimingDescription(float tickSeconds) const {
+        const MotorLoopTiming& timing = status.timing;
+        if(!timing.reports) {
+            return name + ": no timing\n";
+        }
+        float headroom = 1 - timing.loopMax / (tickSeconds * 1e6f);
+        return name + ": loop " + ofToString(timing.getLoopAvg() / 1000, 2) + "/" + ofToString(timing.loopMax / 1000.f, 2) + "ms, " +
+            ofToString(roundf(100 * headroom)) + "% headroom\n" +
+            "  pid " + ofToString(timing.pidMax / 1000.f, 2) + " osc " + ofToString(timing.oscMax / 1000.f, 2) + " status " + ofToString(timing.statusMax / 1000.f, 2) + "ms\n" +
+            "  step isr " + ofToString(100 * timing.getStepIsrLoad(), 1) + "%, " + ofToString(timing.stepIsrMax) + "us max\n" +
+            "  " + ofToString(roundf(timing.getRate(timing.packets))) + " packets/s, " + ofToString(roundf(timing.getRate(timing.encoderEdges))) + " edges/s\n" +
+            getClockDescription();
     }
-    bool getTimeout() const {
-        return lastMessageTime != 0 && getTimeoutDuration() > statusTimeoutSeconds;
+    string getClockDescription() const {
+        const MotorClockEstimate& clock = status.clock;
+        if(!clock.synced) {
+            return "  clock not synced\n";
+        }
+        string description = "  clock " + ofToString(clock.drift * 1e6f, 1) + "ppm +/-" + ofToString(clock.roundTrip * 500, 2) + "ms";
+        if(status.sampleTime) {
+            description += ", status " + ofToString((status.arrivalClock - status.sampleTime) * 1000, 2) + "ms late";
+        }
+        return description + "\n";
     }
-    void draw(ofVec3f eyePosition) {
-        ofPushMatrix();
-        ofPushStyle();
-        ofVec3f start = eyePosition + eyeAttach;
-        ofDrawLine(pillarAttach, getFloorDrop());
-        ofDrawLine(pillarAttach, start);
-        float targetLengthCm = (pillarAttach - start).length();
-        float targetLengthUnits = cmToUnits(targetLengthCm);
-        float curPositionUnits = status.encoder0Pos;
-        float curPositionCm = unitsToCm(curPositionUnits);
+    string getStatusDescription() const {
         string currentStatus = status.statusMessage;
-        if(getTimeout()) {
+        if(timedOut) {
             currentStatus = "TIMEOUT (" + ofToString((int) getTimeoutDuration()) + "s)";
         }
-        
         if(status.rebootSeconds) {
             currentStatus += " (reboot " + ofToString(status.rebootSeconds) + "s)";
         }
-        
-        ofTranslate(pillarAttach);
-        ofDrawBitmapString(name + " (" + ofToString(id) + ")\n"+
-                           "target\n  position: ~" + ofToString(roundf(targetLengthCm)) + "cm / ~" + ofToString(roundf(targetLengthUnits)) + " units\n" +
-                           "  speed: ~" + ofToString(roundf(lengthSpeedCps)) + "cm/s\n" +
-                           "current\n  status: " + currentStatus + "\n" +
-                           "  position: ~" + ofToString(roundf(curPositionCm)) + " cm / ~" + ofToString(roundf(curPositionUnits)) + " units\n" +
-                           "  speed: " + ofToString(status.currentSpeed) + " cm/s",
-                           10, 20);
-        ofPopStyle();
-        ofPopMatrix();
-    }
-    float unitsToCm(float units) {
-        return (refPointUnits - units) / unitsPerCm + refPointCm;
-    }
-    float cmToUnits(float cm) {
-        return (refPointCm - cm) * unitsPerCm + refPointUnits;
-    }
-    float getLengthUnits() {
-        return cmToUnits(prevLength);
+        return currentStatus;
     }
 };
 
-float Motor::statusTimeoutSeconds = 0;
\ No newline at end of file
+float Motor::statusTimeoutSeconds = 0;
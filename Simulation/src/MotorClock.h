@@ -0,0 +1,155 @@
+#pragma once
+
+#include "ofMain.h"
+
+// how one motor's clock lines up with the server's, small enough for a Seqlock
+struct MotorClockEstimate {
+    bool synced;
+    float drift; // the motor's micros() runs fast by this fraction
+    float roundTrip; // fastest recent ping, seconds. the offset is good to half this
+    int pings;
+};
+
+// maps one motor controller's micros() onto the server clock, the wall clock
+// that osc timetags use, so status samples line up with the setpoints that
+// went out in timetagged bundles. each /pong carries when the server sent the
+// ping, when the motor read it and answered by its own clock, and arrives at a
+// time we know. like ntp, only the quickest round trips are trusted, the rest
+// waited somewhere on the way. a line through those over the last half minute
+// of pings gives the drift. only touched by the receive thread.
+class MotorClock {
+public:
+    static const int maxSamples = 32;
+
+    // seconds since 1970 on the server clock
+    static double now() {
+        auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count() * 1e-6;
+    }
+    static double timetagToSeconds(uint32_t seconds, uint32_t fraction) {
+        const double secondsFrom1900To1970 = 2208988800.;
+        return seconds - secondsFrom1900To1970 + fraction / 4294967296.;
+    }
+
+    void reset() {
+        samples.clear();
+        next = 0;
+        started = false;
+        estimate = MotorClockEstimate();
+    }
+    // sent and arrived on the server clock, received and replied by the motor's micros()
+    void addPing(double sent, uint32_t received, uint32_t replied, double arrived) {
+        double motorSeconds = (uint32_t) (replied - received) * 1e-6;
+        Sample sample;
+        sample.roundTrip = (arrived - sent) - motorSeconds;
+        sample.local = unwrap(received) * 1e-6 + motorSeconds / 2;
+        sample.offset = (sent + arrived) / 2 - sample.local;
+        if(sample.roundTrip < 0 || sample.roundTrip > maxRoundTrip) {
+            return;
+        }
+        // a motor that rebooted starts its micros() over
+        if(estimate.synced && fabs(sample.offset - getOffset(sample.local)) > maxJump) {
+            ofLogWarning("MotorClock") << "clock jumped " << (sample.offset - getOffset(sample.local)) << "s, starting over";
+            reset();
+            sample.local = unwrap(received) * 1e-6 + motorSeconds / 2;
+        }
+        if(samples.size() < maxSamples) {
+            samples.push_back(sample);
+        } else {
+            samples[next] = sample;
+            next = (next + 1) % maxSamples;
+        }
+        estimate.pings++;
+        fit();
+    }
+    bool isSynced() const {
+        return estimate.synced;
+    }
+    const MotorClockEstimate& getEstimate() const {
+        return estimate;
+    }
+    // a micros() from the motor, on the server clock. 0 until synced
+    double toServerTime(uint32_t micros) {
+        if(!estimate.synced) {
+            return 0;
+        }
+        double local = unwrap(micros) * 1e-6;
+        return local + getOffset(local);
+    }
+
+protected:
+    static constexpr double maxRoundTrip = 0.5, maxJump = 1;
+    // a drift from less than this much time would be mostly noise
+    static constexpr double minDriftSpan = 10;
+
+    struct Sample {
+        double local; // motor seconds, unwrapped
+        double offset; // server minus motor, seconds
+        double roundTrip;
+    };
+    vector<Sample> samples;
+    int next = 0;
+
+    // micros() wraps every 71 minutes, so count from the first one we saw
+    bool started = false;
+    uint32_t lastMicros = 0;
+    int64_t lastLocal = 0;
+
+    // offset = offsetRef + slope * (local - localRef)
+    double offsetRef = 0, localRef = 0, slope = 0;
+    MotorClockEstimate estimate = MotorClockEstimate();
+
+    int64_t unwrap(uint32_t micros) {
+        if(!started) {
+            started = true;
+            lastMicros = micros;
+            lastLocal = micros;
+        }
+        int64_t local = lastLocal + (int32_t) (micros - lastMicros);
+        // late packets don't move the reference back
+        if(local > lastLocal) {
+            lastMicros = micros;
+            lastLocal = local;
+        }
+        return local;
+    }
+    double getOffset(double local) const {
+        return offsetRef + slope * (local - localRef);
+    }
+    void fit() {
+        // the quicker half
+        vector<Sample> best = samples;
+        std::sort(best.begin(), best.end(), [](const Sample& a, const Sample& b) {
+            return a.roundTrip < b.roundTrip;
+        });
+        best.resize(MAX(1, (int) best.size() / 2));
+
+        double localMin = best[0].local, localMax = best[0].local;
+        double meanLocal = 0, meanOffset = 0;
+        for(const Sample& sample : best) {
+            localMin = MIN(localMin, sample.local);
+            localMax = MAX(localMax, sample.local);
+            meanLocal += sample.local;
+            meanOffset += sample.offset;
+        }
+        meanLocal /= best.size();
+        meanOffset /= best.size();
+
+        slope = 0;
+        if(localMax - localMin >= minDriftSpan) {
+            double covariance = 0, variance = 0;
+            for(const Sample& sample : best) {
+                covariance += (sample.local - meanLocal) * (sample.offset - meanOffset);
+                variance += (sample.local - meanLocal) * (sample.local - meanLocal);
+            }
+            slope = covariance / variance;
+        }
+
+        localRef = meanLocal;
+        offsetRef = meanOffset;
+        // a fast motor clock gets further ahead of ours, so the offset shrinks
+        estimate.drift = -slope / (1 + slope);
+        estimate.roundTrip = best[0].roundTrip;
+        estimate.synced = true;
+    }
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ThreadedOscListener.h"
+#include "Seqlock.h"
+#include "MotorClock.h"
+
+// the firmware's loop timing from one motor's /status, added up over the last
+// 10 to 20 seconds. times in microseconds
+struct MotorLoopTiming {
+    int reports; // /status messages that had timing
+    int loops;
+    int64_t loopTotal; // also how long this covers
+    int loopMin, loopMax;
+    int pidMax, oscMax, statusMax;
+    int stepIsrMax;
+    int64_t stepIsrTotal;
+    int encoderEdges, packets;
+    
+    void add(const MotorLoopTiming& x) {
+        if(!x.reports) {
+            return;
+        }
+        loopMin = reports ? MIN(loopMin, x.loopMin) : x.loopMin;
+        reports += x.reports;
+        loops += x.loops;
+        loopTotal += x.loopTotal;
+        loopMax = MAX(loopMax, x.loopMax);
+        pidMax = MAX(pidMax, x.pidMax);
+        oscMax = MAX(oscMax, x.oscMax);
+        statusMax = MAX(statusMax, x.statusMax);
+        stepIsrMax = MAX(stepIsrMax, x.stepIsrMax);
+        stepIsrTotal += x.stepIsrTotal;
+        encoderEdges += x.encoderEdges;
+        packets += x.packets;
+    }
+    float getLoopAvg() const {
+        return loops ? (float) loopTotal / loops : 0;
+    }
+    // fraction of the time spent in the step interrupt
+    float getStepIsrLoad() const {
+        return loopTotal ? (float) stepIsrTotal / loopTotal : 0;
+    }
+    // count per second
+    float getRate(int count) const {
+        return loopTotal ? count * 1e6f / loopTotal : 0;
+    }
+};
+
+// newest /status from one motor, plus what the receive thread noticed about the stream
+struct MotorStatusSample {
+    char statusMessage[16];
+    float encoder0Pos;
+    float currentSpeed;
+    int rebootSeconds;
+    int encoderErrors; // missed encoder edges since boot, 0 from older firmware
+    MotorLoopTiming timing; // no reports from older firmware
+    float arrivalTime; // ofGetElapsedTimef() when the packet arrived
+    double arrivalClock; // MotorClock::now() when the packet arrived
+    double sampleTime; // when the motor sent it, on the server clock. 0 until the clock is synced
+    MotorClockEstimate clock;
+    unsigned int received; // /status packets from this motor
+    unsigned int dropped; // gaps in the firmware status sequence
+    unsigned int outOfOrder; // packets older than one we already had
+};
+
+// parses /status on the receive thread straight into one Seqlock per motor,
+// so the control loop reads current motor state in constant time no matter
+// how short /statusinterval is.
+class MotorStatusReceiver : public ThreadedOscListener {
+public:
+    static const int maxMotors = 16;
+    static float timingWindowSeconds;
+    // a packet at most this far behind the newest is late, further back the controller restarted
+    static const int maxLatePackets = 32;
+protected:
+    Seqlock<MotorStatusSample> slots[maxMotors];
+    // only touched by the receive thread
+    MotorStatusSample latest[maxMotors];
+    int lastStatusSequence[maxMotors];
+    // timing reports are added up here as they arrive, so none are missed when
+    // the control loop only reads the newest sample. the current and previous window.
+    MotorLoopTiming timingWindows[maxMotors][2];
+    float timingWindowStart[maxMotors];
+    MotorClock clocks[maxMotors];
+
+    std::mutex crashReportMutex;
+    vector<string> crashReports;
+    vector<string> autotuneResults;
+public:
+    MotorStatusReceiver() {
+        for(int i = 0; i < maxMotors; i++) {
+            latest[i] = MotorStatusSample();
+            lastStatusSequence[i] = -1;
+            timingWindows[i][0] = timingWindows[i][1] = MotorLoopTiming();
+            timingWindowStart[i] = 0;
+        }
+    }
+    // true if a newer sample arrived since lastSequence
+    bool getStatus(int motorId, MotorStatusSample& sample, unsigned int& lastSequence) const {
+        if(motorId < 0 || motorId >= maxMotors) {
+            return false;
+        }
+        return slots[motorId].loadIfNewer(sample, lastSequence);
+    }
+    // crash reports are rare, so they just go through a locked list
+    bool getCrashReport(string& crashReport) {
+        std::lock_guard<std::mutex> lock(crashReportMutex);
+        if(crashReports.empty()) {
+            return false;
+        }
+        crashReport = crashReports.front();
+        crashReports.erase(crashReports.begin());
+        return true;
+    }
+    // the gains a motor found with /autotune, or that it failed
+    bool getAutotuneResult(string& autotuneResult) {
+        std::lock_guard<std::mutex> lock(crashReportMutex);
+        if(autotuneResults.empty()) {
+            return false;
+        }
+        autotuneResult = autotuneResults.front();
+        autotuneResults.erase(autotuneResults.begin());
+        return true;
+    }
+protected:
+    void ProcessMessage(const osc::ReceivedMessage& m, const IpEndpointName& remoteEndpoint) {
+        // before anything else, this is the far end of every round trip
+        double arrived = MotorClock::now();
+        const char* address = m.AddressPattern();
+        if(strcmp(address, "/status") == 0) {
+            processStatus(m, arrived);
+        } else if(strcmp(address, "/pong") == 0) {
+            processPong(m, arrived);
+        } else if(strcmp(address, "/crashreport") == 0) {
+            string crashReport = getReport(m, remoteEndpoint);
+            std::lock_guard<std::mutex> lock(crashReportMutex);
+            crashReports.push_back(crashReport);
+        } else if(strcmp(address, "/autotune") == 0) {
+            string autotuneResult = getReport(m, remoteEndpoint);
+            std::lock_guard<std::mutex> lock(crashReportMutex);
+            autotuneResults.push_back(autotuneResult);
+        }
+    }
+    string getReport(const osc::ReceivedMessage& m, const IpEndpointName& remoteEndpoint) {
+        string report = getRemoteIp(remoteEndpoint);
+        for(osc::ReceivedMessageArgumentIterator arg = m.ArgumentsBegin(); arg != m.ArgumentsEnd(); ++arg) {
+            report += "\t" + argToString(*arg);
+        }
+        return report;
+    }
+    void addTiming(int motorId, const MotorLoopTiming& report, MotorLoopTiming& total) {
+        MotorLoopTiming* windows = timingWindows[motorId];
+        float now = ofGetElapsedTimef();
+        if(now - timingWindowStart[motorId] > timingWindowSeconds) {
+            windows[1] = windows[0];
+            windows[0] = MotorLoopTiming();
+            timingWindowStart[motorId] = now;
+        }
+        windows[0].add(report);
+        total = windows[0];
+        total.add(windows[1]);
+    }
+    // the answer to a /ping that went out in a timetagged bundle
+    void processPong(const osc::ReceivedMessage& m, double arrived) {
+        if(m.ArgumentCount() < 5) {
+            malformed++;
+            return;
+        }
+        osc::ReceivedMessageArgumentIterator arg = m.ArgumentsBegin();
+        int motorId = (arg++)->AsInt32();
+        if(motorId < 0 || motorId >= maxMotors) {
+            malformed++;
+            return;
+        }
+        uint32_t seconds = (arg++)->AsInt32();
+        uint32_t fraction = (arg++)->AsInt32();
+        uint32_t received = (arg++)->AsInt32();
+        uint32_t replied = (arg++)->AsInt32();
+        MotorClock& clock = clocks[motorId];
+        clock.addPing(MotorClock::timetagToSeconds(seconds, fraction), received, replied, arrived);
+        // goes out with the next /status
+        latest[motorId].clock = clock.getEstimate();
+    }
+    void processStatus(const osc::ReceivedMessage& m, double arrived) {
+        if(m.ArgumentCount() < 7) {
+            malformed++;
+            return;
+        }
+        osc::ReceivedMessageArgumentIterator arg = m.ArgumentsBegin();
+        int motorId = (arg++)->AsInt32();
+        if(motorId < 0 || motorId >= maxMotors) {
+            malformed++;
+            return;
+        }
+        MotorStatusSample& sample = latest[motorId];
+        sample.received++;
+        // older firmware doesn't send a status sequence, then we can't count drops
+        if(m.ArgumentCount() > 7) {
+            osc::ReceivedMessageArgumentIterator sequenceArg = m.ArgumentsBegin();
+            std::advance(sequenceArg, 7);
+            int sequence = sequenceArg->AsInt32();
+            int& last = lastStatusSequence[motorId];
+            // a rebooted controller counts from 0 again, which is far behind anything late
+            if(last >= 0 && last - sequence > maxLatePackets) {
+                ofLogNotice("MotorStatusReceiver") << "motor " << motorId << " restarted its status sequence at " << sequence;
+                last = -1;
+            }
+            if(last >= 0 && sequence <= last) {
+                // a late packet, keep the newer state we already have. storing it
+                // would look like a new status, the count goes out with the next one
+                sample.outOfOrder++;
+                return;
+            }
+            if(last >= 0 && sequence > last + 1) {
+                sample.dropped += sequence - last - 1;
+            }
+            last = sequence;
+        }
+        strncpy(sample.statusMessage, (arg++)->AsString(), sizeof(sample.statusMessage) - 1);
+        sample.statusMessage[sizeof(sample.statusMessage) - 1] = 0;
+        sample.encoder0Pos = (arg++)->AsFloat();
+        sample.currentSpeed = (arg++)->AsFloat();
+        arg++; // stepper, no longer supported
+        arg++; // encoder, no longer supported
+        sample.rebootSeconds = (arg++)->AsInt32();
+        sample.encoderErrors = 0;
+        if(m.ArgumentCount() > 8) {
+            arg++; // sequence, handled above
+            sample.encoderErrors = (arg++)->AsInt32();
+        }
+        if(m.ArgumentCount() >= 20) {
+            MotorLoopTiming report = MotorLoopTiming();
+            report.reports = 1;
+            report.loops = (arg++)->AsInt32();
+            report.loopMin = (arg++)->AsInt32();
+            report.loopTotal = (int64_t) report.loops * (arg++)->AsInt32();
+            report.loopMax = (arg++)->AsInt32();
+            report.pidMax = (arg++)->AsInt32();
+            report.oscMax = (arg++)->AsInt32();
+            report.statusMax = (arg++)->AsInt32();
+            report.stepIsrMax = (arg++)->AsInt32();
+            report.stepIsrTotal = (arg++)->AsInt32();
+            report.encoderEdges = (arg++)->AsInt32();
+            report.packets = (arg++)->AsInt32();
+            addTiming(motorId, report, sample.timing);
+        }
+        sample.sampleTime = 0;
+        if(m.ArgumentCount() >= 21) {
+            sample.sampleTime = clocks[motorId].toServerTime((uint32_t) (arg++)->AsInt32());
+        }
+        sample.clock = clocks[motorId].getEstimate();
+        sample.arrivalTime = ofGetElapsedTimef();
+        sample.arrivalClock = arrived;
+        slots[motorId].store(sample);
+    }
+};
+
+float MotorStatusReceiver::timingWindowSeconds = 10;
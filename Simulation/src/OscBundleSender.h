@@ -0,0 +1,111 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxOsc.h"
+#include "osc/OscOutboundPacketStream.h"
+#include "ip/UdpSocket.h"
+
+// gathers every message added during one control tick and sends them as a
+// single bundle on flush(), so every motor gets the whole tick in the same
+// datagram and applies it in the same loop. the timetag is when the tick was
+// sent on this machine's clock. the firmware only compares it with this
+// sender's earlier ticks, to ignore setpoints that arrive out of order, and
+// echoes it for clock sync. nothing is scheduled on it.
+// ofxOscSender can only send immediate bundles, so this talks to oscpack.
+class OscBundleSender {
+public:
+    // the motor controllers have 2k of ram, bigger ticks are split into
+    // several bundles with the same timetag
+    int maxBundleBytes = 512;
+
+    OscBundleSender()
+    : buffer(maxPacketBytes)
+    , scratchBuffer(maxPacketBytes) {
+    }
+    void setup(const string& host, int port) {
+        socket.reset(new UdpTransmitSocket(IpEndpointName(host.c_str(), port)));
+        socket->SetEnableBroadcast(true);
+        pending.clear();
+    }
+    void add(const ofxOscMessage& message) {
+        pending.push_back(message);
+    }
+    // drops everything added since the last flush
+    void clear() {
+        pending.clear();
+    }
+    // sends everything added since the last flush
+    void flush() {
+        if(!socket || pending.empty()) {
+            return;
+        }
+        osc::uint64 timetag = getTimetag();
+        osc::OutboundPacketStream packet(buffer.data(), buffer.size());
+        int messages = 0;
+        for(const ofxOscMessage& message : pending) {
+            // a bundle element is its size then the message
+            size_t size = 4 + getSize(message);
+            if(messages && packet.Size() + size > maxBundleBytes) {
+                send(packet, messages);
+                messages = 0;
+            }
+            if(!messages) {
+                packet << osc::BeginBundle(timetag);
+            }
+            append(packet, message);
+            messages++;
+        }
+        send(packet, messages);
+        pending.clear();
+    }
+    unsigned int getPacketsSent() const {
+        return packetsSent;
+    }
+    unsigned int getMessagesSent() const {
+        return messagesSent;
+    }
+    // now as an osc timetag, seconds since 1900 and 32 bits of fraction
+    static osc::uint64 getTimetag() {
+        const osc::uint64 secondsFrom1900To1970 = 2208988800ULL;
+        auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+        osc::uint64 micros = std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count();
+        osc::uint64 seconds = micros / 1000000 + secondsFrom1900To1970;
+        osc::uint64 fraction = ((micros % 1000000) << 32) / 1000000;
+        return (seconds << 32) | fraction;
+    }
+
+protected:
+    static const int maxPacketBytes = 1536;
+
+    unique_ptr<UdpTransmitSocket> socket;
+    vector<ofxOscMessage> pending;
+    vector<char> buffer, scratchBuffer;
+    unsigned int packetsSent = 0, messagesSent = 0;
+
+    size_t getSize(const ofxOscMessage& message) {
+        osc::OutboundPacketStream scratch(scratchBuffer.data(), scratchBuffer.size());
+        append(scratch, message);
+        return scratch.Size();
+    }
+    static void append(osc::OutboundPacketStream& packet, const ofxOscMessage& message) {
+        packet << osc::BeginMessage(message.getAddress().c_str());
+        for(int i = 0; i < message.getNumArgs(); i++) {
+            switch(message.getArgType(i)) {
+                case OFXOSC_TYPE_INT32: packet << (osc::int32) message.getArgAsInt32(i); break;
+                case OFXOSC_TYPE_INT64: packet << (osc::int64) message.getArgAsInt64(i); break;
+                case OFXOSC_TYPE_FLOAT: packet << message.getArgAsFloat(i); break;
+                case OFXOSC_TYPE_DOUBLE: packet << message.getArgAsDouble(i); break;
+                case OFXOSC_TYPE_STRING: packet << message.getArgAsString(i).c_str(); break;
+                default: ofLogWarning("OscBundleSender") << "can't send argument " << i << " of " << message.getAddress();
+            }
+        }
+        packet << osc::EndMessage;
+    }
+    void send(osc::OutboundPacketStream& packet, int messages) {
+        packet << osc::EndBundle;
+        socket->Send(packet.Data(), packet.Size());
+        packetsSent++;
+        messagesSent += messages;
+        packet.Clear();
+    }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Motor.h"
+
+// the winches, where their cables meet the eye, and their calibration, all
+// loaded from config.xml. everything the control loop touches each tick is
+// kept in flat arrays indexed by motor id (the firmware's MOTOR_ID, which is
+// also the position in /go), so more cables only make the loops longer.
+class Rig {
+public:
+    vector<ofVec3f> pillarAttach, eyeAttach;
+    vector<float> unitsPerCm, refPointCm, refPointUnits;
+    vector<float> lengthCm, lengthSpeedCps; // commanded
+    deque<Motor> motors; // status, calibration tracking and timeouts
+    vector<int> outline; // ids in config order, which goes around the room
+    
+    // address is the element holding one <motor> per winch
+    bool setup(ofXml& config, string address) {
+        int n = 0;
+        while(config.exists(address + "/motor[" + ofToString(n) + "]")) {
+            n++;
+        }
+        if(n == 0 || n > MotorStatusReceiver::maxMotors) {
+            ofLogError("Rig") << "need between 1 and " << MotorStatusReceiver::maxMotors << " motors, found " << n;
+            return false;
+        }
+        pillarAttach.assign(n, ofVec3f());
+        eyeAttach.assign(n, ofVec3f());
+        unitsPerCm.assign(n, 0);
+        refPointCm.assign(n, 0);
+        refPointUnits.assign(n, 0);
+        lengthCm.assign(n, 0);
+        lengthSpeedCps.assign(n, 0);
+        // motors own timers, so they are built in place and never move
+        motors.clear();
+        for(int i = 0; i < n; i++) {
+            motors.emplace_back();
+        }
+        outline.clear();
+        vector<bool> found(n, false);
+        for(int i = 0; i < n; i++) {
+            string motor = address + "/motor[" + ofToString(i) + "]/";
+            int id = config.getIntValue(motor + "id");
+            if(id < 0 || id >= n || found[id]) {
+                ofLogError("Rig") << "motor ids must be 0 to " << (n - 1) << " with no repeats, got " << id;
+                return false;
+            }
+            found[id] = true;
+            outline.push_back(id);
+            pillarAttach[id] = getVec3f(config, motor + "pillar/");
+            eyeAttach[id] = getVec3f(config, motor + "eye/");
+            unitsPerCm[id] = config.getFloatValue(motor + "unitsPerCm");
+            refPointCm[id] = config.getFloatValue(motor + "refPoint/cm");
+            refPointUnits[id] = config.getFloatValue(motor + "refPoint/units");
+            motors[id].setup(config.getValue(motor + "name"), id, unitsPerCm[id], refPointCm[id], refPointUnits[id]);
+        }
+        return true;
+    }
+    int size() const {
+        return lengthCm.size();
+    }
+    // recompute commanded cable lengths for a new eye position
+    void update(ofVec3f eyePosition, float dt) {
+        int n = size();
+        for(int i = 0; i < n; i++) {
+            setLengthCm(i, getLengthCm(i, eyePosition), dt);
+        }
+    }
+    // command one cable directly, for moves that don't follow the eye
+    void setLengthCm(int i, float length, float dt) {
+        if(lengthCm[i] > 0) {
+            lengthSpeedCps[i] = (length - lengthCm[i]) / dt;
+        }
+        lengthCm[i] = length;
+    }
+    float getLengthCm(int i, ofVec3f eyePosition) const {
+        return (pillarAttach[i] - (eyePosition + eyeAttach[i])).length();
+    }
+    // row of the cable jacobian: d(length) / d(eyePosition) in cm per cm
+    ofVec3f getJacobian(int i, ofVec3f eyePosition) const {
+        return (eyePosition + eyeAttach[i] - pillarAttach[i]).getNormalized();
+    }
+    // forward kinematics: moves eyePosition, from a guess nearby, to where the
+    // cables would be lengthCm long. gauss-newton on the cable length errors,
+    // the jacobian rows are the unit cable directions. returns the rms error
+    // left over in cm, large when a cable is slack or a zero is wrong.
+    float solveEyePosition(const vector<float>& lengthCm, ofVec3f& eyePosition, int iterations = 10) const {
+        int n = size();
+        float squaredError = 0;
+        for(int iteration = 0; iteration <= iterations; iteration++) {
+            // normal equations A x = c with A = J'J, c = -J'r
+            ofVec3f a0, a1, a2, c;
+            squaredError = 0;
+            for(int i = 0; i < n; i++) {
+                ofVec3f j = getJacobian(i, eyePosition);
+                float error = getLengthCm(i, eyePosition) - lengthCm[i];
+                a0 += j * j.x;
+                a1 += j * j.y;
+                a2 += j * j.z;
+                c += j * -error;
+                squaredError += error * error;
+            }
+            ofVec3f c0 = a1.cross(a2), c1 = a2.cross(a0), c2 = a0.cross(a1);
+            float determinant = a0.dot(c0);
+            if(iteration == iterations || fabsf(determinant) < 1e-6) {
+                break;
+            }
+            // A is symmetric, so its inverse has columns c0, c1, c2 over the determinant
+            ofVec3f step = (c0 * c.x + c1 * c.y + c2 * c.z) / determinant;
+            eyePosition += step;
+            if(step.length() < 1e-3) {
+                break;
+            }
+        }
+        return sqrtf(squaredError / n);
+    }
+    float unitsToCm(int i, float units) const {
+        return (refPointUnits[i] - units) / unitsPerCm[i] + refPointCm[i];
+    }
+    float cmToUnits(int i, float cm) const {
+        return (refPointCm[i] - cm) * unitsPerCm[i] + refPointUnits[i];
+    }
+    float getLengthUnits(int i) const {
+        return cmToUnits(i, lengthCm[i]);
+    }
+    void updateCalibration(int i) {
+        motors[i].updateCalibration(lengthCm[i], lengthSpeedCps[i]);
+    }
+    // every motor's loop timing, worst over the last 10-20 seconds
+    string getTimingSummary(float tickSeconds) const {
+        string summary;
+        for(const Motor& motor : motors) {
+            summary += motor.getTimingDescription(tickSeconds);
+        }
+        return summary;
+    }
+    ofVec3f getFloorDrop(int i) const {
+        ofVec3f floorDrop = pillarAttach[i];
+        floorDrop.z = 0;
+        return floorDrop;
+    }
+    void draw(ofVec3f eyePosition) const {
+        for(int i = 0; i < size(); i++) {
+            draw(i, eyePosition);
+        }
+        ofPolyline floor;
+        floor.close();
+        for(int i = 0; i < outline.size(); i++) {
+            floor.addVertex(getFloorDrop(outline[i]));
+        }
+        floor.draw();
+    }
+    void draw(int i, ofVec3f eyePosition) const {
+        const Motor& motor = motors[i];
+        ofPushMatrix();
+        ofPushStyle();
+        ofVec3f start = eyePosition + eyeAttach[i];
+        ofDrawLine(pillarAttach[i], getFloorDrop(i));
+        ofDrawLine(pillarAttach[i], start);
+        float targetLengthCm = (pillarAttach[i] - start).length();
+        float targetLengthUnits = cmToUnits(i, targetLengthCm);
+        float curPositionUnits = motor.status.encoder0Pos;
+        float curPositionCm = unitsToCm(i, curPositionUnits);
+        
+        ofTranslate(pillarAttach[i]);
+        ofDrawBitmapString(motor.name + " (" + ofToString(motor.id) + ")\n"+
+                           "target\n  position: ~" + ofToString(roundf(targetLengthCm)) + "cm / ~" + ofToString(roundf(targetLengthUnits)) + " units\n" +
+                           "  speed: ~" + ofToString(roundf(lengthSpeedCps[i])) + "cm/s\n" +
+                           "current\n  status: " + motor.getStatusDescription() + "\n" +
+                           "  position: ~" + ofToString(roundf(curPositionCm)) + " cm / ~" + ofToString(roundf(curPositionUnits)) + " units\n" +
+                           "  speed: " + ofToString(motor.status.currentSpeed) + " cm/s\n" +
+                           "  packets: " + ofToString(motor.status.received) + " (" + ofToString(motor.status.dropped) + " dropped, " + ofToString(motor.status.outOfOrder) + " late)\n" +
+                           "  encoder errors: " + ofToString(motor.status.encoderErrors) + "\n" +
+                           motor.calibration.getDescription(),
+                           10, 20);
+        ofPopStyle();
+        ofPopMatrix();
+    }
+protected:
+    static ofVec3f getVec3f(ofXml& config, string address) {
+        return ofVec3f(config.getFloatValue(address + "x"),
+                       config.getFloatValue(address + "y"),
+                       config.getFloatValue(address + "z"));
+    }
+};
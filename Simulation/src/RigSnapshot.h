@@ -0,0 +1,186 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Rig.h"
+#include "MotorClock.h"
+#include <atomic>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// what the server needs to pick up where it left off: the eye pose, and what
+// each motor last reported and was told, with its calibration fit.
+struct RigSnapshotMotor {
+    float encoderUnits; // last /status position
+    float commandedCm;
+    float calibrationTheta[2];
+    float calibrationP[2][2];
+    int32_t calibrationSamples;
+};
+
+struct RigSnapshotData {
+    uint64_t sequence; // starts at 1
+    double savedTime; // MotorClock::now()
+    float eyePosition[3];
+    float lookAngle;
+    uint32_t motorCount;
+    RigSnapshotMotor motors[MotorStatusReceiver::maxMotors];
+    uint32_t checksum; // of everything above
+};
+
+struct RigSnapshotHeader {
+    static const uint32_t magicNumber = 0x48525353; // HRSS
+    static const uint32_t currentVersion = 1;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dataBytes;
+    uint32_t padding;
+};
+
+// keeps the newest RigSnapshotData in a memory mapped file, saved every tick.
+// the pages belong to the kernel, so a snapshot survives the server crashing
+// or being killed, and they are written back to disk in the background. there
+// are two slots, written alternately, and each carries a checksum, so a save
+// torn by a crash leaves the previous one to load.
+class RigSnapshot {
+protected:
+    string path;
+    unsigned char* mapping = nullptr;
+    size_t mappingBytes = 0;
+    uint64_t sequence = 0;
+
+    RigSnapshotHeader& header() const {
+        return *(RigSnapshotHeader*) mapping;
+    }
+    RigSnapshotData* slots() const {
+        return (RigSnapshotData*) (mapping + sizeof(RigSnapshotHeader));
+    }
+    // fnv-1a
+    static uint32_t getChecksum(const RigSnapshotData& data) {
+        const unsigned char* bytes = (const unsigned char*) &data;
+        uint32_t hash = 2166136261u;
+        for(size_t i = 0; i < offsetof(RigSnapshotData, checksum); i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+    static bool isValid(const RigSnapshotData& data) {
+        return data.sequence > 0 && data.checksum == getChecksum(data);
+    }
+public:
+    ~RigSnapshot() {
+        close();
+    }
+    void close() {
+        if(mapping) {
+            msync(mapping, mappingBytes, MS_SYNC);
+            munmap(mapping, mappingBytes);
+            mapping = nullptr;
+        }
+    }
+    // again to pick up saves from another process since
+    bool setup(string path) {
+        close();
+        sequence = 0;
+        this->path = ofToDataPath(path);
+        int fd = ::open(this->path.c_str(), O_CREAT | O_RDWR, 0644);
+        if(fd < 0) {
+            ofLogError("RigSnapshot") << "can't open " << this->path << ": " << strerror(errno);
+            return false;
+        }
+        mappingBytes = sizeof(RigSnapshotHeader) + 2 * sizeof(RigSnapshotData);
+        struct stat info;
+        // a new or short file is zero filled up to size, which reads as no snapshot
+        if(fstat(fd, &info) != 0 || (info.st_size < (off_t) mappingBytes && ftruncate(fd, mappingBytes) != 0)) {
+            ofLogError("RigSnapshot") << "can't size " << this->path << ": " << strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        void* result = mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(result == MAP_FAILED) {
+            ofLogError("RigSnapshot") << "can't map " << this->path << ": " << strerror(errno);
+            return false;
+        }
+        mapping = (unsigned char*) result;
+        RigSnapshotHeader& file = header();
+        if(file.magic != RigSnapshotHeader::magicNumber ||
+           file.version != RigSnapshotHeader::currentVersion ||
+           file.dataBytes != sizeof(RigSnapshotData)) {
+            // from another build, or nothing yet
+            memset(mapping, 0, mappingBytes);
+            file.version = RigSnapshotHeader::currentVersion;
+            file.dataBytes = sizeof(RigSnapshotData);
+            file.magic = RigSnapshotHeader::magicNumber;
+        }
+        RigSnapshotData data;
+        if(load(data)) {
+            sequence = data.sequence;
+        }
+        return true;
+    }
+    // the newest complete snapshot
+    bool load(RigSnapshotData& data) const {
+        if(!mapping) {
+            return false;
+        }
+        const RigSnapshotData* newest = nullptr;
+        for(int i = 0; i < 2; i++) {
+            const RigSnapshotData& slot = slots()[i];
+            if(isValid(slot) && (!newest || slot.sequence > newest->sequence)) {
+                newest = &slot;
+            }
+        }
+        if(!newest) {
+            return false;
+        }
+        data = *newest;
+        return true;
+    }
+    void save(const Rig& rig, ofVec3f eyePosition, float lookAngle) {
+        if(!mapping) {
+            return;
+        }
+        RigSnapshotData& data = slots()[++sequence % 2];
+        data.sequence = sequence;
+        fill(data, rig, eyePosition, lookAngle);
+        // a crash before this leaves a checksum that doesn't match, and the other slot
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        data.checksum = getChecksum(data);
+    }
+    // asks for the pages to go to disk soon, for a power cut rather than a crash
+    void flush() {
+        if(mapping) {
+            msync(mapping, mappingBytes, MS_ASYNC);
+        }
+    }
+    // everything but the sequence and checksum
+    static void fill(RigSnapshotData& data, const Rig& rig, ofVec3f eyePosition, float lookAngle) {
+        data.savedTime = MotorClock::now();
+        data.eyePosition[0] = eyePosition.x;
+        data.eyePosition[1] = eyePosition.y;
+        data.eyePosition[2] = eyePosition.z;
+        data.lookAngle = lookAngle;
+        data.motorCount = rig.size();
+        for(int i = 0; i < rig.size(); i++) {
+            RigSnapshotMotor& motor = data.motors[i];
+            const CalibrationTracker& calibration = rig.motors[i].calibration;
+            motor.encoderUnits = rig.motors[i].status.encoder0Pos;
+            motor.commandedCm = rig.lengthCm[i];
+            memcpy(motor.calibrationTheta, calibration.theta, sizeof(motor.calibrationTheta));
+            memcpy(motor.calibrationP, calibration.P, sizeof(motor.calibrationP));
+            motor.calibrationSamples = calibration.samples;
+        }
+    }
+    static ofVec3f getEyePosition(const RigSnapshotData& data) {
+        return ofVec3f(data.eyePosition[0], data.eyePosition[1], data.eyePosition[2]);
+    }
+    static void restoreCalibration(Rig& rig, const RigSnapshotData& data) {
+        for(int i = 0; i < rig.size() && i < data.motorCount; i++) {
+            const RigSnapshotMotor& motor = data.motors[i];
+            rig.motors[i].calibration.restore(motor.calibrationTheta, motor.calibrationP, motor.calibrationSamples);
+        }
+    }
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RigSnapshot.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// one motor's last /status as the primary saw it
+struct ReplicatedMotor {
+    char statusMessage[16];
+    float encoder0Pos;
+    float currentSpeed;
+    int32_t timedOut;
+};
+
+// everything a standby needs to carry on from the primary's last tick, sent
+// every tick, so it doubles as the heartbeat
+struct ControlState {
+    static const uint32_t magicNumber = 0x48435354; // HCST
+    static const uint32_t currentVersion = 1;
+    enum Flags {
+        EVERYTHING_OK = 1,
+        MOTORS_POWER = 2,
+        VISITOR_MODE = 4,
+        INTERACTION_TIMEOUT_ENABLED = 8,
+        INTERACTION_TIMED_OUT = 16,
+        HOMING = 32, // the standby stops everything rather than finish it
+        WARM_START = 64, // no /go yet, the standby holds too
+        EXITING = 128 // shut down on purpose, nothing to take over
+    };
+    uint32_t magic;
+    uint32_t version;
+    uint64_t instance; // when the primary started, a restarted primary is a new instance
+    uint64_t sequence;
+    uint32_t flags;
+    float tickSeconds;
+    float eyeVelocity[3]; // what the cable limiter let through last tick
+    float moveSpeedCps;
+    int32_t interactionRemainingMillis;
+    ReplicatedMotor motors[MotorStatusReceiver::maxMotors];
+    RigSnapshotData rig; // eye pose, look angle, commanded lengths and calibration
+};
+
+// sent back to the primary every tick for as long as a standby has control
+struct TakeoverNotice {
+    static const uint32_t magicNumber = 0x4854414b; // HTAK
+    uint32_t magic;
+    uint64_t instance; // the primary that was replaced
+    float eyePosition[3]; // where the standby has the eye now
+    float lookAngle;
+};
+
+// a non blocking udp socket for the replication stream between a primary and
+// its standby. plain datagrams of the structs above, both ends are the same
+// build. the primary sends ControlState to the standby's port, the standby
+// answers a takeover to wherever the last ControlState came from.
+class StandbyLink {
+protected:
+    int fd = -1;
+    sockaddr_in peer;
+    bool hasPeer = false;
+
+    bool open(int port) {
+        close();
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(fd < 0) {
+            ofLogError("StandbyLink") << "can't open a socket: " << strerror(errno);
+            return false;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        sockaddr_in local = sockaddr_in();
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons(port);
+        if(bind(fd, (sockaddr*) &local, sizeof(local)) != 0) {
+            ofLogError("StandbyLink") << "can't listen on " << port << ": " << strerror(errno);
+            close();
+            return false;
+        }
+        return true;
+    }
+    void close() {
+        if(fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    template <class T>
+    void send(const T& message) {
+        if(fd >= 0 && hasPeer) {
+            sendto(fd, &message, sizeof(message), 0, (sockaddr*) &peer, sizeof(peer));
+        }
+    }
+    // the next datagram of exactly this type, false once there are no more
+    template <class T>
+    bool receive(T& message, sockaddr_in* from = nullptr) {
+        while(fd >= 0) {
+            sockaddr_in source;
+            socklen_t sourceBytes = sizeof(source);
+            ssize_t n = recvfrom(fd, &message, sizeof(message), 0, (sockaddr*) &source, &sourceBytes);
+            if(n < 0) {
+                return false;
+            }
+            if(n == sizeof(message) && message.magic == T::magicNumber) {
+                if(from) {
+                    *from = source;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+public:
+    ~StandbyLink() {
+        close();
+    }
+    bool isOpen() const {
+        return fd >= 0;
+    }
+};
+
+class PrimaryLink : public StandbyLink {
+protected:
+    uint64_t sequence = 0;
+public:
+    uint64_t instance = 0;
+
+    bool setup(string host, int port) {
+        // any local port, the standby replies to whichever it was
+        if(!open(0)) {
+            return false;
+        }
+        addrinfo hints = addrinfo(), *result = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if(getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result) {
+            ofLogError("PrimaryLink") << "can't find standby host " << host;
+            close();
+            return false;
+        }
+        peer = *(sockaddr_in*) result->ai_addr;
+        peer.sin_port = htons(port);
+        freeaddrinfo(result);
+        hasPeer = true;
+        sequence = 0;
+        instance = MotorClock::now() * 1e6;
+        return true;
+    }
+    // fill in everything but the header and send it
+    void send(ControlState& tick) {
+        tick.magic = ControlState::magicNumber;
+        tick.version = ControlState::currentVersion;
+        tick.instance = instance;
+        tick.sequence = ++sequence;
+        StandbyLink::send(tick);
+    }
+    // true if a standby says it has control instead of this instance, with its newest notice
+    bool checkTakeover(TakeoverNotice& latest) {
+        TakeoverNotice notice;
+        bool replaced = false;
+        while(receive(notice)) {
+            if(notice.instance == instance) {
+                latest = notice;
+                replaced = true;
+            }
+        }
+        return replaced;
+    }
+    // a new instance as far as the standby is concerned, which hands back control
+    void restart() {
+        instance++;
+        sequence = 0;
+    }
+};
+
+class StandbyReceiver : public StandbyLink {
+public:
+    bool setup(int port) {
+        return open(port);
+    }
+    // the next ControlState in the order they arrived, call until false for the newest
+    bool receive(ControlState& state) {
+        sockaddr_in from;
+        while(StandbyLink::receive(state, &from)) {
+            if(state.version == ControlState::currentVersion) {
+                // takeover notices go back to whoever is sending
+                peer = from;
+                hasPeer = true;
+                return true;
+            }
+        }
+        return false;
+    }
+    void sendTakeover(uint64_t instance, ofVec3f eyePosition, float lookAngle) {
+        TakeoverNotice notice = TakeoverNotice();
+        notice.magic = TakeoverNotice::magicNumber;
+        notice.instance = instance;
+        notice.eyePosition[0] = eyePosition.x;
+        notice.eyePosition[1] = eyePosition.y;
+        notice.eyePosition[2] = eyePosition.z;
+        notice.lookAngle = lookAngle;
+        send(notice);
+    }
+};
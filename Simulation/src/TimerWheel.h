@@ -0,0 +1,193 @@
+#pragma once
+
+#include "ofMain.h"
+#include <chrono>
+#include <functional>
+
+// hierarchical timer wheel with 1ms ticks on a monotonic clock.
+// arming and cancelling are O(1): a timer is unlinked from or linked into one
+// slot of one of four 64 slot wheels (about 4.6 hours of range). as time
+// passes, timers cascade down from the coarse wheels into the 1ms wheel and
+// fire in deadline order. callbacks run on whichever thread calls update(),
+// and may arm or cancel any timer, including the one that is firing.
+class TimerWheel {
+public:
+    typedef uint64_t Millis;
+
+    class Timer {
+        friend class TimerWheel;
+        Timer *prev = nullptr, *next = nullptr;
+        Millis deadline = 0;
+        Millis period = 0;
+        std::function<void()> callback;
+    public:
+        Timer() {
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer() {
+            unlink();
+        }
+        void setCallback(std::function<void()> callback) {
+            this->callback = callback;
+        }
+        bool isArmed() const {
+            return next != nullptr;
+        }
+        Millis getDeadline() const {
+            return deadline;
+        }
+    private:
+        void unlink() {
+            if(next) {
+                prev->next = next;
+                next->prev = prev;
+                prev = next = nullptr;
+            }
+        }
+    };
+
+    static const int levels = 4;
+    static const int slotBits = 6;
+    static const int slots = 1 << slotBits;
+    static const int slotMask = slots - 1;
+
+protected:
+    Timer wheel[levels][slots]; // list heads
+    Millis current = 0;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    TimerWheel() : start(std::chrono::steady_clock::now()) {
+        for(int level = 0; level < levels; level++) {
+            for(int slot = 0; slot < slots; slot++) {
+                Timer& head = wheel[level][slot];
+                head.prev = head.next = &head;
+            }
+        }
+    }
+    ~TimerWheel() {
+        // leave the heads looking empty so armed timers can still unlink safely
+        for(int level = 0; level < levels; level++) {
+            for(int slot = 0; slot < slots; slot++) {
+                Timer& head = wheel[level][slot];
+                while(head.next != &head) {
+                    head.next->unlink();
+                }
+                head.prev = head.next = nullptr;
+            }
+        }
+    }
+    // milliseconds on the monotonic clock since the wheel was created
+    Millis now() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    // fire once, delay milliseconds from now. re-arming an armed timer moves it.
+    void arm(Timer& timer, Millis delay) {
+        timer.unlink();
+        timer.period = 0;
+        timer.deadline = now() + delay;
+        insert(timer);
+    }
+    // fire every period milliseconds, starting one period from now
+    void armPeriodic(Timer& timer, Millis period) {
+        timer.unlink();
+        timer.period = MAX(period, (Millis) 1);
+        timer.deadline = now() + timer.period;
+        insert(timer);
+    }
+    void cancel(Timer& timer) {
+        timer.unlink();
+    }
+    // fire everything that is due, in deadline order
+    void update() {
+        Millis target = now();
+        while(current < target) {
+            current++;
+            int index = current & slotMask;
+            if(index == 0) {
+                cascade(1);
+            }
+            fire(wheel[0][index]);
+        }
+    }
+
+protected:
+    // new timers go in at the next tick at the earliest, the tick we are on has been handled.
+    // cascading timers may still land on the current tick, it is handled right after.
+    void insert(Timer& timer, bool cascading = false) {
+        Millis deadline = MAX(timer.deadline, cascading ? current : current + 1);
+        Millis delta = deadline - current;
+        int level = 0;
+        while(level + 1 < levels && delta >= ((Millis) 1 << (slotBits * (level + 1)))) {
+            level++;
+        }
+        Millis maxDelta = (Millis) 1 << (slotBits * levels);
+        if(delta >= maxDelta) {
+            // past the end of the outermost wheel, park it there and let it cascade again
+            deadline = current + maxDelta - 1;
+        }
+        int slot = (deadline >> (slotBits * level)) & slotMask;
+        link(wheel[level][slot], timer);
+    }
+    static void link(Timer& head, Timer& timer) {
+        timer.prev = head.prev;
+        timer.next = &head;
+        head.prev->next = &timer;
+        head.prev = &timer;
+    }
+    // move the timers in the slot we just reached on this level down a level
+    void cascade(int level) {
+        if(level >= levels) {
+            return;
+        }
+        int index = (current >> (slotBits * level)) & slotMask;
+        if(index == 0) {
+            cascade(level + 1);
+        }
+        Timer pending;
+        take(wheel[level][index], pending);
+        while(pending.next != &pending) {
+            Timer& timer = *pending.next;
+            timer.unlink();
+            insert(timer, true);
+        }
+        pending.prev = pending.next = nullptr;
+    }
+    void fire(Timer& head) {
+        if(head.next == &head) {
+            return;
+        }
+        // detach the slot first so callbacks can arm into it or cancel out of it
+        Timer pending;
+        take(head, pending);
+        while(pending.next != &pending) {
+            Timer& timer = *pending.next;
+            timer.unlink();
+            if(timer.deadline > current) {
+                // parked beyond the outer wheel, not due yet
+                insert(timer);
+                continue;
+            }
+            if(timer.period) {
+                // after a stall, skip the periods we missed instead of firing every tick
+                timer.deadline = MAX(timer.deadline + timer.period, current + timer.period);
+                insert(timer);
+            }
+            if(timer.callback) {
+                timer.callback();
+            }
+        }
+        pending.prev = pending.next = nullptr;
+    }
+    static void take(Timer& from, Timer& to) {
+        to.prev = to.next = &to;
+        if(from.next != &from) {
+            to.next = from.next;
+            to.prev = from.prev;
+            to.next->prev = &to;
+            to.prev->next = &to;
+            from.prev = from.next = &from;
+        }
+    }
+};
@@ -1,20 +1,26 @@
 // todo:
 // clean up variables / config
-// add homing function
 // quadlaterate on startup
 // load all config via json/xml
 // move osc output to threaded loop (not graphics loop)
 
 #include "ofMain.h"
-#include "ofxSyphon.h"
 #include "ofxOsc.h"
 #include "ofxConnexion.h"
 #include "ofxGui.h"
-#include "ofxTiming.h"
 
-#include "Motor.h"
+#include "Rig.h"
+#include "CableLimiter.h"
+#include "HomingSequence.h"
+#include "RigSnapshot.h"
+#include "StandbyLink.h"
+#include "MotorStatusReceiver.h"
+#include "TimerWheel.h"
+#include "OscBundleSender.h"
+#include "SharedFrameRing.h"
+#include "Profiler.h"
 
-const float resetWaitTime = 2000;
+const TimerWheel::Millis resetWaitTime = 2000;
 
 const float width = 607, depth = 608, height = 357;
 const float eyeStartHeight = 275;
@@ -33,6 +39,74 @@ const float visitorFloor = 240; // cm
 const float visitorCeiling = 270; // cm
 const float visitorRadius = 190; // cm
 
+// the hard limits, and the visitor's flight zone when in visitor mode
+ofVec3f clampEyePosition(ofVec3f eyePosition, bool visitorMode) {
+    eyePosition = ofVec3f(ofClamp(eyePosition.x, -eyeWidthMax, +eyeWidthMax),
+                          ofClamp(eyePosition.y, -eyeDepthMax, +eyeDepthMax),
+                          ofClamp(eyePosition.z, eyeHeightMin, eyeHeightMax));
+    
+    if (visitorMode) {
+        // enforce audience-control flight zone
+        eyePosition = ofVec3f(ofClamp(eyePosition.x, -visitorRadius, +visitorRadius),
+                              ofClamp(eyePosition.y, -visitorRadius, +visitorRadius),
+                              ofClamp(eyePosition.z, visitorFloor, visitorCeiling));
+        float radial = sqrt(eyePosition.x * eyePosition.x + eyePosition.y * eyePosition.y);
+        if (radial > visitorRadius) {
+            eyePosition = ofVec3f(eyePosition.x * visitorRadius / radial,
+                                  eyePosition.y * visitorRadius / radial,
+                                  eyePosition.z);
+        }
+        
+        /*
+         // make it a triangle!
+        int corner = 2;
+        float angle = 45 + 90 * corner;
+        eyePosition = eyePosition.getRotated(+angle, ofVec3f(0, 0, 1));
+        eyePosition = ofVec3f(MAX(0, eyePosition.x), eyePosition.y, eyePosition.z);
+        eyePosition = eyePosition.getRotated(-angle, ofVec3f(0, 0, 1));
+        */
+        // restrict to ~ back half
+        eyePosition = ofVec3f(ofClamp(eyePosition.x, -visitorRadius, +visitorRadius),
+//                              ofClamp(eyePosition.y, -50, +visitorRadius),
+                              ofClamp(eyePosition.y, -visitorRadius, +visitorRadius),
+                              ofClamp(eyePosition.z, visitorFloor, visitorCeiling));
+    }
+    return eyePosition;
+}
+
+// config shared by the server and its standby
+void setupMotorLimits(ofXml& config) {
+    Motor::statusTimeoutSeconds = config.getFloatValue("motors/statusTimeoutSeconds");
+    CalibrationTracker::forgetting = config.getFloatValue("motors/calibration/forgetting");
+    CalibrationTracker::stillSpeedCps = config.getFloatValue("motors/calibration/stillSpeed");
+    CalibrationTracker::slipThresholdCm = config.getFloatValue("motors/calibration/slip/cm");
+    CalibrationTracker::slipSamples = config.getIntValue("motors/calibration/slip/samples");
+    CalibrationTracker::slipClearSamples = config.getIntValue("motors/calibration/slip/clearSamples");
+    CalibrationTracker::driftThresholdCm = config.getFloatValue("motors/calibration/drift/cm");
+}
+
+bool isEverythingOk(const Rig& rig, bool stopOnCalibrationAlarm) {
+    bool everythingOk = true;
+    for(int i = 0; i < rig.size(); i++) {
+        const Motor& cur = rig.motors[i];
+        const string& msg = cur.status.statusMessage;
+        // whitelist of non-problematic states
+        if(!(msg == "OK" ||
+             msg == "HOMING" ||
+             msg == "HOMINGBACKOFF" ||
+             msg == "MOTOROFF")) {
+            everythingOk = false;
+        }
+        if(cur.timedOut) {
+            everythingOk = false;
+        }
+        if(stopOnCalibrationAlarm && cur.calibration.getAlarm()) {
+            everythingOk = false;
+        }
+    }
+    return everythingOk;
+}
+
 enum LiveMode {
     LIVE_MODE_XY,
     LIVE_MODE_XZ
@@ -42,31 +116,46 @@ class ofApp : public ofBaseApp {
 public:
     ofFile connexionLog, positionLog;
     ofVec3f lastEyePosition;
-    DelayTimer connexionLogTimer, positionLogTimer;
+    bool connexionLogDue = true, positionLogDue = true;
+    
+    // every timeout and periodic job runs off this, advanced once per update()
+    TimerWheel timers;
+    TimerWheel::Timer connexionLogTimer, positionLogTimer, refreshTimer, resetTimer, interactionTimer, clockSyncTimer, warmStartTimer, snapshotFlushTimer;
     
-    ofxSyphonClient syphonCam;
-    ofxOscSender oscMotorsSend, oscOculusSend;
-    ofxOscReceiver oscMotorsReceive;
-    Motor nw, ne, sw, se;
-    vector<Motor*> motorsSorted;
+    SharedFrameViewer cameraViewer;
+    ofPixels cameraPreview;
+    ofTexture cameraTexture;
+    ofxOscSender oscOculusSend;
+    OscBundleSender oscMotorsSend; // one bundle per tick, see flush() in update()
+    MotorStatusReceiver oscMotorsReceive;
+    Rig rig;
+    CableLimiter cableLimiter;
+    HomingSequence homing;
+    RigSnapshot snapshot;
+    string snapshotPath;
+    RigSnapshotData warmStartSnapshot;
+    bool warmStartPending = false;
+    float warmStartMaxResidualCm = 3, warmStartMaxMoveCm = 10;
+    PrimaryLink standbyLink;
+    TakeoverNotice standbyNotice;
+    bool standbyHasControl = false;
     float motorStatusTimeoutSeconds;
+    bool stopOnCalibrationAlarm = false;
     int motorStatusInterval = 50;
     ofEasyCam cam;
     ofVec2f mouseStart, mouseVec;
     ofVec3f moveVecCps;
     float lookAngle, lookAngleDefault, lookAngleSpeedDps;
     float homeSpeedCps = 10, maxSpeedCps = 50;
-    DelayTimer refreshTimer;
     bool resetCompleted = false;
-    unsigned long lastResetTime = 0;
     ofImage shadow;
     int liveMode;
     bool live = false;
+    bool showProfile = false;
     
     // interaction timeout
-    float lastInteractionTime = 0;
     float interactionTimeoutSeconds;
-    bool interactionTimedOut;
+    bool interactionTimedOut = false;
     
     ofxConnexion connexion;
     
@@ -74,7 +163,7 @@ public:
     ofParameter<bool> everythingOk, lockLookAngle, visitorMode, motorsStart, motorsPower, interactionTimeoutEnabled;
     ofParameter<float> lookAngleOffset, moveSpeedCps;
     ofParameter<ofVec3f> eyePosition, connexionPosition, connexionRotation;
-    ofxButton resetBtn, resetLookAngleBtn, toggleFullscreenBtn, visitorModeBtn;
+    ofxButton resetBtn, homeBtn, reclaimBtn, resetLookAngleBtn, toggleFullscreenBtn, visitorModeBtn;
     
     void setup() {
         ofSetFrameRate(40);
@@ -85,34 +174,53 @@ public:
         }
         
         maxSpeedCps = config.getFloatValue("motors/speed/max");
-        refreshTimer.setPeriod(config.getFloatValue("motors/refreshPeriodSeconds"));
-        Motor::statusTimeoutSeconds = config.getFloatValue("motors/statusTimeoutSeconds");
+        cableLimiter.setup(config, "motors/cable/");
+        homing.setup(config, "motors/homing/");
+        if(config.getBoolValue("motors/standby/enabled")) {
+            standbyLink.setup(config.getValue("motors/standby/host"), config.getIntValue("motors/standby/port"));
+        }
+        refreshTimer.setCallback([this] {
+            moveSpeedCps = moveSpeedCps;
+        });
+        timers.armPeriodic(refreshTimer, 1000 * config.getFloatValue("motors/refreshPeriodSeconds"));
         motorStatusInterval = config.getIntValue("motors/statusIntervalMilliseconds");
+        // the ping rides in the tick's bundle, whose timetag says when it left
+        clockSyncTimer.setCallback([this] {
+            ofxOscMessage msg;
+            msg.setAddress("/ping");
+            oscMotorsSend.add(msg);
+        });
+        timers.armPeriodic(clockSyncTimer, 1000 * config.getFloatValue("motors/clockSync/pingPeriodSeconds"));
+        
+        setupMotorLimits(config);
+        stopOnCalibrationAlarm = config.getBoolValue("motors/calibration/stopOnAlarm");
         
         interactionTimeoutEnabled = config.getBoolValue("interaction/timeout/enabled");
         interactionTimeoutSeconds = config.getFloatValue("interaction/timeout/seconds");
+        interactionTimer.setCallback([this] {
+            interactionTimedOut = true;
+        });
+        timers.arm(interactionTimer, 1000 * interactionTimeoutSeconds);
         
-        nw.setup("nw", config, "motors/nw/");
-        ne.setup("ne", config, "motors/ne/");
-        se.setup("se", config, "motors/se/");
-        sw.setup("sw", config, "motors/sw/");
-        motorsSorted.resize(4);
-        motorsSorted[nw.id] = &nw;
-        motorsSorted[ne.id] = &ne;
-        motorsSorted[se.id] = &se;
-        motorsSorted[sw.id] = &sw;
+        if(!rig.setup(config, "motors/rig")) {
+            ofExit();
+        }
+        // the snapshot is checked against the rig, so this needs it set up
+        bool warmStart = setupWarmStart(config, "motors/warmStart/");
         
         lookAngleDefault = config.getFloatValue("oculus/lookAngle/default");
         lookAngleOffset = config.getFloatValue("oculus/lookAngle/offset");;
         lookAngleSpeedDps = config.getFloatValue("oculus/lookAngle/speed");
         
-        syphonCam.setup();
-        syphonCam.set("","Black Syphon");
+        cameraViewer.setup(config.getValue("camera/name"));
         
         positionLog.open("position.log", ofFile::WriteOnly);
         connexionLog.open("connexion.log", ofFile::WriteOnly);
-        positionLogTimer.setPeriod(1);
-        connexionLogTimer.setPeriod(1);
+        positionLogTimer.setCallback([this] { positionLogDue = true; });
+        connexionLogTimer.setCallback([this] { connexionLogDue = true; });
+        timers.armPeriodic(positionLogTimer, 1000);
+        timers.armPeriodic(connexionLogTimer, 1000);
+        resetTimer.setCallback([this] { checkResetCompleted(); });
         
         oscOculusSend.setup("localhost", config.getIntValue("oculus/osc/sendPort"));
         oscMotorsSend.setup(config.getValue("motors/osc/host"), config.getIntValue("motors/osc/sendPort"));
@@ -122,16 +230,6 @@ public:
         shadow.load("shadow.png");
         cam.setFov(50);
         
-        nw.eyeAttach.set(-eyeWidth / 2, +eyeDepth / 2, attachHeight);
-        ne.eyeAttach.set(+eyeWidth / 2, +eyeDepth / 2, attachHeight);
-        sw.eyeAttach.set(-eyeWidth / 2, -eyeDepth / 2, attachHeight);
-        se.eyeAttach.set(+eyeWidth / 2, -eyeDepth / 2, attachHeight);
-        
-        nw.pillarAttach.set(-width / 2, +depth / 2, height);
-        ne.pillarAttach.set(+width / 2, +depth / 2, height);
-        sw.pillarAttach.set(-width / 2, -depth / 2, height);
-        se.pillarAttach.set(+width / 2, -depth / 2, height);
-        
         connexion.start();
         ofAddListener(connexion.connexionEvent, this, &ofApp::connexionData);
         
@@ -143,6 +241,10 @@ public:
         toggleFullscreenBtn.addListener(this, &ofApp::toggleFullscreen);
         gui.add(resetBtn.setup("Reset everything"));
         resetBtn.addListener(this, &ofApp::reset);
+        gui.add(homeBtn.setup("Home all motors"));
+        homeBtn.addListener(this, &ofApp::startHoming);
+        gui.add(reclaimBtn.setup("Take back control"));
+        reclaimBtn.addListener(this, &ofApp::reclaimControl);
         gui.add(motorsStart.set("Motors start", false));
         motorsStart.addListener(this, &ofApp::setMotorsStart);
         gui.add(motorsPower.set("Motors power", false));
@@ -166,6 +268,79 @@ public:
                                 ofVec3f(-eyeWidthMax, -eyeDepthMax, eyeHeightMin),
                                 ofVec3f(+eyeWidthMax, +eyeDepthMax, eyeHeightMax)));
         requireMovement();
+        if(warmStart) {
+            eyePosition = RigSnapshot::getEyePosition(warmStartSnapshot);
+        } else {
+            reset();
+        }
+    }
+    // a snapshot recent enough to try, the motors have the final say in checkWarmStart()
+    bool setupWarmStart(ofXml& config, string address) {
+        warmStartMaxResidualCm = config.getFloatValue(address + "maxResidualCm");
+        warmStartMaxMoveCm = config.getFloatValue(address + "maxMoveCm");
+        snapshotFlushTimer.setCallback([this] { snapshot.flush(); });
+        timers.armPeriodic(snapshotFlushTimer, 1000);
+        warmStartTimer.setCallback([this] {
+            failWarmStart("not every motor reported in time");
+        });
+        snapshotPath = config.getValue(address + "path");
+        if(!snapshot.setup(snapshotPath) || !snapshot.load(warmStartSnapshot)) {
+            return false;
+        }
+        double age = MotorClock::now() - warmStartSnapshot.savedTime;
+        if(warmStartSnapshot.motorCount != rig.size() || age < 0 || age > config.getFloatValue(address + "maxAgeSeconds")) {
+            ofLogNotice("warmStart") << "snapshot from " << age << "s ago for " << warmStartSnapshot.motorCount << " motors, starting cold";
+            return false;
+        }
+        // nothing goes to the motors until they agree, they hold where they were told last
+        warmStartPending = true;
+        lookAngle = warmStartSnapshot.lookAngle;
+        timers.arm(warmStartTimer, 1000 * config.getFloatValue(address + "waitSeconds"));
+        ofLogNotice("warmStart") << "snapshot from " << age << "s ago, waiting for the motors";
+        return true;
+    }
+    // once every motor has reported, where their encoders put the eye has to
+    // match the snapshot, and the cables have to agree on it
+    void checkWarmStart() {
+        vector<float> encoderCm(rig.size());
+        for(int i = 0; i < rig.size(); i++) {
+            const Motor& motor = rig.motors[i];
+            if(!motor.status.received) {
+                return;
+            }
+            const string& status = motor.status.statusMessage;
+            if(!(status == "OK" || status == "STOPPED" || status == "MOTOROFF")) {
+                failWarmStart(motor.name + " is " + status);
+                return;
+            }
+            encoderCm[i] = rig.unitsToCm(i, motor.status.encoder0Pos);
+        }
+        ofVec3f saved = RigSnapshot::getEyePosition(warmStartSnapshot);
+        ofVec3f solved = saved;
+        float residualCm = rig.solveEyePosition(encoderCm, solved);
+        float moveCm = solved.distance(saved);
+        if(residualCm > warmStartMaxResidualCm || moveCm > warmStartMaxMoveCm) {
+            failWarmStart("the encoders put the eye " + ofToString(moveCm, 1) + "cm from the snapshot, cables off by " + ofToString(residualCm, 1) + "cm");
+            return;
+        }
+        warmStartPending = false;
+        timers.cancel(warmStartTimer);
+        RigSnapshot::restoreCalibration(rig, warmStartSnapshot);
+        eyePosition = solved;
+        rig.update(eyePosition, 1. / ofGetTargetFrameRate());
+        cableLimiter.reset();
+        setMotorsStatusInterval(motorStatusInterval);
+        moveSpeedCps = maxSpeedCps;
+        resetCompleted = true;
+        ofLogNotice("warmStart") << "resumed at " << solved << ", " << moveCm << "cm from the snapshot, cables within " << residualCm << "cm";
+    }
+    void failWarmStart(string reason) {
+        if(!warmStartPending) {
+            return;
+        }
+        warmStartPending = false;
+        timers.cancel(warmStartTimer);
+        ofLogWarning("warmStart") << reason << ", starting cold";
         reset();
     }
     void requireMovement() {
@@ -178,12 +353,46 @@ public:
     }
     void reset() {
         resetCompleted = false;
+        for(int i = 0; i < rig.size(); i++) {
+            rig.motors[i].calibration.reset();
+        }
         setMotorsStatusInterval(motorStatusInterval);
-        lastResetTime = ofGetElapsedTimeMillis();
+        timers.arm(resetTimer, resetWaitTime);
+        cableLimiter.reset();
         moveSpeedCps = homeSpeedCps;
         eyePosition = eyeHomePosition;
         resetLookAngle();
     }
+    // every motor at once, the eye comes back to where it is now
+    void startHoming() {
+        if(standbyHasControl) {
+            return;
+        }
+        requireMovement();
+        homing.start(rig, eyePosition);
+    }
+    // after a reset, wait for the motors to settle at home before speeding up
+    void checkResetCompleted() {
+        if(resetCompleted || moveSpeedCps >= maxSpeedCps) {
+            return;
+        }
+        bool ready = everythingOk;
+        for(int i = 0; i < rig.size(); i++) {
+            if(rig.motors[i].status.currentSpeed != 0) {
+                ready = false;
+            }
+        }
+        if(ready) {
+            moveSpeedCps = maxSpeedCps;
+            resetCompleted = true;
+        } else {
+            timers.arm(resetTimer, motorStatusInterval);
+        }
+    }
+    void interacted() {
+        interactionTimedOut = false;
+        timers.arm(interactionTimer, 1000 * interactionTimeoutSeconds);
+    }
     void resetLookAngle() {
         lookAngle = lookAngleDefault;
     }
@@ -209,9 +418,10 @@ public:
         float movementThreshold = 0.05;
         if (npos.length() > movementThreshold ||
             nrot.length() > movementThreshold) {
-            lastInteractionTime = ofGetElapsedTimef();
+            interacted();
             
-            if(connexionLogTimer.tick()) {
+            if(connexionLogDue) {
+                connexionLogDue = false;
                 connexionLog << ofGetTimestampString()
                     << "\t" << npos.x
                     << "\t" << npos.y
@@ -227,7 +437,7 @@ public:
         ofLog() << address;
         ofxOscMessage msg;
         msg.setAddress(address);
-        oscMotorsSend.sendMessage(msg, false);
+        oscMotorsSend.add(msg);
     }
     void setMotorsStart(bool& start) {
         sendMotorsAllCommand(start ? "/resume" : "/stop");
@@ -238,7 +448,7 @@ public:
         ofxOscMessage msg;
         msg.setAddress("/motor");
         msg.addIntArg(powerInt);
-        oscMotorsSend.sendMessage(msg, false);
+        oscMotorsSend.add(msg);
     }
     void setMotorsStatusInterval(int intervalMsec) {
         // time between /status reports in msec
@@ -246,77 +456,159 @@ public:
         //ofLog() << "/statusinterval " << intervalMsec;
         msg.setAddress("/statusinterval");
         msg.addIntArg(intervalMsec);
-        oscMotorsSend.sendMessage(msg, false);
+        oscMotorsSend.add(msg);
     }
     void sendMotorsEachCommand(string address, float value) {
         ofLog() << address << " " << value;
-        for(int i = 0; i < 4; i++) {
+        for(int i = 0; i < rig.size(); i++) {
             ofxOscMessage msg;
             msg.setAddress(address);
             msg.addIntArg(i);
             msg.addFloatArg(value);
-            oscMotorsSend.sendMessage(msg, false);
+            oscMotorsSend.add(msg);
         }
     }
     void moveSpeedChange(float& value) {
-        sendMotorsEachCommand("/maxspeed", moveSpeedCps * 1.25);
+        // the cable limiter keeps commanded cable speeds under its own limit,
+        // so the firmware never needs to go faster than that
+        sendMotorsEachCommand("/maxspeed", MIN(moveSpeedCps, cableLimiter.maxSpeedCps) * 1.25);
+    }
+    // from the standby, once it has taken over. it yields as soon as it hears from a new instance
+    void reclaimControl() {
+        if(!standbyHasControl) {
+            return;
+        }
+        standbyHasControl = false;
+        standbyLink.restart();
+        // the standby saved past our sequence, so pick up from its last save
+        snapshot.setup(snapshotPath);
+        rig.update(eyePosition, 1. / ofGetTargetFrameRate());
+        cableLimiter.reset();
+        interacted();
+        ofLogNotice("standby") << "took back control at " << eyePosition;
     }
     void exit() {
+        // the standby stays out of it when we quit on purpose
+        replicateState(ControlState::EXITING);
         motorsStart = false;
         motorsPower = false;
+        flushMotors();
         connexion.stop();
+        oscMotorsReceive.stop();
     }
     void update() {
+        Profiler::get().update();
+        checkStandby();
+        timers.update();
+        updateCamera();
         updateStatus();
         updateConnexion();
         updateMouse();
-        if(everythingOk) {
+        if(standbyHasControl) {
+            // the standby is sending /go, show where it has the eye
+            eyePosition = ofVec3f(standbyNotice.eyePosition[0], standbyNotice.eyePosition[1], standbyNotice.eyePosition[2]);
+            lookAngle = standbyNotice.lookAngle;
+            cableLimiter.reset();
+        } else if(warmStartPending) {
+            checkWarmStart();
+        } else if(homing.isActive()) {
+            // homing has its own checks, and stops everything if a motor misbehaves
+            updateHoming();
+        } else if(everythingOk) {
             updateEye();
             updateMotors();
+            snapshot.save(rig, eyePosition, lookAngle);
+        } else {
+            // don't coast on a stale velocity once things recover
+            cableLimiter.reset();
         }
         updateOculus();
+        replicateState();
+        // everything the motors were told this tick goes out together
+        flushMotors();
+    }
+    void flushMotors() {
+        if(standbyHasControl) {
+            // anything from here would fight the standby's /go
+            oscMotorsSend.clear();
+        } else {
+            oscMotorsSend.flush();
+        }
+    }
+    // first thing every tick, so a server that hung finds out before it sends anything
+    void checkStandby() {
+        if(standbyLink.checkTakeover(standbyNotice) && !standbyHasControl) {
+            standbyHasControl = true;
+            ofLogError("standby") << "the standby has taken over, nothing more goes to the motors from here";
+        }
+    }
+    // to the standby every tick, which is also how it knows we're still here
+    void replicateState(uint32_t flags = 0) {
+        if(!standbyLink.isOpen() || standbyHasControl) {
+            return;
+        }
+        ControlState state = ControlState();
+        state.flags = flags;
+        if(everythingOk) state.flags |= ControlState::EVERYTHING_OK;
+        if(motorsPower) state.flags |= ControlState::MOTORS_POWER;
+        if(visitorMode) state.flags |= ControlState::VISITOR_MODE;
+        if(interactionTimeoutEnabled) state.flags |= ControlState::INTERACTION_TIMEOUT_ENABLED;
+        if(interactionTimedOut) state.flags |= ControlState::INTERACTION_TIMED_OUT;
+        if(homing.isActive()) state.flags |= ControlState::HOMING;
+        if(warmStartPending) state.flags |= ControlState::WARM_START;
+        state.tickSeconds = 1. / ofGetTargetFrameRate();
+        state.eyeVelocity[0] = cableLimiter.previousVelocity.x;
+        state.eyeVelocity[1] = cableLimiter.previousVelocity.y;
+        state.eyeVelocity[2] = cableLimiter.previousVelocity.z;
+        state.moveSpeedCps = moveSpeedCps;
+        if(interactionTimer.isArmed()) {
+            state.interactionRemainingMillis = MAX(0, (int64_t) (interactionTimer.getDeadline() - timers.now()));
+        }
+        for(int i = 0; i < rig.size(); i++) {
+            const Motor& cur = rig.motors[i];
+            ReplicatedMotor& motor = state.motors[i];
+            strncpy(motor.statusMessage, cur.status.statusMessage.c_str(), sizeof(motor.statusMessage) - 1);
+            motor.encoder0Pos = cur.status.encoder0Pos;
+            motor.currentSpeed = cur.status.currentSpeed;
+            motor.timedOut = cur.timedOut;
+        }
+        RigSnapshot::fill(state.rig, rig, eyePosition, lookAngle);
+        standbyLink.send(state);
+    }
+    void updateCamera() {
+        PROFILE_SCOPE("capture");
+        if(cameraViewer.update(cameraPreview, 640, 360)) {
+            cameraTexture.loadData(cameraPreview);
+        }
     }
     void updateStatus() {
-        float curTime = ofGetElapsedTimef();
-        while(oscMotorsReceive.hasWaitingMessages()) {
-            ofxOscMessage msg;
-            oscMotorsReceive.getNextMessage(&msg);
-            if(msg.getAddress() == "/status") {
-                int motorId = msg.getArgAsInt32(0);
-                Motor& cur = *motorsSorted[motorId];
-                cur.lastMessageTime = curTime;
-                Motor::Status& status = cur.status;
-                status.statusMessage = msg.getArgAsString(1);
-                status.encoder0Pos = msg.getArgAsFloat(2);
-                status.currentSpeed = msg.getArgAsFloat(3);
-                status.rebootSeconds = msg.getArgAsInt32(6);
-            }
-            if(msg.getAddress() == "/crashreport") {
-                ofFile file;
-                file.open("crashreport.log", ofFile::WriteOnly);
-                file << ofGetTimestampString() <<
-                    "\t" << msg.getRemoteIp();
-                for(int i = 0; i < msg.getNumArgs(); i++) {
-                    file << "\t" << msg.getArgAsString(i);
+        // the receive thread keeps only the newest status per motor
+        for(int i = 0; i < rig.size(); i++) {
+            Motor& cur = rig.motors[i];
+            MotorStatusSample sample;
+            if(oscMotorsReceive.getStatus(i, sample, cur.statusSequence)) {
+                cur.setStatus(sample, timers);
+                // lengthCm stands still while the standby drives, it would read as slip
+                if(!standbyHasControl) {
+                    rig.updateCalibration(i);
                 }
             }
         }
-        
-        everythingOk = true;
-        for(int i = 0; i < 4; i++) {
-            Motor& cur = *motorsSorted[i];
-            string& msg = cur.status.statusMessage;
-            // whitelist of non-problematic states
-            if(!(msg == "OK" ||
-                 msg == "HOMING" ||
-                 msg == "HOMINGBACKOFF" ||
-                 msg == "MOTOROFF")) {
-                everythingOk = false;
-            }
-            if(cur.getTimeout()) {
-                everythingOk = false;
-            }
+        string crashReport;
+        while(oscMotorsReceive.getCrashReport(crashReport)) {
+            ofFile file;
+            file.open("crashreport.log", ofFile::WriteOnly);
+            file << ofGetTimestampString() << "\t" << crashReport;
         }
+        string autotuneResult;
+        while(oscMotorsReceive.getAutotuneResult(autotuneResult)) {
+            ofLogNotice("autotune") << autotuneResult;
+            ofFile file;
+            file.open("autotune.log", ofFile::Append);
+            file << ofGetTimestampString() << "\t" << autotuneResult << "\n";
+        }
+        
+        everythingOk = isEverythingOk(rig, stopOnCalibrationAlarm);
     }
     void updateConnexion() {
         moveVecCps = ofVec3f(connexionRotation->y,
@@ -347,14 +639,17 @@ public:
                 moveVecCps.z = moveVecCps.y;
                 moveVecCps.y = 0;
             }
-            lastInteractionTime = ofGetElapsedTimef();
+            interacted();
         }
     }
     void updateEye() {
-        interactionTimedOut = (ofGetElapsedTimef() - lastInteractionTime > interactionTimeoutSeconds);
+        PROFILE_SCOPE("kinematics");
         if(!interactionTimedOut) {
             requireMovement();
         }
+        float dt = 1. / ofGetTargetFrameRate();
+        ofVec3f startPosition = eyePosition;
+        ofVec3f eyeVelocityCps;
         if (visitorMode && interactionTimeoutEnabled && interactionTimedOut) {
             // when timed out, go towards home position and then turn off motors
             ofVec3f theWayHome = eyeHomePosition - eyePosition;
@@ -363,47 +658,23 @@ public:
             if (theWayHome.length() < closeEnough) {
                 motorsPower = false;
             } else {
-                ofVec3f moveVecFps = theWayHome.getNormalized() * moveSpeedCps * 0.75 / ofGetTargetFrameRate();
-                eyePosition += moveVecFps;
+                eyeVelocityCps = theWayHome.getNormalized() * moveSpeedCps * 0.75;
             }
         } else {
-            ofVec3f moveVecFps = moveVecCps / ofGetTargetFrameRate();
-            moveVecFps.rotate(lookAngle, ofVec3f(0, 0, 1));
-            eyePosition += moveVecFps;
+            eyeVelocityCps = moveVecCps;
+            eyeVelocityCps.rotate(lookAngle, ofVec3f(0, 0, 1));
+            // full deflection is as fast as the cables allow in that direction,
+            // faster in the middle of the room, and moveSpeedCps only caps it
+            float deflection = eyeVelocityCps.length() / MAX(moveSpeedCps, 1);
+            float speedCps = MIN(moveSpeedCps, cableLimiter.getMaxEyeSpeed(rig, eyePosition, eyeVelocityCps));
+            eyeVelocityCps = eyeVelocityCps.getNormalized() * deflection * speedCps;
         }
-        
-        // hard limits on eye position
-        eyePosition = ofVec3f(ofClamp(eyePosition->x, -eyeWidthMax, +eyeWidthMax),
-                              ofClamp(eyePosition->y, -eyeDepthMax, +eyeDepthMax),
-                              ofClamp(eyePosition->z, eyeHeightMin, eyeHeightMax));
+        eyeVelocityCps = cableLimiter.limit(rig, eyePosition, eyeVelocityCps, dt);
+        eyePosition = clampEyePosition(eyePosition.get() + eyeVelocityCps * dt, visitorMode);
         
         if (visitorMode) {
-            // enforce audience-control flight zone
-            eyePosition = ofVec3f(ofClamp(eyePosition->x, -visitorRadius, +visitorRadius),
-                                  ofClamp(eyePosition->y, -visitorRadius, +visitorRadius),
-                                  ofClamp(eyePosition->z, visitorFloor, visitorCeiling));
-            float radial = sqrt(eyePosition->x * eyePosition->x + eyePosition->y * eyePosition->y);
-            if (radial > visitorRadius) {
-                eyePosition = ofVec3f(eyePosition->x * visitorRadius / radial,
-                                      eyePosition->y * visitorRadius / radial,
-                                      eyePosition->z);
-            }
-            
-            /*
-             // make it a triangle!
-            int corner = 2;
-            float angle = 45 + 90 * corner;
-            eyePosition = eyePosition->getRotated(+angle, ofVec3f(0, 0, 1));
-            eyePosition = ofVec3f(MAX(0, eyePosition->x), eyePosition->y, eyePosition->z);
-            eyePosition = eyePosition->getRotated(-angle, ofVec3f(0, 0, 1));
-            */
-            // restrict to ~ back half
-            eyePosition = ofVec3f(ofClamp(eyePosition->x, -visitorRadius, +visitorRadius),
-//                                  ofClamp(eyePosition->y, -50, +visitorRadius),
-                                  ofClamp(eyePosition->y, -visitorRadius, +visitorRadius),
-                                  ofClamp(eyePosition->z, visitorFloor, visitorCeiling));
-            
-            if(positionLogTimer.tick() && lastEyePosition != eyePosition) {
+            if(positionLogDue && lastEyePosition != eyePosition) {
+                positionLogDue = false;
                 positionLog << ofGetTimestampString()
                     << "\t" << eyePosition->x
                     << "\t" << eyePosition->y
@@ -413,46 +684,46 @@ public:
                 lastEyePosition = eyePosition;
             }
         }
+        
+        // remember what the clamps actually let through for the next acceleration limit
+        cableLimiter.setPreviousVelocity((eyePosition.get() - startPosition) / dt);
     }
-    void updateMotors() {
-        nw.update(eyePosition);
-        ne.update(eyePosition);
-        sw.update(eyePosition);
-        se.update(eyePosition);
-        
-        unsigned long curTime = ofGetElapsedTimeMillis();
-        unsigned long curDuration = curTime - lastResetTime;
-        if(curDuration > resetWaitTime && moveSpeedCps < maxSpeedCps && !resetCompleted) {
-            bool ready = true;
-            for(int i = 0; i < 4; i++) {
-                if(motorsSorted[i]->status.currentSpeed != 0) {
-                    ready = false;
-                }
-            }
-            if(ready) {
-                moveSpeedCps = maxSpeedCps;
-                resetCompleted = true;
-            }
+    void updateHoming() {
+        homing.update(rig, oscMotorsSend, 1. / ofGetTargetFrameRate());
+        if(homing.isDone()) {
+            // the cables were left where the kinematics put this eye position
+            eyePosition = homing.getTarget();
+            cableLimiter.reset();
         }
-        
-        if(refreshTimer.tick()) {
-            moveSpeedCps = moveSpeedCps;
+        if(homing.isActive() || homing.isDone()) {
+            sendMotorLengths();
         }
-        
+    }
+    void updateMotors() {
+        {
+            PROFILE_SCOPE("kinematics");
+            rig.update(eyePosition, 1. / ofGetTargetFrameRate());
+        }
+        sendMotorLengths();
+    }
+    void sendMotorLengths() {
+        PROFILE_SCOPE("send");
         ofxOscMessage motors;
         motors.setAddress("/go");
-        for(int i = 0; i < 4; i++) {
-            motors.addFloatArg(MAX(0, motorsSorted[i]->getLengthUnits()));
+        for(int i = 0; i < rig.size(); i++) {
+            motors.addFloatArg(MAX(0, rig.getLengthUnits(i)));
         }
-        oscMotorsSend.sendMessage(motors, false);
+        oscMotorsSend.add(motors);
     }
     void updateOculus() {
+        PROFILE_SCOPE("send");
         ofxOscMessage oculus;
         oculus.setAddress("/lookAngle");
         oculus.addFloatArg(lookAngle+lookAngleOffset);
         oscOculusSend.sendMessage(oculus);
     }
     void draw() {
+        PROFILE_SCOPE("draw");
         if(everythingOk) {
             if (!motorsPower) {
                 ofBackground(40);
@@ -503,17 +774,7 @@ public:
         ofPopMatrix();
         
         ofPushStyle();
-        nw.draw(eyePosition);
-        ne.draw(eyePosition);
-        sw.draw(eyePosition);
-        se.draw(eyePosition);
-        ofPolyline floor;
-        floor.close();
-        floor.addVertex(nw.getFloorDrop());
-        floor.addVertex(ne.getFloorDrop());
-        floor.addVertex(se.getFloorDrop());
-        floor.addVertex(sw.getFloorDrop());
-        floor.draw();
+        rig.draw(eyePosition);
         ofPopStyle();
         
         ofPushMatrix();
@@ -572,10 +833,25 @@ public:
         
         ofPushMatrix();
         ofTranslate(0, ofGetHeight() - 360);
-        syphonCam.draw(0, 0, 640, 360);
+        if(cameraTexture.isAllocated()) {
+            cameraTexture.draw(0, 0, 640, 360);
+        }
         ofPopMatrix();
         
         gui.draw();
+        string homingDescription = homing.getDescription(rig);
+        if(!homingDescription.empty()) {
+            ofDrawBitmapStringHighlight(homingDescription, 10, gui.getShape().getBottom() + 20);
+        }
+        if(standbyHasControl) {
+            ofDrawBitmapStringHighlight("the standby has control of the motors, take back control to steer from here",
+                                        10, ofGetHeight() - 380, ofColor(192, 0, 0), ofColor::white);
+        }
+        
+        if(showProfile) {
+            // the control tick is one frame, the motors need to keep up with it too
+            ofDrawBitmapStringHighlight(Profiler::get().getSummary() + "\n" + rig.getTimingSummary(1 / ofGetTargetFrameRate()), ofGetWidth() - 300, 20);
+        }
         
         drawCursor();
     }
@@ -610,12 +886,21 @@ public:
         if(key == 'r') {
             reset();
         }
+        if(key == 'h' && !homing.isActive()) {
+            startHoming();
+        }
         if(key == 'f') {
             toggleFullscreen();
         }
         if(key == 'm') {
             motorsPower = false;
         }
+        if(key == 'p') {
+            showProfile = !showProfile;
+        }
+        if(key == 'x') {
+            Profiler::get().saveTrace(ofGetTimestampString() + ".trace.json");
+        }
     }
     void keyReleased(int key) {
         if(key == ' ' || key == '\t') {
@@ -624,7 +909,227 @@ public:
     }
 };
 
-int main() {
+// the same server without a window, run as --standby. it follows the ControlState
+// the primary sends every tick and listens to the motors itself, and if no state
+// arrives for a few ticks it carries on from the last one: the eye coasts to a
+// stop under the cable limits, heads home and powers off once the interaction
+// times out, and the /go stream keeps going. every tick it tells the primary
+// it has taken over, so a primary that only hung stops sending when it wakes
+// up. a primary that restarts, or takes back control, gets it back at once.
+class StandbyServer {
+public:
+    TimerWheel timers;
+    TimerWheel::Timer heartbeatTimer, interactionTimer, snapshotFlushTimer;
+    StandbyReceiver link;
+    OscBundleSender oscMotorsSend;
+    MotorStatusReceiver oscMotorsReceive;
+    Rig rig;
+    CableLimiter cableLimiter;
+    RigSnapshot snapshot;
+    string snapshotPath;
+    ControlState state; // the newest from the primary
+    bool hasState = false;
+    bool active = false, holding = false;
+    uint64_t replacedInstance = 0; // its state is ignored from now on
+    int timeoutTicks = 4;
+    bool stopOnCalibrationAlarm = false;
+    
+    ofVec3f eyePosition;
+    float lookAngle = 0, moveSpeedCps = 0, tickSeconds = 1. / 40;
+    bool everythingOk = false, motorsPower = false, visitorMode = true;
+    bool interactionTimeoutEnabled = true, interactionTimedOut = false;
+    
+    bool setup() {
+        ofXml config;
+        if(!config.load("config.xml") || !rig.setup(config, "motors/rig")) {
+            return false;
+        }
+        cableLimiter.setup(config, "motors/cable/");
+        setupMotorLimits(config);
+        stopOnCalibrationAlarm = config.getBoolValue("motors/calibration/stopOnAlarm");
+        timeoutTicks = config.getIntValue("motors/standby/timeoutTicks");
+        snapshotPath = config.getValue("motors/warmStart/path");
+        
+        heartbeatTimer.setCallback([this] { takeOver(); });
+        interactionTimer.setCallback([this] { interactionTimedOut = true; });
+        snapshotFlushTimer.setCallback([this] { snapshot.flush(); });
+        timers.armPeriodic(snapshotFlushTimer, 1000);
+        
+        int port = config.getIntValue("motors/standby/port");
+        if(!link.setup(port)) {
+            return false;
+        }
+        oscMotorsSend.setup(config.getValue("motors/osc/host"), config.getIntValue("motors/osc/sendPort"));
+        oscMotorsReceive.setup(config.getIntValue("motors/standby/receivePort"));
+        ofLogNotice("standby") << "waiting for the primary on " << port;
+        return true;
+    }
+    float getTickSeconds() const {
+        return tickSeconds;
+    }
+    void update() {
+        // before the timers, a heartbeat that made it in time counts
+        ControlState received;
+        while(link.receive(received)) {
+            if(received.instance == replacedInstance) {
+                continue;
+            }
+            if(active) {
+                ofLogNotice("standby") << "the primary is back, handing over control";
+                active = holding = false;
+            }
+            state = received;
+            hasState = true;
+            tickSeconds = state.tickSeconds;
+            if(state.flags & ControlState::EXITING) {
+                timers.cancel(heartbeatTimer);
+            } else {
+                timers.arm(heartbeatTimer, 1000 * timeoutTicks * tickSeconds);
+            }
+        }
+        timers.update();
+        updateStatus();
+        if(active) {
+            updateActive();
+        }
+    }
+    void updateStatus() {
+        for(int i = 0; i < rig.size(); i++) {
+            Motor& cur = rig.motors[i];
+            MotorStatusSample sample;
+            if(oscMotorsReceive.getStatus(i, sample, cur.statusSequence)) {
+                cur.setStatus(sample, timers);
+                if(active) {
+                    rig.updateCalibration(i);
+                }
+            }
+        }
+        // the primary keeps the logs
+        string ignored;
+        while(oscMotorsReceive.getCrashReport(ignored)) {
+        }
+        while(oscMotorsReceive.getAutotuneResult(ignored)) {
+        }
+        everythingOk = isEverythingOk(rig, stopOnCalibrationAlarm);
+    }
+    void takeOver() {
+        if(active || !hasState) {
+            return;
+        }
+        active = true;
+        replacedInstance = state.instance;
+        
+        const RigSnapshotData& data = state.rig;
+        eyePosition = RigSnapshot::getEyePosition(data);
+        lookAngle = data.lookAngle;
+        for(int i = 0; i < rig.size() && i < data.motorCount; i++) {
+            rig.lengthCm[i] = data.motors[i].commandedCm;
+            rig.lengthSpeedCps[i] = 0;
+        }
+        RigSnapshot::restoreCalibration(rig, data);
+        cableLimiter.reset();
+        cableLimiter.setPreviousVelocity(ofVec3f(state.eyeVelocity[0], state.eyeVelocity[1], state.eyeVelocity[2]));
+        
+        // a motor we haven't heard from ourselves yet is as the primary last saw it
+        for(int i = 0; i < rig.size(); i++) {
+            Motor& cur = rig.motors[i];
+            const ReplicatedMotor& motor = state.motors[i];
+            if(!cur.status.received) {
+                cur.status.statusMessage = string(motor.statusMessage, strnlen(motor.statusMessage, sizeof(motor.statusMessage)));
+                cur.status.encoder0Pos = motor.encoder0Pos;
+                cur.status.currentSpeed = motor.currentSpeed;
+                cur.timedOut = motor.timedOut;
+                timers.arm(cur.statusTimer, 1000 * Motor::statusTimeoutSeconds);
+            }
+        }
+        everythingOk = isEverythingOk(rig, stopOnCalibrationAlarm) && (state.flags & ControlState::EVERYTHING_OK);
+        
+        motorsPower = state.flags & ControlState::MOTORS_POWER;
+        visitorMode = state.flags & ControlState::VISITOR_MODE;
+        interactionTimeoutEnabled = state.flags & ControlState::INTERACTION_TIMEOUT_ENABLED;
+        interactionTimedOut = state.flags & ControlState::INTERACTION_TIMED_OUT;
+        moveSpeedCps = state.moveSpeedCps;
+        if(!interactionTimedOut) {
+            // nobody can steer from here, so this runs out
+            timers.arm(interactionTimer, state.interactionRemainingMillis);
+        }
+        
+        // the saves carry on from whatever the primary saved last
+        snapshot.setup(snapshotPath);
+        
+        holding = state.flags & (ControlState::HOMING | ControlState::WARM_START);
+        if(state.flags & ControlState::HOMING) {
+            // a homing half done can't be finished from here
+            ofxOscMessage msg;
+            msg.setAddress("/stop");
+            oscMotorsSend.add(msg);
+        }
+        ofLogError("standby") << "no state from the primary for " << timeoutTicks << " ticks, taking over at " << eyePosition
+            << (holding ? ", holding" : "");
+    }
+    void updateActive() {
+        if(!holding && everythingOk) {
+            updateEye();
+            rig.update(eyePosition, tickSeconds);
+            ofxOscMessage motors;
+            motors.setAddress("/go");
+            for(int i = 0; i < rig.size(); i++) {
+                motors.addFloatArg(MAX(0, rig.getLengthUnits(i)));
+            }
+            oscMotorsSend.add(motors);
+            snapshot.save(rig, eyePosition, lookAngle);
+        } else {
+            cableLimiter.reset();
+        }
+        link.sendTakeover(replacedInstance, eyePosition, lookAngle);
+        oscMotorsSend.flush();
+    }
+    void updateEye() {
+        ofVec3f startPosition = eyePosition;
+        // with nobody steering the eye comes to a stop
+        ofVec3f eyeVelocityCps;
+        if (visitorMode && interactionTimeoutEnabled && interactionTimedOut) {
+            // like the primary, towards home and then the motors off
+            ofVec3f theWayHome = eyeHomePosition - eyePosition;
+            float closeEnough = 50;
+            if (theWayHome.length() < closeEnough) {
+                if(motorsPower) {
+                    motorsPower = false;
+                    ofxOscMessage msg;
+                    msg.setAddress("/motor");
+                    msg.addIntArg(0);
+                    oscMotorsSend.add(msg);
+                }
+            } else {
+                eyeVelocityCps = theWayHome.getNormalized() * moveSpeedCps * 0.75;
+            }
+        }
+        eyeVelocityCps = cableLimiter.limit(rig, eyePosition, eyeVelocityCps, tickSeconds);
+        eyePosition = clampEyePosition(eyePosition + eyeVelocityCps * tickSeconds, visitorMode);
+        cableLimiter.setPreviousVelocity((eyePosition - startPosition) / tickSeconds);
+    }
+};
+
+// no window or gl, just the control tick
+int runStandby() {
+    StandbyServer standby;
+    if(!standby.setup()) {
+        return 1;
+    }
+    auto next = std::chrono::steady_clock::now();
+    while(true) {
+        standby.update();
+        next += std::chrono::microseconds((int64_t) (1e6 * standby.getTickSeconds()));
+        // after a stall, carry on from now rather than catch up
+        next = MAX(next, std::chrono::steady_clock::now());
+        std::this_thread::sleep_until(next);
+    }
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1 && string(argv[1]) == "--standby") {
+        return runStandby();
+    }
     ofSetupOpenGL(1280, 720, OF_WINDOW);
     ofSetWindowShape(1280*2, 720*2);
     ofSetWindowPosition((ofGetScreenWidth() - ofGetWindowWidth()) / 2,
@@ -2,50 +2,279 @@
 #include "ofxBlackMagic.h"
 #include "ofxTiming.h"
 #include "Fisheye.h"
+#include "SharedFrameRing.h"
+#include "FisheyeRecording.h"
+#include "FisheyeDetector.h"
+#include "FisheyeStitcher.h"
+#include "Profiler.h"
 
 class ofApp : public ofBaseApp {
 public:
     ofxBlackMagic cam;
     Fisheye fisheye;
+    FisheyeDetector detector;
+    bool detectCircle = true;
 	RateTimer timer;
     ofEasyCam easyCam;
+    // every captured frame goes out to the headset and simulation viewers
+    SharedFramePublisher publisher;
+    // synthetic frames for trying the viewers without a camera
+    bool testPattern = false;
+    ofPixels testPixels;
+    ofTexture testTexture;
+    float lastTestFrame = 0;
+    // sessions keep only what's inside the circle, drop one back on to replay it
+    FisheyeRecorder recorder;
+    FisheyeRecordingReader playback;
+    vector<unsigned char> playbackFrame;
+    int playbackPosition = 0;
+    float lastPlaybackFrame = 0;
+    // several recordings dropped together are stitched, with the rig from config.xml
+    deque<FisheyeRecordingReader> stitchInputs;
+    vector<vector<unsigned char>> stitchFrames;
+    FisheyeStitcher stitcher;
+    ofPixels stitched;
+    ofTexture stitchedTexture;
+    float stitchMilliseconds = 0;
+    bool showProfile = false;
 	
 	void setup() {
 		ofSetLogLevel(OF_LOG_VERBOSE);
 		cam.setup(1920, 1080, 29.97f);
         fisheye.setup();
+        detector.setup();
+        publisher.setup(SharedFrameRing::getDefaultName(), 1920 * 1080 * 3);
 	}
 	void exit() {
+        recorder.close();
+        detector.close();
 		cam.close();
 	}
 	void update() {
-		if(cam.update()) {
+        Profiler::get().update();
+        if(!stitchInputs.empty()) {
+            if(ofGetElapsedTimef() - lastPlaybackFrame > 1 / 29.97) {
+                lastPlaybackFrame = ofGetElapsedTimef();
+                updateStitch();
+                timer.tick();
+            }
+        } else if(playback.getFrameCount()) {
+            if(ofGetElapsedTimef() - lastPlaybackFrame > 1 / 29.97) {
+                lastPlaybackFrame = ofGetElapsedTimef();
+                updatePlayback();
+                timer.tick();
+            }
+        } else if(testPattern) {
+            if(ofGetElapsedTimef() - lastTestFrame > 1 / 29.97) {
+                lastTestFrame = ofGetElapsedTimef();
+                updateTestPattern();
+                publisher.publish(testPixels);
+                timer.tick();
+            }
+        } else if(cam.update()) {
+            PROFILE_SCOPE("capture");
 			timer.tick();
+            // the card's own 4:2:2, viewers convert only what they show
+            publisher.publish(cam.getYuvRaw().data(), SHARED_FRAME_UYVY, 1920, 1080);
+            recorder.add(cam.getYuvRaw().data(), 1920 * 2);
+            if(detectCircle) {
+                detector.submit(UyvyImage(cam.getYuvRaw().data(), 1920, 1080));
+            }
 		}
+        if(detectCircle) {
+            detector.update(fisheye);
+        }
 	}
+    void updatePlayback() {
+        PROFILE_SCOPE("playback");
+        int width = playback.getWidth(), height = playback.getHeight();
+        SharedFrameFormat format = playback.getFormat();
+        playbackFrame.resize(width * height * format);
+        playback.getFrame(playbackPosition, playbackFrame.data(), width * format);
+        publisher.publish(playbackFrame.data(), format, width, height);
+        playbackPosition = (playbackPosition + 1) % playback.getFrameCount();
+    }
+    // config.xml has one <camera> per recording under <stitch>, with its fov and
+    // rotation. the lens circle is the one each recording was masked with.
+    void setupStitch(const vector<string>& paths) {
+        ofXml config;
+        config.load("config.xml");
+        vector<FisheyeStitcher::Camera> cameras;
+        stitchInputs.clear();
+        for(int i = 0; i < paths.size(); i++) {
+            stitchInputs.emplace_back();
+            FisheyeRecordingReader& input = stitchInputs.back();
+            if(!input.setup(paths[i]) || !input.getFrameCount()) {
+                ofLogError() << "can't stitch " << paths[i];
+                stitchInputs.clear();
+                return;
+            }
+            string camera = "stitch/camera[" + ofToString(i) + "]/";
+            FisheyeStitcher::Camera settings;
+            settings.width = input.getWidth();
+            settings.height = input.getHeight();
+            settings.fisheye.offset = input.getOffset();
+            settings.fisheye.radius = input.getRadius();
+            settings.fisheye.fov = config.getFloatValue(camera + "fov");
+            settings.rotation.set(config.getFloatValue(camera + "rotation/x"),
+                                  config.getFloatValue(camera + "rotation/y"),
+                                  config.getFloatValue(camera + "rotation/z"));
+            cameras.push_back(settings);
+        }
+        stitcher.blendDegrees = config.getFloatValue("stitch/blendDegrees");
+        stitcher.setup(cameras, config.getIntValue("stitch/width"));
+        ofLogNotice() << "stitching " << paths.size() << " cameras, " << ofToString(stitcher.getCoverage() * 100, 1) << "% of the sphere";
+        stitchFrames.resize(stitchInputs.size());
+        playback.close();
+        playbackPosition = 0;
+    }
+    void updateStitch() {
+        PROFILE_SCOPE("stitch");
+        vector<const ofPixels*> rgb;
+        vector<const UyvyImage*> uyvy;
+        vector<ofPixels> rgbFrames(stitchInputs.size());
+        vector<UyvyImage> uyvyFrames(stitchInputs.size());
+        for(int i = 0; i < stitchInputs.size(); i++) {
+            FisheyeRecordingReader& input = stitchInputs[i];
+            int width = input.getWidth(), height = input.getHeight();
+            SharedFrameFormat format = input.getFormat();
+            stitchFrames[i].resize(width * height * format);
+            input.getFrame(playbackPosition % input.getFrameCount(), stitchFrames[i].data(), width * format);
+            if(format == SHARED_FRAME_UYVY) {
+                uyvyFrames[i] = UyvyImage(stitchFrames[i].data(), width, height);
+                uyvy.push_back(&uyvyFrames[i]);
+            } else {
+                rgbFrames[i].setFromExternalPixels(stitchFrames[i].data(), width, height, format);
+                rgb.push_back(&rgbFrames[i]);
+            }
+        }
+        float start = ofGetElapsedTimef();
+        if(uyvy.size() == stitchInputs.size()) {
+            stitcher.stitch(uyvy, stitched);
+        } else if(rgb.size() == stitchInputs.size()) {
+            stitcher.stitch(rgb, stitched);
+        } else {
+            ofLogError() << "recordings to stitch need to be all 4:2:2 or all rgb";
+            stitchInputs.clear();
+            return;
+        }
+        stitchMilliseconds = (ofGetElapsedTimef() - start) * 1000;
+        stitchedTexture.loadData(stitched);
+        playbackPosition++;
+    }
+    void toggleRecording() {
+        if(recorder.isRecording()) {
+            ofLogNotice() << "recorded " << recorder.getFrameCount() << " frames at " << recorder.getRatio() << " of full size";
+            recorder.close();
+        } else {
+            recorder.setup(ofGetTimestampString() + ".fisheye", fisheye, 1920, 1080, SHARED_FRAME_UYVY);
+        }
+    }
+    // a gradient with a bar sweeping across it, so dropped or torn frames are easy to see
+    void updateTestPattern() {
+        int width = 1920, height = 1080;
+        if(!testPixels.isAllocated()) {
+            testPixels.allocate(width, height, OF_PIXELS_RGB);
+        }
+        int bar = ofGetFrameNum() * 8 % width;
+        unsigned char* data = testPixels.getData();
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                bool inBar = abs(x - bar) < 16;
+                *data++ = inBar ? 255 : x * 255 / width;
+                *data++ = inBar ? 255 : y * 255 / height;
+                *data++ = inBar ? 255 : 128;
+            }
+        }
+        testTexture.loadData(testPixels);
+    }
     void draw() {
-        cam.drawColor();
+        PROFILE_SCOPE("draw");
+        if(!stitchInputs.empty()) {
+            if(stitchedTexture.isAllocated()) {
+                stitchedTexture.draw(0, 0, ofGetWidth(), ofGetWidth() / 2);
+            }
+            ofDrawBitmapStringHighlight("Stitching " + ofToString(stitchInputs.size()) + " cameras, frame " +
+                                        ofToString(playbackPosition) + ", " + ofToString(stitchMilliseconds, 1) + "ms", 10, 20);
+            return;
+        }
+        if(testPattern) {
+            testTexture.draw(0, 0);
+        } else {
+            cam.drawColor();
+            ofPushStyle();
+            ofNoFill();
+            ofSetColor(detectCircle ? ofColor::green : ofColor::red);
+            ofDrawCircle(fisheye.offset, fisheye.radius);
+            ofPopStyle();
+        }
         
         easyCam.setPosition(0, 0, 0);
         easyCam.setFov(80);
         easyCam.begin();
         ofEnableDepthTest();
         ofScale(100, 100, 100);
-        fisheye.draw(cam.getColorTexture());
+        if(testPattern) {
+            testTexture.bind();
+        } else {
+            cam.getColorTexture().bind();
+        }
+        fisheye.draw();
+        if(testPattern) {
+            testTexture.unbind();
+        } else {
+            cam.getColorTexture().unbind();
+        }
         easyCam.end();
         
         ofDisableDepthTest();
 		ofDrawBitmapStringHighlight(ofToString((int) timer.getFramerate()), 10, 20);
+        if(recorder.isRecording()) {
+            ofDrawBitmapStringHighlight("Recording " + ofToString(recorder.getFrameCount()), 10, 40, ofColor::red);
+        }
+        if(playback.getFrameCount()) {
+            ofDrawBitmapStringHighlight("Playing " + ofToString(playbackPosition) + "/" + ofToString(playback.getFrameCount()), 10, 60);
+        }
+        if(showProfile) {
+            ofDrawBitmapStringHighlight(Profiler::get().getSummary(), 10, 80);
+        }
 	}
 	void keyPressed(int key) {
 		if(key == 'f') {
 			ofToggleFullscreen();
 		}
+        if(key == 't') {
+            testPattern = !testPattern;
+        }
+        if(key == 'a') {
+            detectCircle = !detectCircle;
+        }
+        if(key == 'r') {
+            toggleRecording();
+        }
+        if(key == 'h') {
+            showProfile = !showProfile;
+        }
+        if(key == 'x') {
+            Profiler::get().saveTrace(ofGetTimestampString() + ".trace.json");
+        }
+        if(key == 'p') {
+            playback.close();
+            stitchInputs.clear();
+        }
         if(key == ' ') {
             string path = ofToString(ofGetFrameNum(), 8) + ".tiff";
-            ofSaveImage(cam.getColorPixels(), path);
+            ofSaveImage(stitchInputs.empty() ? cam.getColorPixels() : stitched, path);
         }
 	}
+    void dragEvent(ofDragInfo dragInfo) {
+        if(dragInfo.files.size() > 1) {
+            setupStitch(dragInfo.files);
+        } else if(dragInfo.files.size() && playback.setup(dragInfo.files[0])) {
+            stitchInputs.clear();
+            playbackPosition = 0;
+        }
+    }
 };
 
 int main() {
@@ -1,6 +1,9 @@
 #include "ofMain.h"
 
 #include "Fisheye.h"
+#include "FisheyePanorama.h"
+#include "FisheyeDetector.h"
+#include "Profiler.h"
 
 #include "ofxBlackMagic.h"
 #include "ofxTiming.h"
@@ -11,6 +14,9 @@ class ofApp : public ofBaseApp {
 public:
     ofxBlackMagic cam;
     Fisheye fisheye;
+    FisheyePanorama panorama;
+    FisheyeDetector detector;
+    bool detectCircle = true;
 	RateTimer cameraTimer, renderTimer;
     ofCamera camera;
     ofxOculusDK2 oculusRift;
@@ -27,23 +33,44 @@ public:
         ofViewport(ofGetNativeViewport());
         
 		cam.setup(1920, 1080, 29.97f);
-        fisheye.setup(cam.getColorTexture());
+        fisheye.setup();
+        panorama.setup(fisheye);
         
         ofXml config;
         config.load("config.xml");
         osc.setup(config.getIntValue("osc/port"));
+        panorama.eyeFov.left = config.getFloatValue("unwrap/eyeFov/left");
+        panorama.eyeFov.right = config.getFloatValue("unwrap/eyeFov/right");
+        panorama.eyeFov.up = config.getFloatValue("unwrap/eyeFov/up");
+        panorama.eyeFov.down = config.getFloatValue("unwrap/eyeFov/down");
+        panorama.predictionMargin = config.getFloatValue("unwrap/margin");
+        detectCircle = config.getBoolValue("unwrap/detectCircle");
+        detector.setup();
         
         oculusRift.baseCamera = &camera;
         oculusRift.setup();
 	}
 	void exit() {
+        detector.close();
 		cam.close();
 	}
     void update() {
+        Profiler::get().update();
         if(ofGetKeyPressed('-') && cam.update()) {
+            PROFILE_SCOPE("capture");
             cameraTimer.tick();
+            panorama.invalidate();
+            if(detectCircle) {
+                detector.submit(UyvyImage(cam.getYuvRaw().data(), 1920, 1080));
+            }
+        }
+        // the lens circle drifts, rebuild the unwrap when it's moved
+        if(detectCircle && detector.update(fisheye)) {
+            panorama.setup(fisheye);
+            panorama.invalidate();
         }
         renderTimer.tick();
+        PROFILE_SCOPE("osc receive");
         while(osc.hasWaitingMessages()) {
             ofxOscMessage msg;
             osc.getNextMessage(&msg);
@@ -53,6 +80,14 @@ public:
         }
 	}
     void draw() {
+        // unwrap once per camera frame, not once per eye per display frame,
+        // and only the tiles that might be seen before the next update
+        {
+            PROFILE_SCOPE("unwrap");
+            panorama.update(cam.getColorTexture(), getView());
+        }
+        
+        PROFILE_SCOPE("draw");
         ofEnableDepthTest();
         
         oculusRift.beginLeftEye();
@@ -65,12 +100,26 @@ public:
         
         oculusRift.draw();
     }
+    // where the headset is looking, in the fisheye's camera space
+    FisheyePanorama::View getView() {
+        FisheyePanorama::View view;
+        view.forward = toCameraSpace(oculusRift.getOrientationQuat() * ofVec3f(0, 0, -1));
+        view.up = toCameraSpace(oculusRift.getOrientationQuat() * ofVec3f(0, 1, 0));
+        return view;
+    }
+    // undoes drawScene()
+    ofVec3f toCameraSpace(ofVec3f direction) {
+        direction.rotate(90, ofVec3f(1, 0, 0));
+        direction.rotate(-lookAngle, ofVec3f(0, 1, 0));
+        direction.rotate(-180, ofVec3f(1, 0, 0));
+        return direction;
+    }
     void drawScene() {
         ofPushMatrix();
         ofScale(100, 100, 100); // avoid clipping
         ofRotateX(-90);
         ofRotateY(lookAngle);
-        fisheye.draw(cam.getColorTexture());
+        panorama.draw();
         ofPopMatrix();
         
         if(debug) {
@@ -81,6 +130,10 @@ public:
             ofDrawBitmapStringHighlight("Camera: " + ofToString((int) cameraTimer.getFramerate()), 0, 0);
             ofSetDrawBitmapMode(OF_BITMAPMODE_MODEL);
             ofDrawBitmapStringHighlight("Render: " + ofToString((int) renderTimer.getFramerate()), 0, 40);
+            ofDrawBitmapStringHighlight("Tiles: " + ofToString(panorama.tilesUpdated), 0, 80);
+            ofDrawBitmapStringHighlight("Circle: " + ofToString(fisheye.offset) + " " + ofToString(fisheye.radius, 1) +
+                                        (detectCircle ? "" : " (fixed)"), 0, 120);
+            ofDrawBitmapStringHighlight(Profiler::get().getSummary(), 0, 160);
         }
 	}
 	void keyPressed(int key) {
@@ -94,6 +147,24 @@ public:
             string path = ofGetTimestampString() + ".jpg";
             ofSaveImage(cam.getColorPixels(), path);
         }
+        if(key == 'a') {
+            detectCircle = !detectCircle;
+        }
+        if(key == 'x') {
+            Profiler::get().saveTrace(ofGetTimestampString() + ".trace.json");
+        }
+        if(key == 'v') {
+            float maxError;
+            float meanError = FisheyePanorama::verify(fisheye, cam.getColorPixels(), maxError);
+            ofLog() << "panorama reprojection error: " << meanError << " mean, " << maxError << " max";
+        }
+        if(key == 'b') {
+            FisheyePanorama reference;
+            reference.setup(fisheye);
+            reference.benchmark(fisheye, cam.getColorPixels());
+            // straight from the card's 4:2:2, without converting the whole frame first
+            reference.benchmark(fisheye, UyvyImage(cam.getYuvRaw().data(), 1920, 1080));
+        }
 	}
 };
 
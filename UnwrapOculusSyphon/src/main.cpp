@@ -1,16 +1,25 @@
 #include "ofMain.h"
 
 #include "Fisheye.h"
+#include "FisheyePanorama.h"
+#include "FisheyeDetector.h"
+#include "PreviewServer.h"
+#include "Profiler.h"
 
 #include "ofxTiming.h"
 #include "ofxOculusDK2.h"
 #include "ofxOsc.h"
-#include "ofxSyphon.h"
+#include "SharedFrameRing.h"
 
 class ofApp : public ofBaseApp {
 public:
-    ofxSyphonClient cam;
+    SharedFrameViewer cam;
+    ofTexture camTexture;
     Fisheye fisheye;
+    FisheyePanorama panorama;
+    FisheyeDetector detector;
+    PreviewServer preview;
+    bool detectCircle = true;
 	RateTimer cameraTimer, renderTimer;
     DelayTimer screenshotTimer;
     ofCamera camera;
@@ -24,25 +33,38 @@ public:
         ofBackground(0);
         ofHideCursor();
         
-        cam.setup();
-        cam.set("","Black Syphon");
         fisheye.setup();
+        panorama.setup(fisheye);
         
         screenshotTimer.setPeriod(60);
         
         ofXml config;
         config.load("config.xml");
         osc.setup(config.getIntValue("osc/port"));
+        cam.setup(config.getValue("camera/name"));
+        panorama.eyeFov.left = config.getFloatValue("unwrap/eyeFov/left");
+        panorama.eyeFov.right = config.getFloatValue("unwrap/eyeFov/right");
+        panorama.eyeFov.up = config.getFloatValue("unwrap/eyeFov/up");
+        panorama.eyeFov.down = config.getFloatValue("unwrap/eyeFov/down");
+        panorama.predictionMargin = config.getFloatValue("unwrap/margin");
+        detectCircle = config.getBoolValue("unwrap/detectCircle");
+        detector.setup();
+        preview.width = config.getIntValue("preview/width");
+        preview.maxFps = config.getFloatValue("preview/fps");
+        preview.setup(config.getIntValue("preview/port"));
         
         oculusRift.baseCamera = &camera;
         oculusRift.setup();
 	}
     void saveScreen(string prefix) {
-        cam.save(prefix + ofGetTimestampString() + "-camera.tiff");
+        ofPixels pixels;
+        camTexture.readToPixels(pixels);
+        ofSaveImage(pixels, prefix + ofGetTimestampString() + "-camera.tiff");
 //        ofSaveScreen(prefix + ofGetTimestampString() + "-oculus.tiff");
     }
     int goFullscreen = 0;
     void update() {
+        Profiler::get().update();
         if( goFullscreen == 2 ){
             ofSetFullscreen(false);
             ofSetWindowPosition(1920, 0);
@@ -57,6 +79,14 @@ public:
         }
         
         renderTimer.tick();
+        updateOsc();
+        lookAngle = ofLerp(lookAngle, targetLookAngle, .1);
+        if(screenshotTimer.tick()) {
+//            saveScreen("automatic/"); // uncomment to enable automatic screenshot
+        }
+	}
+    void updateOsc() {
+        PROFILE_SCOPE("osc receive");
         while(osc.hasWaitingMessages()) {
             ofxOscMessage msg;
             osc.getNextMessage(&msg);
@@ -71,12 +101,16 @@ public:
                 saveScreen("button/");
             }
         }
-        lookAngle = ofLerp(lookAngle, targetLookAngle, .1);
-        if(screenshotTimer.tick()) {
-//            saveScreen("automatic/"); // uncomment to enable automatic screenshot
-        }
-	}
+    }
     void draw() {
+        updateCamera();
+        // only the tiles that might be seen before the next update
+        if(camTexture.isAllocated()) {
+            PROFILE_SCOPE("unwrap");
+            panorama.update(camTexture, getView());
+        }
+        
+        PROFILE_SCOPE("draw");
         ofEnableDepthTest();
         
         oculusRift.beginLeftEye();
@@ -88,19 +122,56 @@ public:
         oculusRift.endRightEye();
         
         oculusRift.draw();
-        
-        // this is essential for setting up the texture
-        cam.bind();
-        cam.unbind();
+    }
+    void updateCamera() {
+        PROFILE_SCOPE("capture");
+        if(cam.update(camTexture)) {
+            panorama.setUyvy(cam.getInfo().format == SHARED_FRAME_UYVY);
+            panorama.invalidate();
+            cameraTimer.tick();
+            // the capture card's frames, the rgb test pattern has no lens circle
+            if(detectCircle && cam.getInfo().format == SHARED_FRAME_UYVY) {
+                detector.submit(cam.getUyvyImage());
+            }
+            submitPreview();
+        }
+        if(detectCircle && detector.update(fisheye)) {
+            panorama.setup(fisheye);
+            panorama.invalidate();
+        }
+    }
+    // for the operator tablets, does nothing unless one is watching
+    void submitPreview() {
+        const SharedFrameInfo& info = cam.getInfo();
+        if(info.format == SHARED_FRAME_UYVY) {
+            preview.submit(fisheye, cam.getUyvyImage());
+        } else if(info.stride == info.width * info.format) {
+            ofPixels pixels;
+            pixels.setFromExternalPixels((unsigned char*) cam.getPixels(), info.width, info.height, info.format);
+            preview.submit(fisheye, pixels);
+        }
+    }
+    // where the headset is looking, in the fisheye's camera space
+    FisheyePanorama::View getView() {
+        FisheyePanorama::View view;
+        view.forward = toCameraSpace(oculusRift.getOrientationQuat() * ofVec3f(0, 0, -1));
+        view.up = toCameraSpace(oculusRift.getOrientationQuat() * ofVec3f(0, 1, 0));
+        return view;
+    }
+    // undoes drawScene()
+    ofVec3f toCameraSpace(ofVec3f direction) {
+        direction.y *= -1;
+        direction.rotate(-90, ofVec3f(1, 0, 0));
+        direction.rotate(-lookAngle, ofVec3f(0, 0, 1));
+        direction.rotate(-180, ofVec3f(1, 0, 0));
+        return direction;
     }
     void drawScene() {
         ofPushMatrix();
         ofScale(100, -100, 100); // avoid clipping
         ofRotateX(+90);
         ofRotateZ(+lookAngle);
-        cam.bind();
-        fisheye.draw();
-        cam.unbind();
+        panorama.draw();
         ofPopMatrix();
         
         if(debug) {
@@ -111,6 +182,8 @@ public:
             ofDrawBitmapStringHighlight("Camera: " + ofToString((int) cameraTimer.getFramerate()), 0, 0);
             ofSetDrawBitmapMode(OF_BITMAPMODE_MODEL);
             ofDrawBitmapStringHighlight("Render: " + ofToString((int) renderTimer.getFramerate()), 0, 40);
+            ofDrawBitmapStringHighlight("Tiles: " + ofToString(panorama.tilesUpdated), 0, 80);
+            ofDrawBitmapStringHighlight(Profiler::get().getSummary(), 0, 120);
         }
 	}
 	void keyPressed(int key) {
@@ -120,7 +193,15 @@ public:
         if(key == 'f') {
             ofToggleFullscreen();
         }
+        // turn detection off to nudge the circle by hand
+        if(key == 'a') {
+            detectCircle = !detectCircle;
+        }
+        if(key == 'x') {
+            Profiler::get().saveTrace(ofGetTimestampString() + ".trace.json");
+        }
         fisheye.keyPressed(key);
+        panorama.setup(fisheye);
 	}
 };
 
@@ -0,0 +1,52 @@
+#pragma once
+
+// just enough of the arduino core for motor_driver.ino to build on a desktop.
+// time only moves when ../sketch.h moves it, and the registers are plain
+// variables the simulated plant reads and writes.
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <cmath>
+
+using std::abs;
+
+typedef uint8_t byte;
+
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+extern unsigned long simMicros;
+inline unsigned long micros() { return simMicros; }
+inline unsigned long millis() { return simMicros / 1000; }
+inline void delay(unsigned long) {}
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+int digitalRead(int pin); // the endstop, from the plant
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+#define ISR(vector, ...) void vector()
+#define ISR_NOBLOCK
+
+extern uint8_t PIND, PORTB, PCMSK2, PCIFR, PCICR, TCCR1A, TCCR1B, TIMSK1;
+extern uint16_t OCR1A, TCNT1;
+#define PCINT18 2
+#define PCINT19 3
+#define PCIF2 2
+#define PCIE2 2
+#define WGM12 3
+#define CS11 1
+#define OCIE1A 1
+
+class __FlashStringHelper;
+
+struct Print {
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <Arduino.h>
+
+// reads 0, so the sketch is motor 0 and doesn't try to recover a position
+struct EEPROMClass {
+  uint8_t read(int) { return 0; }
+  void write(int, uint8_t) {}
+};
+static EEPROMClass EEPROM;
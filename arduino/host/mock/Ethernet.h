@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+
+struct IPAddress {
+  uint8_t bytes[4];
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+  // network order, first byte first, like the arduino one
+  IPAddress(uint32_t address) { memcpy(bytes, &address, 4); }
+  operator uint32_t() const {
+    uint32_t address;
+    memcpy(&address, bytes, 4);
+    return address;
+  }
+  uint8_t &operator[](int i) { return bytes[i]; }
+};
+
+struct EthernetClass {
+  void begin(uint8_t *, IPAddress) {}
+};
+static EthernetClass Ethernet;
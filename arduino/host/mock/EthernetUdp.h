@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Ethernet.h>
+#include <string>
+
+// where packets come from and go, set by whatever the sketch is built into
+struct UdpHost {
+  unsigned long reads = 0; // peek() and read() calls, each an spi transaction on the w5100
+  uint32_t remoteAddress = 0; // network order, and the port, of the packet receive() last gave
+  uint16_t remotePort = 0;
+  virtual bool receive(std::string &packet) = 0;
+  virtual void send(const std::string &packet) = 0;
+};
+extern UdpHost *udpHost;
+
+class EthernetUDP : public Print {
+  std::string in, out;
+  size_t pos = 0;
+
+public:
+  void begin(unsigned int) {}
+  int parsePacket() {
+    in.clear();
+    pos = 0;
+    if (!udpHost || !udpHost->receive(in)) return 0;
+    return in.size();
+  }
+  int peek() {
+    if (udpHost) udpHost->reads++;
+    return pos < in.size() ? (uint8_t)in[pos] : -1;
+  }
+  int read(uint8_t *buffer, size_t n) {
+    if (udpHost) udpHost->reads++;
+    size_t k = 0;
+    while (k < n && pos < in.size()) buffer[k++] = in[pos++];
+    return k;
+  }
+  IPAddress remoteIP() { return IPAddress(udpHost ? udpHost->remoteAddress : 0); }
+  uint16_t remotePort() { return udpHost ? udpHost->remotePort : 0; }
+  int beginPacket(IPAddress, int) { out.clear(); return 1; }
+  size_t write(const uint8_t *buffer, size_t size) { out.append((const char *)buffer, size); return size; }
+  int endPacket() {
+    if (udpHost) udpHost->send(out);
+    return 1;
+  }
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <OSCMessage.h>
+
+// "#bundle", the timetag, then each message with its size
+class OSCBundle {
+  std::vector<uint8_t> incoming;
+  std::vector<OSCMessage> messages;
+  bool error = false;
+
+  void decode() {
+    if (incoming.empty()) return;
+    std::vector<uint8_t> in;
+    in.swap(incoming);
+    messages.clear();
+    error = in.size() < 16 || memcmp(in.data(), "#bundle", 8) != 0;
+    for (size_t i = 16; !error && i < in.size(); ) {
+      if (i + 4 > in.size()) {
+        error = true;
+        break;
+      }
+      size_t n = (size_t)in[i] << 24 | in[i + 1] << 16 | in[i + 2] << 8 | in[i + 3];
+      i += 4;
+      if (i + n > in.size()) {
+        error = true;
+        break;
+      }
+      messages.emplace_back();
+      messages.back().fill(std::string((const char *)&in[i], n));
+      if (messages.back().hasError()) error = true;
+      i += n;
+    }
+  }
+
+public:
+  void fill(uint8_t *bytes, int n) { incoming.insert(incoming.end(), bytes, bytes + n); }
+  bool hasError() { decode(); return error; }
+  int size() { decode(); return messages.size(); }
+  OSCMessage *getOSCMessage(int i) { decode(); return &messages[i]; }
+};
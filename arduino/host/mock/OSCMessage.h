@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+// reads and writes the same bytes as CNMAT's OSCMessage, for the int, float
+// and string arguments the firmware uses
+class OSCMessage {
+  struct Arg {
+    char type;
+    int32_t i;
+    float f;
+    std::string s;
+  };
+  std::string address;
+  std::vector<Arg> args;
+  std::vector<uint8_t> incoming; // from fill(), decoded on first use
+  bool error = false;
+
+  OSCMessage &addArg(char type, int32_t i, float f, const char *s = "") {
+    Arg arg = {type, i, f, s};
+    args.push_back(arg);
+    return *this;
+  }
+
+  static uint32_t readWord(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+  }
+  static void writeWord(std::vector<uint8_t> &out, uint32_t x) {
+    out.push_back(x >> 24);
+    out.push_back(x >> 16);
+    out.push_back(x >> 8);
+    out.push_back(x);
+  }
+  // null terminated, padded to 4 bytes
+  static bool readString(const std::vector<uint8_t> &in, size_t &i, std::string &s) {
+    size_t end = i;
+    while (end < in.size() && in[end]) end++;
+    if (end >= in.size()) return false;
+    s.assign((const char *)&in[i], end - i);
+    i = (end + 4) & ~3;
+    return i <= in.size();
+  }
+  static void writeString(std::vector<uint8_t> &out, const std::string &s) {
+    out.insert(out.end(), s.begin(), s.end());
+    do out.push_back(0); while (out.size() % 4);
+  }
+
+  void decode() {
+    if (incoming.empty()) return;
+    std::vector<uint8_t> in;
+    in.swap(incoming);
+    args.clear();
+    size_t i = 0;
+    std::string tags;
+    error = !readString(in, i, address) || !readString(in, i, tags) || tags.empty() || tags[0] != ',';
+    for (size_t t = 1; !error && t < tags.size(); t++) {
+      if (tags[t] == 's') {
+        std::string s;
+        if (!readString(in, i, s)) error = true;
+        else addArg('s', 0, 0, s.c_str());
+        continue;
+      }
+      if (i + 4 > in.size() || (tags[t] != 'i' && tags[t] != 'f')) {
+        error = true;
+        break;
+      }
+      uint32_t word = readWord(&in[i]);
+      i += 4;
+      float f;
+      memcpy(&f, &word, 4);
+      if (tags[t] == 'i') addArg('i', word, (int32_t)word);
+      else addArg('f', f, f);
+    }
+  }
+
+public:
+  OSCMessage(const char *address = "") : address(address) {}
+
+  OSCMessage &add(int x) { return addArg('i', x, x); }
+  OSCMessage &add(long x) { return addArg('i', x, x); }
+  OSCMessage &add(float x) { return addArg('f', x, x); }
+  OSCMessage &add(double x) { return addArg('f', x, x); }
+  OSCMessage &add(const char *x) { return addArg('s', 0, 0, x); }
+
+  int size() { decode(); return args.size(); }
+  bool isInt(int i) { decode(); return args[i].type == 'i'; }
+  int getInt(int i) { decode(); return args[i].type == 'i' ? args[i].i : (int)args[i].f; }
+  float getFloat(int i) { decode(); return args[i].type == 'f' ? args[i].f : args[i].i; }
+  const char *getString(int i) { decode(); return args[i].s.c_str(); }
+  int getAddressLength() { decode(); return address.size(); }
+  int getAddress(char *buffer) { decode(); strcpy(buffer, address.c_str()); return address.size(); }
+  const char *getAddress() { decode(); return address.c_str(); }
+
+  void fill(uint8_t *bytes, int n) { incoming.insert(incoming.end(), bytes, bytes + n); }
+  void fill(const std::string &bytes) { incoming.assign(bytes.begin(), bytes.end()); }
+  bool hasError() { decode(); return error; }
+  void empty() { args.clear(); incoming.clear(); error = false; }
+
+  std::vector<uint8_t> bytes() {
+    decode();
+    std::vector<uint8_t> out;
+    writeString(out, address);
+    std::string tags = ",";
+    for (const Arg &arg : args) tags += arg.type;
+    writeString(out, tags);
+    for (const Arg &arg : args) {
+      if (arg.type == 's') writeString(out, arg.s);
+      else if (arg.type == 'i') writeWord(out, arg.i);
+      else {
+        uint32_t word;
+        memcpy(&word, &arg.f, 4);
+        writeWord(out, word);
+      }
+    }
+    return out;
+  }
+  void send(Print &p) {
+    std::vector<uint8_t> out = bytes();
+    p.write(out.data(), out.size());
+  }
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Arduino.h>
+
+// the same algorithm as br3ttb's PID_v1 1.1.1, which the firmware uses, so the
+// sweep sees its sample time, integral clamp and derivative on measurement.
+// the library itself needs the real arduino core to build.
+
+#define AUTOMATIC 1
+#define MANUAL 0
+#define DIRECT 0
+#define REVERSE 1
+
+class PID {
+public:
+  PID(double *Input, double *Output, double *Setpoint, double Kp, double Ki, double Kd, int ControllerDirection)
+  : myInput(Input), myOutput(Output), mySetpoint(Setpoint), inAuto(false) {
+    SetOutputLimits(0, 255);
+    SampleTime = 100;
+    SetControllerDirection(ControllerDirection);
+    SetTunings(Kp, Ki, Kd);
+    lastTime = millis() - SampleTime;
+  }
+
+  bool Compute() {
+    if (!inAuto) return false;
+    unsigned long now = millis();
+    unsigned long timeChange = now - lastTime;
+    if (timeChange < (unsigned long)SampleTime) return false;
+
+    double input = *myInput;
+    double error = *mySetpoint - input;
+    ITerm += ki * error;
+    ITerm = clamp(ITerm);
+    double dInput = input - lastInput;
+
+    *myOutput = clamp(kp * error + ITerm - kd * dInput);
+
+    lastInput = input;
+    lastTime = now;
+    return true;
+  }
+
+  void SetTunings(double Kp, double Ki, double Kd) {
+    if (Kp < 0 || Ki < 0 || Kd < 0) return;
+    dispKp = Kp;
+    dispKi = Ki;
+    dispKd = Kd;
+
+    double SampleTimeInSec = SampleTime / 1000.0;
+    kp = Kp;
+    ki = Ki * SampleTimeInSec;
+    kd = Kd / SampleTimeInSec;
+    if (controllerDirection == REVERSE) {
+      kp = -kp;
+      ki = -ki;
+      kd = -kd;
+    }
+  }
+
+  void SetSampleTime(int NewSampleTime) {
+    if (NewSampleTime <= 0) return;
+    double ratio = (double)NewSampleTime / SampleTime;
+    ki *= ratio;
+    kd /= ratio;
+    SampleTime = NewSampleTime;
+  }
+
+  void SetOutputLimits(double Min, double Max) {
+    if (Min >= Max) return;
+    outMin = Min;
+    outMax = Max;
+    if (inAuto) {
+      *myOutput = clamp(*myOutput);
+      ITerm = clamp(ITerm);
+    }
+  }
+
+  void SetMode(int Mode) {
+    bool newAuto = Mode == AUTOMATIC;
+    if (newAuto && !inAuto) Initialize();
+    inAuto = newAuto;
+  }
+
+  void SetControllerDirection(int Direction) {
+    if (inAuto && Direction != controllerDirection) {
+      kp = -kp;
+      ki = -ki;
+      kd = -kd;
+    }
+    controllerDirection = Direction;
+  }
+
+  double GetKp() { return dispKp; }
+  double GetKi() { return dispKi; }
+  double GetKd() { return dispKd; }
+  int GetMode() { return inAuto ? AUTOMATIC : MANUAL; }
+  int GetDirection() { return controllerDirection; }
+
+private:
+  void Initialize() {
+    ITerm = clamp(*myOutput);
+    lastInput = *myInput;
+  }
+
+  double clamp(double x) { return x > outMax ? outMax : x < outMin ? outMin : x; }
+
+  double dispKp, dispKi, dispKd;
+  double kp, ki, kd;
+  int controllerDirection;
+  double *myInput, *myOutput, *mySetpoint;
+  unsigned long lastTime;
+  double ITerm, lastInput;
+  int SampleTime;
+  double outMin, outMax;
+  bool inAuto;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+// motor_driver.ino built for a desktop, driving a simulated winch. shared by
+// motor_sweep and motor_emulator, which are built with -I../host/mock so the
+// mock folder stands in for the arduino libraries. the sketch is compiled as
+// is, with its globals, so each simulated motor needs its own process.
+
+#include <Arduino.h>
+#include <PID_v1.h>
+#include <OSCMessage.h>
+#include <EthernetUdp.h>
+
+// the arduino ide would generate these
+void setup();
+void loop();
+void setupWatchdog();
+void setupEthernet();
+void setupPID();
+void pidSetMaxSpeed(float ms);
+bool setupEncoder();
+void setupMotorDriver(bool poweron);
+void setupEndstops();
+void setStepTarget(float cps);
+void setStepAccel(float cmps2);
+float stepSpeed();
+void stepSettle(float target);
+void stepNext();
+void motorEnable(bool power);
+long readEncoder();
+void writeEncoder(long pos);
+double encoderSteps();
+void rememberEncoder();
+void sendOscStatus(long stepper, long encoder);
+void timeLoop();
+void timeSection(unsigned long &worst, unsigned long start);
+void addLoopTiming(OSCMessage &msg);
+void checkOsc();
+void checkOscBundle(int s);
+bool isStaleTimetag(uint32_t address, unsigned int port, unsigned long seconds, unsigned long fraction);
+void dispatchOsc(OSCMessage &oscMsg);
+void oscGo(OSCMessage &m);
+void oscGo2(OSCMessage &m);
+void applyGo();
+void oscHome(OSCMessage &m);
+void oscSetMaxSpeed(OSCMessage &m);
+void oscSetMaxAccel(OSCMessage &m);
+void oscSetDeadZone(OSCMessage &m);
+void oscSetStatusInterval(OSCMessage &m);
+void oscSetServerAddress(OSCMessage &m);
+void oscStop(OSCMessage &m);
+void oscResume(OSCMessage &m);
+void oscSetMotorPower(OSCMessage &m);
+void oscFreeRun(OSCMessage &m);
+void oscSetTunings(OSCMessage &m);
+void oscAutotune(OSCMessage &m);
+void updateAutotune();
+void finishAutotune(bool ok);
+void oscPing(OSCMessage &m);
+void oscSetPosition(OSCMessage &m);
+void oscRememberPosition(OSCMessage &m);
+void oscCrash(OSCMessage &m);
+
+unsigned long simMicros = 0;
+uint8_t PIND, PORTB, PCMSK2, PCIFR, PCICR, TCCR1A, TCCR1B, TIMSK1;
+uint16_t OCR1A, TCNT1;
+UdpHost *udpHost = 0;
+
+#include "../motor_driver/motor_driver.ino"
+
+// the watchdog has nothing to watch
+Watchdog::CApplicationMonitor::CApplicationMonitor(int nBaseAddress, int nMaxEntries)
+: c_nBaseAddress(nBaseAddress), c_nMaxEntries(nMaxEntries) {}
+void Watchdog::CApplicationMonitor::Dump(OSCMessage &, bool) const {}
+void Watchdog::CApplicationMonitor::EnableWatchdog(ETimeout) {}
+void Watchdog::CApplicationMonitor::IAmAlive() const {}
+
+#include <algorithm>
+
+// PLANT ---------------------------
+// the encoder follows the stepper through the stretch in the cable, a lightly
+// damped spring. positions in encoder steps from the endstop, the server's
+// calibration is about 150 of them per cm.
+double ENCODER_STEPS_PER_CM = 150;
+double CABLE_HZ = 8; // resonance of the cable and eye
+double CABLE_DAMPING = 0.2;
+const double PLANT_STEP = 25; // usec
+
+double plantOffset = 0, plantPosition = 0, plantVelocity = 0;
+long plantCounts = 0; // encoder edges so far, the isr would have counted these
+
+// puts the cable at rest, position encoder steps out from the endstop
+void plantReset(double position) {
+  plantOffset = position - stepperpos * ENCODER_STEPS_PER_CM / STEPS_PER_CM;
+  plantPosition = position;
+  plantVelocity = 0;
+  plantCounts = lround(position * COUNTS_PER_STEP);
+}
+
+void plantUpdate(double seconds) {
+  // positive speeds count stepperpos down, and the encoder with it
+  double target = plantOffset + stepperpos * ENCODER_STEPS_PER_CM / STEPS_PER_CM;
+  double w = TWO_PI * CABLE_HZ;
+  plantVelocity += (w * w * (target - plantPosition) - 2 * CABLE_DAMPING * w * plantVelocity) * seconds;
+  plantPosition += plantVelocity * seconds;
+  // the firmware can move its zero, so only hand over the edges
+  long counts = lround(plantPosition * COUNTS_PER_STEP);
+  encoder0Pos += counts - plantCounts;
+  plantCounts = counts;
+}
+
+// the endstop closes when the cable is paid all the way out
+int digitalRead(int pin) {
+  return pin == EXTENSIONENDSTOPPIN && plantPosition <= 0;
+}
+
+// runs the plant and the step isr for a while
+double simTime = 0, nextStepIsr = 0; // usec
+void simulate(double usec) {
+  double end = simTime + usec;
+  while (simTime < end) {
+    double next = std::min(std::min(end, simTime + PLANT_STEP), nextStepIsr);
+    plantUpdate((next - simTime) * 1e-6);
+    simTime = next;
+    simMicros = simTime;
+    if (simTime >= nextStepIsr) {
+      TCNT1 = 20; // about what the isr takes
+      TIMER1_COMPA_vect();
+      nextStepIsr += (OCR1A + 1) / 2.0;
+    }
+  }
+}
+
+// boots the sketch with the cable at position, and homed there if homed
+void simulateSetup(double position, bool homed) {
+  setup();
+  plantReset(position);
+  writeEncoder(lround(position * COUNTS_PER_STEP));
+  if (homed) {
+    ::homed = true;
+    state = OK;
+    motorEnable(true);
+    pidSetpoint = pidInput = position;
+    // start the pid from here, not from 0
+    myPID.SetMode(MANUAL);
+    myPID.SetMode(AUTOMATIC);
+  }
+  nextStepIsr = simTime + (OCR1A + 1) / 2.0;
+}
@@ -0,0 +1,27 @@
+#ifndef OSC_ROUTE_H
+#define OSC_ROUTE_H
+
+#include <stdint.h>
+#include <OSCMessage.h>
+
+// kept out of the sketch so the ide's prototype generation leaves it alone
+
+// 32 bit FNV-1a, usable at compile time
+constexpr uint32_t oscHashFrom(const char *s, uint32_t h) {
+  return *s ? oscHashFrom(s + 1, (h ^ (uint8_t)*s) * 16777619UL) : h;
+}
+
+constexpr uint32_t oscHash(const char *s) {
+  return oscHashFrom(s, 2166136261UL);
+}
+
+// one entry in the firmware's address table
+struct OscRoute {
+  const char *address;
+  uint32_t hash;
+  void (*handler)(OSCMessage &);
+};
+
+#define OSC_ROUTE(address, handler) { address, oscHash(address), handler }
+
+#endif
@@ -4,11 +4,6 @@
 // modified from http://playground.arduino.cc/Main/RotaryEncoders#Example3
 // (changed position variable to signed long)
 
-// TimerOne library from pjrc
-// http://www.pjrc.com/teensy/td_libs_TimerOne.html
-#include <TimerOne.h>
-
-
 // PID_v1 library
 // https://github.com/br3ttb/Arduino-PID-Library/
 // http://playground.arduino.cc/Code/PIDLibrary
@@ -25,6 +20,9 @@
 // http://www.megunolink.com/how-to-detect-lockups-using-the-arduino-watchdog/
 #include "ApplicationMonitor.h"
 
+// address table with precomputed hashes
+#include "OscRoute.h"
+
 
 // Ethernet libraries
 #include <SPI.h>        
@@ -48,9 +46,9 @@ const int LOCALNET = 2; // 2 for osx internet sharing 192.168.2.*, 1 for NYCR ne
 double pidSetpoint, pidInput, pidOutput;
 const double consKp=0.08, consKi=0.012, consKd=0.00001;
 PID myPID(&pidInput, &pidOutput, &pidSetpoint, consKp, consKi, consKd, REVERSE); // DIRECT or REVERSE
-// Dead zone: stop motor if within +/- desired position in encoder steps
-int STILL_DEAD_ZONE = 15; // when desired velocity is 0, big dead zone
-int MOVING_DEAD_ZONE = 2; // when moving, smaller dead zone (so slow movements aren't jerky as they jump from one dead zone to the next)
+// Dead zone: stop motor if within +/- desired position in encoder steps (resolution is a quarter step)
+float STILL_DEAD_ZONE = 4; // when desired velocity is 0, big dead zone
+float MOVING_DEAD_ZONE = 0.5; // when moving, smaller dead zone (so slow movements aren't jerky as they jump from one dead zone to the next)
 
 
 // ENCODER SETUP ---------------------------
@@ -60,12 +58,18 @@ const int encoder0PinA = 2;  // white   PORTD BIT 2
 const byte encoder0PinAMask = 0x04;
 const int encoder0PinB = 3;  // black   PORTD BIT 3
 const byte encoder0PinBMask = 0x08;
+const int ENCODER_SHIFT = 2; // moves A and B down to bits 0 and 1
 //const int encoder0PinZ = 4;  // orange
+// encoder0Pos counts every edge on both channels, so 4 counts per encoder step.
+// positions in osc messages stay in encoder steps, so the server's calibration still holds.
+const int COUNTS_PER_STEP = 4;
 volatile long encoder0Pos __attribute__ ((section (".noinit")));
 volatile long encoder0Checksum __attribute__ ((section (".noinit")));
 const long encoder0ChecksumKey = 314159265L;
 volatile long encoder0Zero = 0;
 volatile long encoder0ZeroState = 0;
+volatile byte encoder0State = 0; // A and B at the last interrupt
+volatile unsigned int encoder0Errors = 0; // both channels changed at once, so an edge was missed
 
 // ENDSTOP SETUP ---------------------------
 const int EXTENSIONENDSTOPPIN = 6; // endstop for max extension, wired Normally Closed
@@ -100,16 +104,40 @@ const int BACKOFF_STEPS = 200; // how many encoder steps to reverse out of endst
 
 // MOTOR TIMING/POS
 volatile long stepperpos = 0;
-volatile int dir = 0;
-volatile unsigned long period;
 double currentSpeed = 0;
 
 
+// STEP GENERATOR ---------------------------
+// timer 1 interrupts when each step is due and works out when the next one is
+// from MAX_ACCEL, so ramps don't depend on how long loop() takes.
+// pulse is PORTB bit 1 (pin 9), direction PORTB bit 0 (pin 8)
+#define STEP_PORT PORTB
+const byte PULSEPINMASK = 0x02;
+const byte DIRPINMASK = 0x01;
+const float STEP_TIMER_HZ = 2000000.0; // 16MHz / 8, half microsecond ticks
+const unsigned int STEP_IDLE_TICKS = 2000; // while stopped, look for a new target every 1ms
+const float MIN_STEP_TICKS = 200; // 100us, the isr has to finish inside this, see timingStepIsrMax
+const float MIN_STEP_RATE = 1.0; // steps per second, anything slower is stopped
+
+// from the loop
+volatile float stepTargetInterval = 0; // timer ticks per step at goalSpeed, 0 to stop
+volatile byte stepTargetDir = 1;
+volatile float stepFirstInterval = 0, stepRampConstant = 0; // see setStepAccel()
+
+// the isr's own state
+volatile float stepInterval = 0; // timer ticks from this step to the next
+volatile float stepTickRemainder = 0; // fraction of a tick carried to the next step
+volatile unsigned long stepTicksLeft = 0; // of an interval too long for the 16 bit timer
+volatile long stepRampIndex = 0; // n in the ramp equations, steps from standstill at MAX_ACCEL
+volatile bool stepping = false;
+volatile byte stepDir = 1; // 0 for negative speeds
+
+
 
 // NETWORK SETUP  -------
 const int SS_SD_CARD = 4; // chip select for sd card reader on ethernet card (keep high to disable)
 
-// get motor id (0 for NW motor, 1 for NE, 2 for SE, 3 for SW) from EEPROM address 0
+// get motor id from EEPROM address 0 (0 to N-1, the server's config.xml says where each one is)
 int MOTOR_ID = EEPROM.read(EEPROM_MOTOR_ID);
 
 byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, MOTOR_ID };
@@ -124,6 +152,35 @@ int destinationPort = 12000;
 EthernetUDP UDP;
 
 int MSEC_PER_STATUS = 50; // millseconds between sending status messages
+long statusSequence = 0; // counts status messages so server can spot drops and reordering
+
+// timetag of the newest bundle applied, so a late one can't undo a newer setpoint,
+// and who sent it. only a server's own timetags are compared, from its own clock
+unsigned long lastTimetagSeconds = 0, lastTimetagFraction = 0;
+uint32_t lastTimetagAddress = 0;
+unsigned int lastTimetagPort = 0;
+bool staleSetpoints = false; // while dispatching a bundle older than that
+unsigned long bundleSeconds = 0, bundleFraction = 0; // timetag of the bundle being dispatched, 0 outside one
+unsigned long oscPacketMicros = 0; // when the packet being dispatched was read
+
+const int MAX_PACKETS_PER_LOOP = 16; // so a flood can't starve the PID or the watchdog
+
+// newest /go or /go2 from this loop's packets, applied once they've all been read
+bool goPending = false;
+double goSetpoint = 0;
+float goMaxSpeed = -1; // -1 for MAX_SPEED
+
+// LOOP TIMING ---------
+// worst cases since the last status message, sent along with it so the server
+// can see how much headroom the control loop has. times in microseconds
+unsigned long timingLoopStart = 0;
+unsigned long timingLoops = 0, timingLoopTotal = 0;
+unsigned long timingLoopMin = 0xFFFFFFFF, timingLoopMax = 0;
+unsigned long timingPidMax = 0, timingOscMax = 0, timingStatusMax = 0;
+unsigned long timingPackets = 0;
+volatile unsigned long timingStepIsrTicks = 0; // timer 1 ticks, half microseconds
+volatile unsigned int timingStepIsrMax = 0;
+volatile unsigned int timingEncoderEdges = 0;
 
 // WATCHDOG TIMER ---------
 Watchdog::CApplicationMonitor ApplicationMonitor;
@@ -135,6 +192,23 @@ float freeruncenter = 0;
 float freerunwidth = 0;
 
 
+// AUTOTUNE --------
+// relay feedback: drive at +/- autotuneSpeed around where the motor started,
+// switching whenever it's more than autotuneHysteresis past. the oscillation
+// that settles in gives the ultimate gain and period to pick PID gains from.
+const int AUTOTUNE_CYCLES = 6; // measured, after one to settle
+const float AUTOTUNE_MAX_EXCURSION = 400; // encoder steps from the start before giving up
+const unsigned long AUTOTUNE_TIMEOUT = 30000; // msec
+float autotuneSpeed = 2.0; // cm/sec
+float autotuneHysteresis = 1.0; // encoder steps
+double autotuneCenter = 0;
+float autotuneOutput = 0;
+unsigned long autotuneStart = 0, autotuneLastCycle = 0;
+int autotuneCycles = 0;
+double autotuneHigh = 0, autotuneLow = 0; // extremes of the current cycle
+double autotuneAmplitudes = 0, autotunePeriods = 0; // sums over the measured cycles
+
+
 // SYSTEM STATE
 enum stateEnum {
   NOTHOMED,         // don't know actual position
@@ -145,7 +219,8 @@ enum stateEnum {
   STOPPED,          // stopped by /stop command
   ENDSTOP,          // unexpectedly hit the end stop, need to home again
   FREERUNTEST,      // exercising the motor
-  MOTOROFF         // motor power off by /disable command
+  MOTOROFF,         // motor power off by /disable command
+  AUTOTUNE          // relay oscillation to find PID gains
 } state = MOTOROFF;
 
 
@@ -161,26 +236,28 @@ void setup() {
   setupPID();
   
   setupWatchdog();
+  timingLoopStart = micros();
 }
 
 
 
-unsigned long lastmicros = micros();
 unsigned long lastStatusMsgMillis = millis();
 long laststepperpos = 0, lastencoder0Pos = 0;
 double lastSetpoint = 0;
 
 void loop(){ 
+  timeLoop();
   
   // call off the watchdog
   ApplicationMonitor.IAmAlive();
   ApplicationMonitor.SetData(state);
+  rememberEncoder();
 
   
   
   if (state==OK) {
     // PID loop
-    pidInput = encoder0Pos;
+    pidInput = encoderSteps();
     // use big dead zone only if setpoint hasn't changed; ie desired speed is 0
     if (
          (lastSetpoint == pidSetpoint && abs(pidInput-pidSetpoint) < STILL_DEAD_ZONE)
@@ -190,7 +267,9 @@ void loop(){
       goalSpeed = 0;
     }
     else {
+      unsigned long t = micros();
       myPID.Compute();
+      timeSection(timingPidMax, t);
       goalSpeed = pidOutput;
     }
       
@@ -207,11 +286,11 @@ void loop(){
   
   else if (state==HOMINGBACKOFF) {
     goalSpeed = -homingSpeed;
-    go(goalSpeed);
+    setStepTarget(goalSpeed);
     
-    if (encoder0Pos > 0) {
+    if (readEncoder() > 0) {
       goalSpeed = 0;
-      pidSetpoint = encoder0Pos;
+      pidSetpoint = encoderSteps();
       state = OK;
       homed = true;
       reboots = 0;
@@ -225,6 +304,10 @@ void loop(){
     goalSpeed = pidOutput;
   }
   
+  else if (state==AUTOTUNE) {
+    updateAutotune();
+  }
+  
 
   // check end stop
   int endstop = digitalRead(EXTENSIONENDSTOPPIN);
@@ -234,7 +317,7 @@ void loop(){
   if (endstop) {
     if (state==HOMING) {
       state=HOMINGBACKOFF;
-      encoder0Pos = -BACKOFF_STEPS;
+      writeEncoder(-BACKOFF_STEPS * COUNTS_PER_STEP);
       manualSpeed = true;
     }
     else if (state==HOMINGBACKOFF) {
@@ -253,12 +336,10 @@ void loop(){
   
   
   if (!manualSpeed) {
-    // update speed from goalspeed taking acceleration limit into account
-    unsigned long dt = micros() - lastmicros;
-    lastmicros = micros();
-    
-    updateSpeed(dt);
+    // the step isr gets there taking acceleration limit into account
+    setStepTarget(goalSpeed);
   }
+  currentSpeed = stepSpeed();
   
   
 
@@ -266,7 +347,9 @@ void loop(){
   
   
   // check for incoming messages 
+  unsigned long t = micros();
   checkOsc();
+  timeSection(timingOscMax, t);
   
   
   // send updates 
@@ -277,10 +360,13 @@ void loop(){
     long stepper_steps_this_update = stepperpos - laststepperpos;
     laststepperpos = stepperpos;
     
-    long encoder_steps_this_update = encoder0Pos - lastencoder0Pos;
-    lastencoder0Pos = encoder0Pos;
+    long encoder0PosNow = readEncoder();
+    long encoder_steps_this_update = (encoder0PosNow - lastencoder0Pos) / COUNTS_PER_STEP;
+    lastencoder0Pos = encoder0PosNow;
     
+    t = micros();
     sendOscStatus(stepper_steps_this_update, encoder_steps_this_update);
+    timeSection(timingStatusMax, t); // reported with the next one
   }
   
   
@@ -332,9 +418,9 @@ bool setupEncoder() {
   
   if (EEPROM.read(EEPROM_REMEMBER_POSITION) == 1) {
     // check if encoder value can be recovered after crash
-    if (encoder0Pos ^ encoder0ChecksumKey == encoder0Checksum) {
+    if ((encoder0Pos ^ encoder0ChecksumKey) == encoder0Checksum) {
       // sanity check
-      if (encoder0Pos > 10 && encoder0Pos < 100000) {
+      if (encoder0Pos > 10 * COUNTS_PER_STEP && encoder0Pos < 100000L * COUNTS_PER_STEP) {
         // yes! let's claim we're homed
         reboots++;
         recovered = true;
@@ -342,30 +428,37 @@ bool setupEncoder() {
     }
   }
 
-  if (!recovered) encoder0Pos = -1;
+  if (!recovered) encoder0Pos = -COUNTS_PER_STEP;
   
   pinMode(encoder0PinA, INPUT); 
   pinMode(encoder0PinB, INPUT); 
   //pinMode(encoder0PinZ, INPUT);
-  // encoder pin on interrupt 0 (pin 2)
-  attachInterrupt(0, doEncoderA, RISING);
+  encoder0State = (ENCODER_PORT & (encoder0PinAMask | encoder0PinBMask)) >> ENCODER_SHIFT;
+  // pin change interrupt 2 covers port D, only pins 2 and 3 are enabled
+  PCMSK2 |= (1 << PCINT18) | (1 << PCINT19);
+  PCIFR |= (1 << PCIF2);
+  PCICR |= (1 << PCIE2);
   
   return recovered;
 }
 
 void setupMotorDriver(bool poweron) {
-  //pinMode(PULSEPIN, OUTPUT); pwm() will do this
+  pinMode(PULSEPIN, OUTPUT);
   pinMode(DIRPIN, OUTPUT);
   pinMode(ENAPIN, OUTPUT);
   
   digitalWrite(ENAPIN, poweron); // disable motor driver
   
-  // set up interrupts for motor speed control
-  Timer1.initialize(1000);
-  Timer1.pwm(PULSEPIN, 0);
-  Timer1.start();
-  
-  //Timer1.attachInterrupt(countSteps);
+  // set up interrupts for motor speed control: timer 1 counts half microsecond
+  // ticks up to OCR1A, then the step isr runs and sets OCR1A for the next step
+  setStepAccel(MAX_ACCEL);
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM12) | (1 << CS11); // ctc, clock / 8
+  OCR1A = STEP_IDLE_TICKS;
+  TCNT1 = 0;
+  TIMSK1 |= (1 << OCIE1A);
+  interrupts();
 }
 
 void setupEndstops() {
@@ -377,50 +470,153 @@ void setupEndstops() {
 
 // MOTOR HANDLERS ----------------------------------------
 
-// move actual speed towards goal speed
-// dt is time since last update in microseconds
-void updateSpeed(unsigned long dt) {
-  float requestedDS = goalSpeed - currentSpeed;
-  float maxDS = MAX_ACCEL * dt / 1000000.0;
-  if (requestedDS > maxDS) requestedDS = maxDS;
-  else if (requestedDS < -maxDS) requestedDS = -maxDS;
+// speed in cms per second (negative to go backwards), the step isr ramps to it
+void setStepTarget(float cps) {
+  float rate = cps < 0 ? -cps * STEPS_PER_CM : cps * STEPS_PER_CM;
+  float interval = 0;
+  if (rate >= MIN_STEP_RATE) {
+    interval = STEP_TIMER_HZ / rate;
+    if (interval < MIN_STEP_TICKS) interval = MIN_STEP_TICKS;
+  }
   
-  go(currentSpeed + requestedDS);  
+  noInterrupts();
+  stepTargetInterval = interval;
+  stepTargetDir = cps < 0 ? 0 : 1;
+  interrupts();
 }
 
-// speed in cms per second (negative to go backwards)
-// returns actual period
-unsigned long go(float cps) {
-  currentSpeed = cps;
-  if (cps==0) {
-    Timer1.pwm(PULSEPIN, 0);
-    period = 0;
-    return 0;
+// acceleration in cms per second^2. the first step from standstill takes
+// 0.676 * f * sqrt(2 / accel) ticks (Austin's correction for the first step),
+// and a speed of f / c is reached after f^2 / (2 * accel * c^2) steps
+void setStepAccel(float cmps2) {
+  float accel = cmps2 * STEPS_PER_CM;
+  float first = 0.676 * STEP_TIMER_HZ * sqrt(2.0 / accel);
+  float ramp = STEP_TIMER_HZ * STEP_TIMER_HZ / (2.0 * accel);
+  
+  noInterrupts();
+  stepFirstInterval = first;
+  stepRampConstant = ramp;
+  interrupts();
+}
+
+// actual speed of the step generator in cms per second
+float stepSpeed() {
+  noInterrupts();
+  bool moving = stepping;
+  float interval = stepInterval;
+  byte d = stepDir;
+  interrupts();
+  
+  if (!moving) return 0;
+  float cps = STEP_TIMER_HZ / interval / STEPS_PER_CM;
+  return d ? cps : -cps;
+}
+
+// jump to the target interval, with the ramp index that speed would have
+void stepSettle(float target) {
+  stepInterval = target;
+  stepRampIndex = stepRampConstant / (target * target);
+}
+
+// one step per interrupt, and the interval to the next from Austin's
+// "Generate stepper-motor speed profiles in real time" (Atmel AVR446):
+// accelerating c_n = c_n-1 - 2 c_n-1 / (4n + 1), decelerating the same with -n.
+// that's one division per step. runs from the isr below with interrupts on.
+void stepNext() {
+  if (stepTicksLeft) {
+    // a slow step that's already waited longer than a ramp's first step can
+    // go now, if the loop wants to go faster the same way
+    bool faster = stepTargetDir == stepDir && stepTargetInterval > 0 && stepTargetInterval < stepInterval;
+    if (faster && stepInterval - stepTicksLeft >= stepFirstInterval) {
+      stepTicksLeft = 0;
+      stepTickRemainder = 0;
+    }
+    else {
+      // every piece of a long interval is at least 32768 ticks, never too short to finish
+      unsigned int piece = stepTicksLeft > 65535 ? 32768 : stepTicksLeft;
+      stepTicksLeft -= piece;
+      OCR1A = piece - 1;
+      return;
+    }
+  }
+  
+  if (stepping) {
+    STEP_PORT |= PULSEPINMASK;
+    if (stepDir) stepperpos--;
+    else stepperpos++;
+  }
+  
+  float target = stepTargetInterval;
+  if (stepTargetDir != stepDir) target = 0; // come to a stop before turning around
+  
+  if (!stepping) {
+    if (stepTargetInterval > 0) {
+      stepDir = stepTargetDir;
+      if (stepDir) STEP_PORT |= DIRPINMASK;
+      else STEP_PORT &= ~DIRPINMASK;
+      stepping = true;
+      stepRampIndex = 0;
+      stepInterval = stepFirstInterval;
+      if (stepTargetInterval > stepFirstInterval) stepSettle(stepTargetInterval);
+    }
+  }
+  else if (target == 0 || stepInterval < target) {
+    // slow down, or stop once back at the first step
+    if (stepRampIndex <= 0) {
+      stepping = false;
+    }
+    else {
+      stepInterval += 2 * stepInterval / (4 * stepRampIndex - 1);
+      stepRampIndex--;
+      if (target > 0 && stepInterval > target) stepSettle(target);
+    }
+  }
+  else if (stepInterval > target) {
+    if (stepInterval > stepFirstInterval) {
+      // slower than a ramp starts, the recurrence would take many slow steps to catch up
+      stepRampIndex = 0;
+      stepInterval = stepFirstInterval;
+    }
+    else {
+      stepRampIndex++;
+      stepInterval -= 2 * stepInterval / (4 * stepRampIndex + 1);
+    }
+    if (stepInterval < target) stepSettle(target);
   }
-  if (cps < 0) {
-    cps = -cps;
-    dir = 0;
-  } else {
-    dir = 1;
-  }    
   
-  digitalWrite(DIRPIN, dir);
+  unsigned long ticks = STEP_IDLE_TICKS;
+  if (stepping) {
+    // whole ticks only, so carry the rest over and the steps average out exact
+    float exact = stepInterval + stepTickRemainder;
+    ticks = exact;
+    stepTickRemainder = exact - ticks;
+    if (ticks > 65535) {
+      stepTicksLeft = ticks - 32768;
+      ticks = 32768;
+    }
+  }
+  else {
+    stepTickRemainder = 0;
+  }
+  OCR1A = ticks - 1; // ctc counts 0 to OCR1A
   
-  period = 1000000.0 / cps / STEPS_PER_CM;
-  // try to get duty period to be about 50 us
-  unsigned long duty = (1024.0 * 50.0) / period;
-  if (duty < 1) duty = 1;
-  else if (duty > 511) duty = 511;
+  STEP_PORT &= ~PULSEPINMASK;
   
-  Timer1.pwm(PULSEPIN, duty, period);
-  return period;
+  // the count restarted at the compare match, so this is the isr's time including its latency
+  unsigned int spent = TCNT1;
+  timingStepIsrTicks += spent;
+  if (spent > timingStepIsrMax) timingStepIsrMax = spent;
 }
 
-void countSteps() {
-  if (!period) return;
-  
-  if (dir) stepperpos--;
-  else stepperpos++;
+// the encoder and ethernet interrupts can come in while the step math runs,
+// but not this one again, or a slow pass would nest and mangle the ramp state.
+// a step that falls due meanwhile waits until it's done.
+ISR(TIMER1_COMPA_vect) {
+  TIMSK1 &= ~(1 << OCIE1A);
+  interrupts();
+  stepNext();
+  noInterrupts();
+  TIMSK1 |= (1 << OCIE1A);
 }
 
 
@@ -434,22 +630,53 @@ void motorEnable(bool power) {
 // ENCODER HANDLERS -----------------------------
 
 
-// triggered on rising encoder A
-void doEncoderA() {
-  /* via Trammell:
-      For the quadrature, you can also just trigger on the rising edge of one
-    line. When it goes high, you then sample the other line as soon as possible.
-    If it is already high, then you are going clockwise.  If it is still low,
-    then you're going anti-clockwise.
-  */
-  if (ENCODER_PORT & encoder0PinBMask) {
-    encoder0Pos --;
-  }
-  else {
-    encoder0Pos ++;
-  }
-  
+// indexed by the previous and current BA bits: +1 or -1 for one edge either way,
+// 0 for no change, 2 for both channels changing at once (an edge was missed).
+// forward is A rising while B is low, same as the old rising edge decoder.
+const int8_t QUADRATURE_TABLE[16] = {
+   0, +1, -1,  2,
+  -1,  0,  2, +1,
+  +1,  2,  0, -1,
+   2, -1, +1,  0
+};
+
+// triggered on any change of encoder A or B. no loops and one branch, so every
+// edge costs the same handful of cycles
+ISR(PCINT2_vect) {
+  byte ab = (ENCODER_PORT & (encoder0PinAMask | encoder0PinBMask)) >> ENCODER_SHIFT;
+  int8_t delta = QUADRATURE_TABLE[(encoder0State << 2) | ab];
+  encoder0State = ab;
+  if (delta == 2) encoder0Errors++;
+  else encoder0Pos += delta;
+  timingEncoderEdges++;
+}
+
+// encoder0Pos is 4 bytes, so it can't be read or written while the isr might change it
+long readEncoder() {
+  noInterrupts();
+  long pos = encoder0Pos;
+  interrupts();
+  return pos;
+}
+
+void writeEncoder(long pos) {
+  noInterrupts();
+  encoder0Pos = pos;
+  interrupts();
+}
+
+// position in encoder steps, to a quarter step
+double encoderSteps() {
+  return readEncoder() / (double)COUNTS_PER_STEP;
+}
+
+// the checksum lets setupEncoder() trust encoder0Pos after a crash. it's kept
+// once per loop instead of in the isr, so if the encoder moved after the last
+// loop the position doesn't match and isn't trusted.
+void rememberEncoder() {
+  noInterrupts();
   encoder0Checksum = encoder0Pos ^ encoder0ChecksumKey;
+  interrupts();
 }
 
 
@@ -494,17 +721,26 @@ void sendOscStatus(long stepper, long encoder) {
       msg.add("FREERUNTEST");
       break;
       
+    case AUTOTUNE:
+      msg.add("AUTOTUNE");
+      break;
+      
     default:  
        msg.add("UNKNOWN");
        break;
   }
   
-  msg.add((float)encoder0Pos); 
+  unsigned long now = micros(); // when the position was read, for the server's clock sync
+  msg.add((float)encoderSteps()); 
   msg.add(currentSpeed);
   msg.add(stepper);
   msg.add(encoder);
   int seconds_since_reboot = millis() / 1000;
   msg.add(reboots ? seconds_since_reboot : 0);
+  msg.add(statusSequence++);
+  msg.add((int)encoder0Errors);
+  addLoopTiming(msg);
+  msg.add((long)now);
   
   UDP.beginPacket(destinationIP, destinationPort);
   msg.send(UDP);
@@ -513,62 +749,216 @@ void sendOscStatus(long stepper, long encoder) {
 }
 
 
+// LOOP TIMING ---------------------------
+
+// at the top of every loop
+void timeLoop() {
+  unsigned long now = micros();
+  unsigned long dt = now - timingLoopStart;
+  timingLoopStart = now;
+  
+  timingLoops++;
+  timingLoopTotal += dt;
+  if (dt < timingLoopMin) timingLoopMin = dt;
+  if (dt > timingLoopMax) timingLoopMax = dt;
+}
+
+void timeSection(unsigned long &worst, unsigned long start) {
+  unsigned long dt = micros() - start;
+  if (dt > worst) worst = dt;
+}
+
+// appends the timing since the last status message and starts over
+void addLoopTiming(OSCMessage &msg) {
+  noInterrupts();
+  unsigned long isrTicks = timingStepIsrTicks;
+  unsigned int isrMax = timingStepIsrMax;
+  unsigned int edges = timingEncoderEdges;
+  timingStepIsrTicks = 0;
+  timingStepIsrMax = 0;
+  timingEncoderEdges = 0;
+  interrupts();
+  
+  msg.add((long)timingLoops);
+  msg.add((long)(timingLoops ? timingLoopMin : 0));
+  msg.add((long)(timingLoops ? timingLoopTotal / timingLoops : 0));
+  msg.add((long)timingLoopMax);
+  msg.add((long)timingPidMax);
+  msg.add((long)timingOscMax);
+  msg.add((long)timingStatusMax);
+  msg.add((long)(isrMax / 2));
+  msg.add((long)(isrTicks / 2));
+  msg.add((long)edges);
+  msg.add((long)timingPackets);
+  
+  timingLoops = 0;
+  timingLoopTotal = 0;
+  timingLoopMin = 0xFFFFFFFF;
+  timingLoopMax = 0;
+  timingPidMax = 0;
+  timingOscMax = 0;
+  timingStatusMax = 0;
+  timingPackets = 0;
+}
+
+
+// reads everything that's waiting, instead of one packet per loop, so the PID
+// never works from a setpoint that's already been replaced
 void checkOsc() {
-  OSCMessage oscMsg;
   int s;
-   
-  //receive a bundle
-  if ((s = UDP.parsePacket())>0) {
-    while (s--) {
-      oscMsg.fill(UDP.read());
+  
+  for (int packets = 0; packets < MAX_PACKETS_PER_LOOP && (s = UDP.parsePacket()) > 0; packets++) {
+    oscPacketMicros = micros();
+    timingPackets++;
+    // the server sends everything from one control tick as a bundle
+    if (UDP.peek() == '#') {
+      checkOscBundle(s);
+      continue;
+    }
+    
+    OSCMessage oscMsg;
+    byte chunk[32]; // reading a chunk at a time saves an spi transaction per byte
+    while (s > 0) {
+      int n = UDP.read(chunk, s < (int)sizeof(chunk) ? s : sizeof(chunk));
+      if (n <= 0) break;
+      oscMsg.fill(chunk, n);
+      s -= n;
     }
     
     if (!oscMsg.hasError()) {
-      oscMsg.dispatch("/go", oscGo); 
-      oscMsg.dispatch("/go2", oscGo2);
-      oscMsg.dispatch("/home", oscHome);
-      oscMsg.dispatch("/maxspeed", oscSetMaxSpeed); 
-      oscMsg.dispatch("/maxaccel", oscSetMaxAccel);
-      oscMsg.dispatch("/deadzone", oscSetDeadZone);
-      
-      oscMsg.dispatch("/stop", oscStop);
-      oscMsg.dispatch("/resume", oscResume);
-      
-      oscMsg.dispatch("/statusinterval", oscSetStatusInterval);
-      //oscMsg.dispatch("/serveraddress", oscSetServerAddress);
-      
-      oscMsg.dispatch("/motor", oscSetMotorPower);
-      
-      //oscMsg.dispatch("/freeruntest", oscFreeRun);
-      
-      oscMsg.dispatch("/crashtest", oscCrash);
-      
-      oscMsg.dispatch("/setposition", oscSetPosition);
-      oscMsg.dispatch("/rememberposition", oscRememberPosition);      
+      dispatchOsc(oscMsg);
     }
     else {
-      // bad bundle!
+      // bad message!
+    }
+  }
+  
+  applyGo();
+}
+
+void checkOscBundle(int s) {
+  OSCBundle bundle;
+  unsigned long seconds = 0, fraction = 0;
+  byte chunk[32];
+  for (int i = 0; i < s; ) {
+    int n = UDP.read(chunk, s - i < (int)sizeof(chunk) ? s - i : sizeof(chunk));
+    if (n <= 0) break;
+    // "#bundle" then the timetag, big endian seconds and fraction
+    for (int j = 0; j < n; j++, i++) {
+      if (i >= 8 && i < 12) seconds = (seconds << 8) | chunk[j];
+      else if (i >= 12 && i < 16) fraction = (fraction << 8) | chunk[j];
     }
+    bundle.fill(chunk, n);
   }
+  
+  if (bundle.hasError()) {
+    // bad bundle!
+    return;
+  }
+  
+  // all of it is applied in this loop, so every motor moves to the same tick's setpoints together.
+  // a late bundle still delivers its commands, but not its setpoints.
+  staleSetpoints = isStaleTimetag(UDP.remoteIP(), UDP.remotePort(), seconds, fraction);
+  bundleSeconds = seconds;
+  bundleFraction = fraction;
+  for (int i = 0; i < bundle.size(); i++) {
+    dispatchOsc(*bundle.getOSCMessage(i));
+  }
+  staleSetpoints = false;
+  bundleSeconds = bundleFraction = 0;
+}
+
+bool isStaleTimetag(uint32_t address, unsigned int port, unsigned long seconds, unsigned long fraction) {
+  // 0.000...1 means immediately, which has no order
+  if (seconds == 0 && fraction <= 1) return false;
+  
+  // a standby taking over stamps its ticks from another clock, which can be
+  // behind the primary's, so a new sender starts the order over
+  if (address != lastTimetagAddress || port != lastTimetagPort) {
+    lastTimetagAddress = address;
+    lastTimetagPort = port;
+    lastTimetagSeconds = seconds;
+    lastTimetagFraction = fraction;
+    return false;
+  }
+  
+  bool older = seconds < lastTimetagSeconds || (seconds == lastTimetagSeconds && fraction < lastTimetagFraction);
+  // a big jump back means the server restarted or its clock was set, so start over
+  if (older && lastTimetagSeconds - seconds < 10) return true;
+  
+  lastTimetagSeconds = seconds;
+  lastTimetagFraction = fraction;
+  return false;
 }
 
+// OSC ADDRESS TABLE
+// each address is hashed once at compile time, so dispatching is one hash of
+// the incoming address, an integer compare per entry and a single strcmp,
+// instead of pattern matching against every address in turn.
+// the server never sends wildcards, so exact matches are enough.
+// most frequent first
+const OscRoute oscRoutes[] = {
+  OSC_ROUTE("/go", oscGo),
+  OSC_ROUTE("/go2", oscGo2),
+  OSC_ROUTE("/maxspeed", oscSetMaxSpeed),
+  OSC_ROUTE("/ping", oscPing),
+  OSC_ROUTE("/statusinterval", oscSetStatusInterval),
+  OSC_ROUTE("/stop", oscStop),
+  OSC_ROUTE("/resume", oscResume),
+  OSC_ROUTE("/motor", oscSetMotorPower),
+  OSC_ROUTE("/home", oscHome),
+  OSC_ROUTE("/maxaccel", oscSetMaxAccel),
+  OSC_ROUTE("/deadzone", oscSetDeadZone),
+  //OSC_ROUTE("/serveraddress", oscSetServerAddress),
+  //OSC_ROUTE("/freeruntest", oscFreeRun),
+  OSC_ROUTE("/crashtest", oscCrash),
+  OSC_ROUTE("/setposition", oscSetPosition),
+  OSC_ROUTE("/rememberposition", oscRememberPosition),
+  OSC_ROUTE("/pid", oscSetTunings),
+  OSC_ROUTE("/autotune", oscAutotune),
+};
+
+void dispatchOsc(OSCMessage &oscMsg) {
+  char address[24];
+  if (oscMsg.getAddressLength() >= (int)sizeof(address)) return; // nothing that long is ours
+  oscMsg.getAddress(address);
+  
+  uint32_t hash = oscHash(address);
+  for (byte i = 0; i < sizeof(oscRoutes) / sizeof(oscRoutes[0]); i++) {
+    if (oscRoutes[i].hash == hash && strcmp(oscRoutes[i].address, address) == 0) {
+      oscRoutes[i].handler(oscMsg);
+      return;
+    }
+  }
+}
+
+// only the newest setpoint of a loop matters, so /go and /go2 just keep it for applyGo()
 void oscGo(OSCMessage &m) {
-  // /go/motor0pos,motor1pos,motor2pos,motor3pos long ints
-  if (state != OK || m.size() < 4) return; 
+  // /go/motor0pos,motor1pos,... one float per motor, as many motors as the rig has
+  if (staleSetpoints || state != OK || m.size() <= MOTOR_ID) return; 
   
-  double value = m.getFloat(MOTOR_ID);
-  pidSetpoint = value;
-  pidSetMaxSpeed(MAX_SPEED);
+  goSetpoint = m.getFloat(MOTOR_ID);
+  goMaxSpeed = -1;
+  goPending = true;
 }
 
 
 void oscGo2(OSCMessage &m) {
-  if (state != OK || m.size() < 8) return;
+  if (staleSetpoints || state != OK || m.size() < MOTOR_ID*2+2) return;
   
-  double pos = m.getFloat(MOTOR_ID*2);
-  double spd = m.getFloat(MOTOR_ID*2+1);
-  pidSetpoint = pos;
-  pidSetMaxSpeed(spd);
+  goSetpoint = m.getFloat(MOTOR_ID*2);
+  goMaxSpeed = m.getFloat(MOTOR_ID*2+1);
+  goPending = true;
+}
+
+void applyGo() {
+  if (!goPending) return;
+  goPending = false;
+  // a /stop or /motor 0 read after the /go wins
+  if (state != OK) return;
+  
+  pidSetpoint = goSetpoint;
+  pidSetMaxSpeed(goMaxSpeed >= 0 ? goMaxSpeed : MAX_SPEED);
 }
 
 
@@ -594,14 +984,16 @@ void oscSetMaxSpeed(OSCMessage &m) {
 void oscSetMaxAccel(OSCMessage &m) {
   if (m.size()==1 || (m.size()==2 && m.getInt(0)==MOTOR_ID)) {
     MAX_ACCEL = m.getFloat(m.size()-1);
+    setStepAccel(MAX_ACCEL);
   }
 }
 
 // /deadzone [motorID] stillDeadZone movingDeadZone
 void oscSetDeadZone(OSCMessage &m) {
   if (m.size()==2 || (m.size()==3 && m.getInt(0)==MOTOR_ID)) {
-    STILL_DEAD_ZONE = m.getInt(m.size()-2);
-    MOVING_DEAD_ZONE = m.getInt(m.size()-1);
+    // ints from older servers, floats for fractions of a step
+    STILL_DEAD_ZONE = m.isInt(m.size()-2) ? m.getInt(m.size()-2) : m.getFloat(m.size()-2);
+    MOVING_DEAD_ZONE = m.isInt(m.size()-1) ? m.getInt(m.size()-1) : m.getFloat(m.size()-1);
   }
 }
 
@@ -628,7 +1020,7 @@ void oscSetServerAddress(OSCMessage &m) {
 // STOP: 
 void oscStop(OSCMessage &m) {
   if (m.size()==0 || (m.size()==1 && m.getInt(0)==MOTOR_ID)) {
-    if (state==OK || state==FREERUNTEST) state = STOPPED;
+    if (state==OK || state==FREERUNTEST || state==AUTOTUNE) state = STOPPED;
     else if (state==HOMING || state==HOMINGBACKOFF) state = NOTHOMED;
   }
   goalSpeed = 0;
@@ -671,10 +1063,136 @@ void oscFreeRun(OSCMessage &m) {
 }
 
 
+// PID GAINS: from /autotune or the sweep tool
+void oscSetTunings(OSCMessage &m) {
+  if (m.size()==3 || (m.size()==4 && m.getInt(0)==MOTOR_ID)) {
+    int i = m.size()-3;
+    myPID.SetTunings(m.getFloat(i), m.getFloat(i+1), m.getFloat(i+2));
+  }
+}
+
+
+// AUTOTUNE (one motor at a time only!): motorID [speed] [hysteresis]
+void oscAutotune(OSCMessage &m) {
+  if (m.size() < 1 || m.getInt(0) != MOTOR_ID || state != OK) return;
+  if (m.size() > 1) autotuneSpeed = m.getFloat(1);
+  if (m.size() > 2) autotuneHysteresis = m.getFloat(2);
+  
+  autotuneCenter = encoderSteps();
+  autotuneOutput = -autotuneSpeed;
+  autotuneStart = millis();
+  autotuneLastCycle = 0;
+  autotuneCycles = 0;
+  autotuneHigh = autotuneLow = autotuneCenter;
+  autotuneAmplitudes = autotunePeriods = 0;
+  state = AUTOTUNE;
+}
+
+void updateAutotune() {
+  double position = encoderSteps();
+  double error = position - autotuneCenter;
+  
+  if (abs(error) > AUTOTUNE_MAX_EXCURSION || millis() - autotuneStart > AUTOTUNE_TIMEOUT) {
+    finishAutotune(false);
+    return;
+  }
+  
+  if (position > autotuneHigh) autotuneHigh = position;
+  if (position < autotuneLow) autotuneLow = position;
+  
+  // the pid is REVERSE: negative speeds raise the count
+  if (autotuneOutput < 0 && error > autotuneHysteresis) {
+    autotuneOutput = autotuneSpeed;
+  }
+  else if (autotuneOutput > 0 && error < -autotuneHysteresis) {
+    autotuneOutput = -autotuneSpeed;
+    
+    // a cycle ends each time it heads back up
+    unsigned long now = millis();
+    if (autotuneLastCycle) {
+      autotuneCycles++;
+      if (autotuneCycles > 1) {
+        autotunePeriods += now - autotuneLastCycle;
+        autotuneAmplitudes += (autotuneHigh - autotuneLow) / 2;
+      }
+    }
+    autotuneLastCycle = now;
+    autotuneHigh = autotuneLow = position;
+    
+    if (autotuneCycles > AUTOTUNE_CYCLES) {
+      finishAutotune(true);
+      return;
+    }
+  }
+  
+  goalSpeed = autotuneOutput;
+}
+
+// sets the new gains if it worked, and tells the server either way
+void finishAutotune(bool ok) {
+  float amplitude = autotuneAmplitudes / AUTOTUNE_CYCLES; // encoder steps
+  float period = autotunePeriods / AUTOTUNE_CYCLES / 1000.0; // seconds
+  if (amplitude <= autotuneHysteresis) ok = false;
+  
+  goalSpeed = 0;
+  pidSetpoint = autotuneCenter;
+  state = ok ? OK : STOPPED;
+  
+  OSCMessage msg("/autotune");
+  msg.add(MOTOR_ID);
+  if (ok) {
+    // describing function of a relay with hysteresis
+    float ku = 4 * autotuneSpeed / (PI * sqrt(amplitude * amplitude - autotuneHysteresis * autotuneHysteresis));
+    // the motor turns speed into position, so the plant already integrates and
+    // ziegler-nichols style integral overshoots badly. mostly proportional, with
+    // just enough integral to pull out an offset, and no derivative of the
+    // quarter step encoder. in the sweep tool this beats the hand tuning.
+    float kp = ku / 1.6;
+    float ki = kp / (50 * period);
+    float kd = 0;
+    myPID.SetTunings(kp, ki, kd);
+    
+    msg.add("OK");
+    msg.add(kp);
+    msg.add(ki);
+    msg.add(kd);
+    msg.add(ku);
+    msg.add(period);
+  }
+  else {
+    msg.add("FAILED");
+  }
+  
+  UDP.beginPacket(destinationIP, destinationPort);
+  msg.send(UDP);
+  UDP.endPacket();
+  msg.empty();
+}
+
+
+// CLOCK SYNC: the server puts /ping in a tick bundle. the reply echoes the
+// bundle's timetag, with when the packet was read and when the reply went out
+// by micros(), so the server can map this clock onto its own.
+void oscPing(OSCMessage &m) {
+  if (bundleSeconds == 0) return; // not in a bundle, or immediate, so nothing to echo
+  
+  OSCMessage msg("/pong");
+  msg.add(MOTOR_ID);
+  msg.add((long)bundleSeconds);
+  msg.add((long)bundleFraction);
+  msg.add((long)oscPacketMicros);
+  UDP.beginPacket(destinationIP, destinationPort);
+  msg.add((long)micros());
+  msg.send(UDP);
+  UDP.endPacket();
+  msg.empty();
+}
+
+
 // force calibration (one motor at a time only!)
 void oscSetPosition(OSCMessage &m) {
   if (m.size()==2 && m.getInt(0) == MOTOR_ID) {
-    encoder0Pos = (long)m.getFloat(1);
+    writeEncoder((long)(m.getFloat(1) * COUNTS_PER_STEP));
     homed = true;
     if (state==NOTHOMED) state=OK;
   }
@@ -0,0 +1,175 @@
+// runs motor_driver.ino for several motors on this machine, each against a
+// simulated winch, talking osc over udp like the real controllers. point the
+// server at it by setting motors/osc/host to 127.0.0.1 in its config.xml.
+//
+// build: g++ -O2 -std=c++11 -I../host/mock motor_emulator.cpp -o motor_emulator
+// run:   ./motor_emulator [-motors 0,1,2,3] [-port 12001] [-server 127.0.0.1] [-serverport 12000,...]
+//                         [-position steps] [-nothomed] [-drift ppm] [-micros start]
+//
+// with -nothomed every motor waits for /home like after a power cut, which is
+// how to try the server's homing sequence.
+//
+// the server's packets arrive here once and are passed on to every motor, each
+// running in its own process. -drift runs motor n's micros() fast by ppm * (n + 1)
+// so clock sync has something to find, and -micros starts every motor's clock
+// there, 4290000000 wraps the 32 bits sent on the wire within a few seconds.
+//
+// every reply goes to each -serverport, which stands in for the broadcast the
+// real controllers send on one machine: -serverport 12000,12002 feeds both the
+// server and a hot standby listening on motors/standby/receivePort.
+
+#include "../host/sketch.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+
+// usec since the emulator started, on the host's clock
+double elapsedMicros() {
+  static timespec start = {0, 0};
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!start.tv_sec && !start.tv_nsec) start = now;
+  return (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) * 1e-3;
+}
+
+// one motor's end: packets from the parent, each after the address and port it
+// came from, and replies straight to the servers
+struct EmulatorUdp : UdpHost {
+  int fromParent, toServer;
+  std::vector<sockaddr_in> servers;
+
+  bool receive(std::string &packet) {
+    char buffer[2048];
+    ssize_t n = recv(fromParent, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n <= 6) return false;
+    memcpy(&remoteAddress, buffer, 4);
+    memcpy(&remotePort, buffer + 4, 2);
+    remotePort = ntohs(remotePort);
+    packet.assign(buffer + 6, n - 6);
+    return true;
+  }
+  void send(const std::string &packet) {
+    for (const sockaddr_in &server : servers) {
+      sendto(toServer, packet.data(), packet.size(), 0, (sockaddr *)&server, sizeof(server));
+    }
+  }
+} emulatorUdp;
+
+void runMotor(int id, double position, bool homed, double drift, double startMicros) {
+  MOTOR_ID = id;
+  udpHost = &emulatorUdp;
+  simTime = startMicros;
+  simulateSetup(position, homed);
+  printf("motor %d: %s at %g encoder steps, micros() %+gppm from %.0f\n",
+    id, homed ? "homed" : "not homed", position, drift, startMicros);
+  fflush(stdout);
+
+  pid_t parent = getppid();
+  while (getppid() == parent) {
+    double now = startMicros + elapsedMicros() * (1 + drift * 1e-6);
+    if (now > simTime) simulate(now - simTime);
+    loop();
+    usleep(200);
+  }
+}
+
+std::vector<int> parseList(const char *s) {
+  std::vector<int> list;
+  char *end;
+  for (;;) {
+    list.push_back(strtol(s, &end, 10));
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return list;
+}
+
+int main(int argc, char **argv) {
+  std::vector<int> ids = {0, 1, 2, 3};
+  std::vector<int> serverPorts = {12000};
+  int port = 12001;
+  const char *serverHost = "127.0.0.1";
+  double position = 14000, drift = 0, startMicros = 0;
+  bool homed = true;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (strcmp(arg, "-nothomed") == 0) { homed = false; continue; }
+    i++;
+    if (strcmp(arg, "-motors") == 0) ids = parseList(value);
+    else if (strcmp(arg, "-port") == 0) port = atoi(value);
+    else if (strcmp(arg, "-server") == 0) serverHost = value;
+    else if (strcmp(arg, "-serverport") == 0) serverPorts = parseList(value);
+    else if (strcmp(arg, "-position") == 0) position = atof(value);
+    else if (strcmp(arg, "-drift") == 0) drift = atof(value);
+    else if (strcmp(arg, "-micros") == 0) startMicros = atof(value);
+    else {
+      fprintf(stderr, "unknown option %s, see the top of motor_emulator.cpp\n", arg);
+      return 1;
+    }
+  }
+
+  int listener = socket(AF_INET, SOCK_DGRAM, 0);
+  int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port = htons(port);
+  if (bind(listener, (sockaddr *)&local, sizeof(local)) != 0) {
+    perror("can't listen");
+    return 1;
+  }
+
+  for (int serverPort : serverPorts) {
+    sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(serverPort);
+    if (inet_pton(AF_INET, serverHost, &server.sin_addr) != 1) {
+      fprintf(stderr, "bad server address %s\n", serverHost);
+      return 1;
+    }
+    emulatorUdp.servers.push_back(server);
+  }
+
+  elapsedMicros(); // every motor's clock starts now
+  std::vector<int> toMotors;
+  for (int id : ids) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0) {
+      perror("socketpair");
+      return 1;
+    }
+    if (fork() == 0) {
+      close(listener);
+      close(fds[0]);
+      emulatorUdp.fromParent = fds[1];
+      emulatorUdp.toServer = socket(AF_INET, SOCK_DGRAM, 0);
+      runMotor(id, position, homed, drift * (id + 1), startMicros);
+      _exit(0);
+    }
+    close(fds[1]);
+    toMotors.push_back(fds[0]);
+  }
+
+  // the same broadcast reaches every controller on the real network. the
+  // firmware orders ticks per sender, so a primary and a standby on this
+  // machine have to stay apart
+  char buffer[2048];
+  for (;;) {
+    sockaddr_in from = {};
+    socklen_t fromSize = sizeof(from);
+    ssize_t n = recvfrom(listener, buffer + 6, sizeof(buffer) - 6, 0, (sockaddr *)&from, &fromSize);
+    if (n <= 0) continue;
+    memcpy(buffer, &from.sin_addr.s_addr, 4);
+    memcpy(buffer + 4, &from.sin_port, 2);
+    for (int fd : toMotors) send(fd, buffer, n + 6, MSG_DONTWAIT);
+  }
+}
@@ -0,0 +1,356 @@
+// runs motor_driver.ino's control loop on a desktop against a simulated cable,
+// for every combination of PID gains, dead zones and acceleration in a grid,
+// and ranks them by tracking error, settling time and overshoot.
+//
+// build: g++ -O2 -std=c++11 -I../host/mock motor_sweep.cpp -o motor_sweep
+// run:   ./motor_sweep [-j jobs] [-top n] [-sort score|rms|settle|overshoot|hold|hunting]
+//                      [-csv file] [-autotune] [-seed n] [-cablehz hz] [-damping ratio]
+//                      [-kp a,b,...] [-ki ...] [-kd ...] [-still ...] [-moving ...] [-accel ...]
+//
+// the firmware and the simulated cable are in ../host/sketch.h. each setting
+// runs in its own forked copy of the sketch, so they all start from the same
+// state and run in parallel.
+
+#include "../host/sketch.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// LOOP TIMING ---------------------------
+// mostly the usual few hundred usec, longer when a status message goes out,
+// and the occasional stall in the ethernet chip
+uint32_t rng = 1;
+uint32_t random32() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+double loopDuration(bool sentStatus) {
+  double usec = 350 + random32() % 100;
+  if (sentStatus) usec += 1500;
+  if (random32() % 1000 < 5) usec += 6000;
+  return usec;
+}
+
+// nothing arrives, and only the /autotune reply matters of what goes out
+struct SweepUdp : UdpHost {
+  bool receive(std::string &) { return false; }
+  void send(const std::string &packet) {
+    OSCMessage msg;
+    msg.fill(packet);
+    if (!msg.hasError() && strcmp(msg.getAddress(), "/autotune") == 0) {
+      autotuneReply = msg;
+      autotuneReplied = true;
+    }
+  }
+  OSCMessage autotuneReply;
+  bool autotuneReplied = false;
+} sweepUdp;
+
+// one loop() and the time it takes
+void step() {
+  long sequence = statusSequence;
+  loop();
+  simulate(loopDuration(statusSequence != sequence));
+}
+
+// SETPOINTS ---------------------------
+// the server sends a /go every frame. a slow move, a hold, a small correction,
+// a fast move back and a hold
+const double GO_HZ = 60;
+const double START = 1000; // encoder steps
+const double SETTLE_BAND = 2; // encoder steps, or the still dead zone if that's bigger
+
+struct Segment {
+  double start, end; // seconds
+  double from, to; // encoder steps
+};
+const Segment profile[] = {
+  {0.0, 0.5, START, START},
+  {0.5, 2.5, START, START + 1200},
+  {2.5, 4.0, START + 1200, START + 1200},
+  {4.0, 5.5, START + 1140, START + 1140},
+  {5.5, 6.5, START + 1140, START},
+  {6.5, 8.0, START, START},
+};
+const int SEGMENTS = sizeof(profile) / sizeof(profile[0]);
+
+// minimum jerk, how the server eases between positions
+double setpointAt(const Segment &s, double t) {
+  if (s.from == s.to) return s.to;
+  double x = (t - s.start) / (s.end - s.start);
+  return s.from + (s.to - s.from) * x * x * x * (10 - 15 * x + 6 * x * x);
+}
+
+// SETTINGS ---------------------------
+struct Setting {
+  double kp, ki, kd;
+  double still, moving, accel;
+  const char *label;
+};
+
+// the firmware keeps the dead zones and acceleration as floats
+bool isSame(const Setting &a, const Setting &b) {
+  return (float)a.kp == (float)b.kp && (float)a.ki == (float)b.ki && (float)a.kd == (float)b.kd &&
+    (float)a.still == (float)b.still && (float)a.moving == (float)b.moving && (float)a.accel == (float)b.accel;
+}
+
+struct Result {
+  int index;
+  double rms; // tracking error while moving, encoder steps
+  double settle; // worst time to stay settled after stopping, seconds
+  double overshoot; // furthest past the target after stopping, encoder steps
+  double hold; // mean error once settled, encoder steps
+  int hunting; // reversals while holding
+  double score;
+};
+
+// lower is better, each weight is what counts as one point
+double score(const Result &r) {
+  return r.rms / 4 + r.settle / 0.25 + r.overshoot / 4 + r.hold / 2 + r.hunting / 10.0;
+}
+
+void apply(const Setting &s) {
+  myPID.SetTunings(s.kp, s.ki, s.kd);
+  STILL_DEAD_ZONE = s.still;
+  MOVING_DEAD_ZONE = s.moving;
+  MAX_ACCEL = s.accel;
+  setStepAccel(MAX_ACCEL);
+}
+
+Result run(const Setting &s, uint32_t seed) {
+  apply(s);
+  rng = seed;
+  double band = std::max(SETTLE_BAND, s.still);
+
+  Result r = {};
+  double squares = 0, holdTotal = 0;
+  int moving = 0, holding = 0;
+  double t0 = simTime * 1e-6, nextGo = 0;
+  long lastStepper = stepperpos;
+  int lastDir = 0;
+
+  for (int i = 0; i < SEGMENTS; i++) {
+    const Segment &seg = profile[i];
+    bool hold = seg.from == seg.to;
+    double lastOutside = seg.start;
+
+    double t;
+    while ((t = simTime * 1e-6 - t0) < seg.end) {
+      if (t >= nextGo) {
+        OSCMessage go("/go");
+        go.add((float)setpointAt(seg, t));
+        oscGo(go);
+        nextGo += 1 / GO_HZ;
+      }
+      step();
+
+      t = simTime * 1e-6 - t0;
+      double error = encoderSteps() - setpointAt(seg, std::min(t, seg.end));
+      if (!hold) {
+        squares += error * error;
+        moving++;
+        continue;
+      }
+
+      if (abs(error) > band) lastOutside = t;
+      if (i > 0) {
+        // past the target, the way it came from
+        double from = profile[i - 1].from == profile[i - 1].to ? profile[i - 1].to : profile[i - 1].from;
+        r.overshoot = std::max(r.overshoot, seg.to > from ? error : -error);
+      }
+      if (t > seg.end - 0.5) {
+        holdTotal += abs(error);
+        holding++;
+      }
+
+      long moved = stepperpos - lastStepper;
+      lastStepper = stepperpos;
+      int dir = moved > 0 ? 1 : moved < 0 ? -1 : 0;
+      if (dir && lastDir && dir != lastDir) r.hunting++;
+      if (dir) lastDir = dir;
+    }
+    if (hold && i > 0) r.settle = std::max(r.settle, lastOutside - seg.start);
+  }
+
+  r.rms = moving ? sqrt(squares / moving) : 0;
+  r.hold = holding ? holdTotal / holding : 0;
+  r.score = score(r);
+  return r;
+}
+
+// relay autotune on the simulated plant, like /autotune on the rig
+bool autotune(Setting &s) {
+  OSCMessage m("/autotune");
+  m.add(MOTOR_ID);
+  oscAutotune(m);
+  while (state == AUTOTUNE) step();
+  OSCMessage &reply = sweepUdp.autotuneReply;
+  if (!sweepUdp.autotuneReplied || strcmp(reply.getString(1), "OK") != 0) return false;
+  s.kp = reply.getFloat(2);
+  s.ki = reply.getFloat(3);
+  s.kd = reply.getFloat(4);
+  fprintf(stderr, "autotune: ku %g, period %gs -> kp %g ki %g kd %g\n",
+    reply.getFloat(5), reply.getFloat(6), s.kp, s.ki, s.kd);
+  return true;
+}
+
+// MAIN ---------------------------
+std::vector<double> parseList(const char *s) {
+  std::vector<double> list;
+  char *end;
+  for (;;) {
+    list.push_back(strtod(s, &end));
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return list;
+}
+
+double sortKey(const Result &r, const char *key) {
+  if (strcmp(key, "rms") == 0) return r.rms;
+  if (strcmp(key, "settle") == 0) return r.settle;
+  if (strcmp(key, "overshoot") == 0) return r.overshoot;
+  if (strcmp(key, "hold") == 0) return r.hold;
+  if (strcmp(key, "hunting") == 0) return r.hunting;
+  return r.score;
+}
+
+int main(int argc, char **argv) {
+  std::vector<double> kps = {0.02, 0.04, 0.08, 0.12, 0.16, 0.24, 0.32};
+  std::vector<double> kis = {0, 0.006, 0.012, 0.024, 0.048};
+  std::vector<double> kds = {0, 0.00001, 0.001, 0.004};
+  std::vector<double> stills = {1, 2, 4, 8};
+  std::vector<double> movings = {0.25, 0.5, 1};
+  std::vector<double> accels = {500, 1000};
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int top = 20;
+  const char *sort = "score";
+  const char *csv = 0;
+  bool tune = false;
+  uint32_t seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (strcmp(arg, "-autotune") == 0) { tune = true; continue; }
+    i++;
+    if (strcmp(arg, "-j") == 0) jobs = atoi(value);
+    else if (strcmp(arg, "-top") == 0) top = atoi(value);
+    else if (strcmp(arg, "-sort") == 0) sort = value;
+    else if (strcmp(arg, "-csv") == 0) csv = value;
+    else if (strcmp(arg, "-seed") == 0) seed = strtoul(value, 0, 10) | 1;
+    else if (strcmp(arg, "-cablehz") == 0) CABLE_HZ = atof(value);
+    else if (strcmp(arg, "-damping") == 0) CABLE_DAMPING = atof(value);
+    else if (strcmp(arg, "-kp") == 0) kps = parseList(value);
+    else if (strcmp(arg, "-ki") == 0) kis = parseList(value);
+    else if (strcmp(arg, "-kd") == 0) kds = parseList(value);
+    else if (strcmp(arg, "-still") == 0) stills = parseList(value);
+    else if (strcmp(arg, "-moving") == 0) movings = parseList(value);
+    else if (strcmp(arg, "-accel") == 0) accels = parseList(value);
+    else {
+      fprintf(stderr, "unknown option %s, see the top of motor_sweep.cpp\n", arg);
+      return 1;
+    }
+  }
+  if (jobs < 1) jobs = 1;
+
+  // homed and holding at START, every child forks from here
+  udpHost = &sweepUdp;
+  simulateSetup(START, true);
+
+  // what's in the firmware now, to compare against
+  std::vector<Setting> settings;
+  settings.push_back({consKp, consKi, consKd, STILL_DEAD_ZONE, MOVING_DEAD_ZONE, MAX_ACCEL, "firmware"});
+
+  if (tune) {
+    int fds[2];
+    if (pipe(fds) != 0) return 1;
+    Setting tuned = settings[0];
+    tuned.label = "autotune";
+    if (fork() == 0) {
+      bool ok = autotune(tuned);
+      if (ok) write(fds[1], &tuned, sizeof(tuned));
+      _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    if (read(fds[0], &tuned, sizeof(tuned)) == sizeof(tuned)) settings.push_back(tuned);
+    else fprintf(stderr, "autotune: failed\n");
+    close(fds[0]);
+    wait(0);
+  }
+
+  // the grid usually includes the firmware's setting, which is already there with its label
+  size_t labeled = settings.size();
+  for (double kp : kps)
+    for (double ki : kis)
+      for (double kd : kds)
+        for (double still : stills)
+          for (double moving : movings)
+            for (double accel : accels) {
+              Setting s = {kp, ki, kd, still, moving, accel, ""};
+              bool duplicate = false;
+              for (size_t i = 0; i < labeled; i++) duplicate = duplicate || isSame(s, settings[i]);
+              if (!duplicate) settings.push_back(s);
+            }
+
+  // every child writes one Result, which is small enough for the pipe to keep whole
+  int fds[2];
+  if (pipe(fds) != 0) return 1;
+  std::vector<Result> results;
+  size_t started = 0;
+  int running = 0;
+  while (results.size() < settings.size()) {
+    while (running < jobs && started < settings.size()) {
+      if (fork() == 0) {
+        close(fds[0]);
+        Result r = run(settings[started], seed);
+        r.index = started;
+        write(fds[1], &r, sizeof(r));
+        _exit(0);
+      }
+      started++;
+      running++;
+    }
+    Result r;
+    if (read(fds[0], &r, sizeof(r)) != sizeof(r)) break;
+    wait(0);
+    running--;
+    results.push_back(r);
+    if (results.size() % 500 == 0) fprintf(stderr, "%d / %d\n", (int)results.size(), (int)settings.size());
+  }
+
+  std::stable_sort(results.begin(), results.end(), [&](const Result &a, const Result &b) {
+    return sortKey(a, sort) < sortKey(b, sort);
+  });
+
+  printf("rank  score    rms  settle  overshoot   hold  hunting      kp      ki       kd  still  moving  accel\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    const Setting &s = settings[r.index];
+    if ((int)i >= top && !*s.label) continue;
+    printf("%4d %6.2f %6.2f %6.2fs %8.2f %7.2f %8d %7.3f %7.4f %8.5f %6.2f %7.2f %6.0f  %s\n",
+      (int)i + 1, r.score, r.rms, r.settle, r.overshoot, r.hold, r.hunting,
+      s.kp, s.ki, s.kd, s.still, s.moving, s.accel, s.label);
+  }
+
+  if (csv) {
+    FILE *f = fopen(csv, "w");
+    if (!f) {
+      fprintf(stderr, "can't write %s\n", csv);
+      return 1;
+    }
+    fprintf(f, "score,rms,settle,overshoot,hold,hunting,kp,ki,kd,still,moving,accel,label\n");
+    for (const Result &r : results) {
+      const Setting &s = settings[r.index];
+      fprintf(f, "%g,%g,%g,%g,%g,%d,%g,%g,%g,%g,%g,%g,%s\n",
+        r.score, r.rms, r.settle, r.overshoot, r.hold, r.hunting,
+        s.kp, s.ki, s.kd, s.still, s.moving, s.accel, s.label);
+    }
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,146 @@
+// measures motor_driver.ino's osc receive path on a desktop: how many reads
+// from the ethernet chip a control tick's bundle takes, how long loop() takes
+// with one waiting, and how many loops a burst of queued ticks takes until the
+// pid has the newest setpoint.
+//
+// build: g++ -O2 -std=c++11 -I../host/mock osc_bench.cpp -o osc_bench
+// run:   ./osc_bench [-loops n] [-motors n] [-burst n]
+//
+// the reads are what matters on the controller, each is an spi transaction
+// with the W5100. the times are host cpu, only good for comparing two builds
+// of the sketch on the same machine.
+
+#include "../host/sketch.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <deque>
+
+// whatever is queued arrives one packet per parsePacket(), replies go nowhere
+struct BenchUdp : UdpHost {
+  std::deque<std::string> incoming;
+  bool receive(std::string &packet) {
+    if (incoming.empty()) return false;
+    packet = incoming.front();
+    incoming.pop_front();
+    return true;
+  }
+  void send(const std::string &) {}
+} benchUdp;
+
+// PACKETS ---------------------------
+void writeWord(std::string &out, uint32_t x) {
+  for (int i = 3; i >= 0; i--) out.push_back((char)(x >> (i * 8)));
+}
+
+std::string encode(OSCMessage &msg) {
+  std::vector<uint8_t> bytes = msg.bytes();
+  return std::string(bytes.begin(), bytes.end());
+}
+
+// each bundle a millisecond after the last, the way the server timetags its ticks
+uint32_t timetagSeconds = 3900000000u, timetagFraction = 0;
+std::string bundle(const std::vector<std::string> &messages) {
+  std::string out("#bundle", 8);
+  timetagFraction += 4294967;
+  if (timetagFraction < 4294967) timetagSeconds++;
+  writeWord(out, timetagSeconds);
+  writeWord(out, timetagFraction);
+  for (const std::string &m : messages) {
+    writeWord(out, m.size());
+    out += m;
+  }
+  return out;
+}
+
+int motors = 8;
+std::string go(float position) {
+  OSCMessage msg("/go");
+  for (int i = 0; i < motors; i++) msg.add(position);
+  return encode(msg);
+}
+
+std::string statusInterval() {
+  OSCMessage msg("/statusinterval");
+  msg.add(50);
+  return encode(msg);
+}
+
+// second to last in the table
+std::string deadZone() {
+  OSCMessage msg("/deadzone");
+  msg.add(STILL_DEAD_ZONE);
+  msg.add(MOVING_DEAD_ZONE);
+  return encode(msg);
+}
+
+// TIMING ---------------------------
+double hostMicros() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double loopMicros = 0;
+void step() {
+  double start = hostMicros();
+  loop();
+  loopMicros += hostMicros() - start;
+  simulate(1000);
+}
+
+// host usec per loop with this packet waiting before each one, and reads per packet
+void measure(const char *label, std::string (*packet)(), int loops) {
+  unsigned long reads = benchUdp.reads;
+  loopMicros = 0;
+  for (int i = 0; i < loops; i++) {
+    benchUdp.incoming.push_back(packet());
+    step();
+  }
+  printf("%-28s %7.3f us per loop, %.1f reads per packet\n", label, loopMicros / loops,
+    (benchUdp.reads - reads) / (double)loops);
+}
+
+float nextPosition = 1000;
+std::string tick() { return bundle({go(nextPosition += 0.01), statusInterval()}); }
+std::string bareGo() { return go(nextPosition += 0.01); }
+
+int main(int argc, char **argv) {
+  int loops = 200000, burst = 6;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-loops") == 0) loops = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-motors") == 0) motors = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-burst") == 0) burst = atoi(argv[i + 1]);
+    else {
+      fprintf(stderr, "unknown option %s, see the top of osc_bench.cpp\n", argv[i]);
+      return 1;
+    }
+  }
+
+  udpHost = &benchUdp;
+  simulateSetup(nextPosition, true);
+
+  printf("%d byte tick bundle, /go for %d motors and a /statusinterval\n", (int)tick().size(), motors);
+  // nothing queued
+  loopMicros = 0;
+  for (int i = 0; i < loops; i++) step();
+  printf("%-28s %7.3f us per loop\n", "nothing waiting", loopMicros / loops);
+  measure("a tick bundle", tick, loops);
+  measure("a bare /go", bareGo, loops);
+  measure("a bare /deadzone", deadZone, loops);
+
+  // a network stall delivers several ticks at once
+  int worst = 0;
+  for (int r = 0; r < 1000; r++) {
+    for (int i = 0; i < burst; i++) benchUdp.incoming.push_back(tick());
+    int n = 0;
+    while (pidSetpoint != nextPosition && n < 100) {
+      step();
+      n++;
+    }
+    while (!benchUdp.incoming.empty()) step();
+    worst = std::max(worst, n);
+  }
+  char label[32];
+  snprintf(label, sizeof(label), "a burst of %d ticks", burst);
+  printf("%-28s %d loops until the newest setpoint is applied\n", label, worst);
+  return 0;
+}
@@ -0,0 +1,132 @@
+// runs motor_driver.ino's step generator on a desktop against a goal speed
+// profile, with loop() taking a light or a heavy random time between speed
+// updates, and measures the acceleration between the steps it puts out. then
+// checks that steady speeds come out at exactly the requested step rate.
+//
+// build: g++ -O2 -std=c++11 -I../host/mock step_ramp.cpp -o step_ramp
+// run:   ./step_ramp [-seeds n]
+//
+// exits 1 if the peak acceleration is more than 10% over MAX_ACCEL, or a
+// steady rate is off by more than 0.1%.
+
+#include "../host/sketch.h"
+
+#include <stdio.h>
+#include <vector>
+
+// a step and which way, times in usec
+struct Step {
+  double time;
+  int dir;
+};
+
+// runs the step isr up to time, noting each step it puts out
+void runSteps(double time, std::vector<Step> &steps) {
+  while (simTime < time) {
+    long before = stepperpos;
+    simulate(std::min(time, nextStepIsr) - simTime);
+    if (stepperpos != before) steps.push_back({simTime, stepperpos < before ? 1 : -1});
+  }
+}
+
+// goal speed in cm/s, seconds from the start
+float goal(double t) {
+  if (t < 0.1) return 0;
+  if (t < 0.5) return 30;
+  if (t < 0.9) return -30;
+  if (t < 1.2) return 5;
+  return 0;
+}
+
+uint32_t rng = 1;
+double random01() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng / 4294967296.0;
+}
+
+struct Stats {
+  double peak, rms; // cm/s^2
+  int steps;
+};
+
+// light: a loop every 0.5ms. heavy: mostly that, with bundles, status
+// messages and the occasional 8ms stall in between
+Stats run(bool heavy, uint32_t seed) {
+  rng = seed;
+  std::vector<Step> steps;
+  double start = simTime;
+  while (simTime - start < 1.5e6) {
+    setStepTarget(goal((simTime - start) * 1e-6));
+    double r = random01(), loopUs = 500;
+    if (heavy) loopUs = r < 0.6 ? 500 : r < 0.95 ? 2000 : 8000;
+    runSteps(simTime + loopUs, steps);
+  }
+  // speed between consecutive steps, acceleration between consecutive speeds,
+  // leaving out stops and turns
+  Stats s = {0, 0, (int)steps.size()};
+  double squares = 0;
+  int n = 0;
+  for (size_t i = 2; i < steps.size(); i++) {
+    double d1 = steps[i].time - steps[i - 1].time, d0 = steps[i - 1].time - steps[i - 2].time;
+    if (d0 > 20000 || d1 > 20000 || steps[i].dir != steps[i - 1].dir || steps[i - 1].dir != steps[i - 2].dir) continue;
+    double v1 = 1e6 / d1 / STEPS_PER_CM, v0 = 1e6 / d0 / STEPS_PER_CM;
+    double a = fabs(v1 - v0) / ((d1 + d0) / 2e6);
+    s.peak = std::max(s.peak, a);
+    squares += a * a;
+    n++;
+  }
+  s.rms = n ? sqrt(squares / n) : 0;
+  return s;
+}
+
+// steps per second over 10s once the ramp is done
+double steadyRate(float cps) {
+  std::vector<Step> steps;
+  setStepTarget(cps);
+  runSteps(simTime + 2e6, steps);
+  steps.clear();
+  runSteps(simTime + 10e6, steps);
+  setStepTarget(0);
+  std::vector<Step> stopping;
+  runSteps(simTime + 2e6, stopping);
+  if (steps.size() < 2) return 0;
+  return (steps.size() - 1) / ((steps.back().time - steps.front().time) * 1e-6);
+}
+
+int main(int argc, char **argv) {
+  int seeds = 5;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-seeds") == 0) seeds = atoi(argv[i + 1]);
+    else {
+      fprintf(stderr, "unknown option %s, see the top of step_ramp.cpp\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // the generator doesn't care where the cable is
+  simulateSetup(1000, true);
+  bool ok = true;
+
+  printf("goal 0 -> 30 -> -30 -> 5 -> 0 cm/s, MAX_ACCEL %.0f cm/s^2, %d seeds\n", MAX_ACCEL, seeds);
+  for (int heavy = 0; heavy < 2; heavy++) {
+    double peak = 0, rms = 0;
+    int steps = 0;
+    for (int seed = 1; seed <= seeds; seed++) {
+      Stats s = run(heavy, seed);
+      peak = std::max(peak, s.peak);
+      rms += s.rms / seeds;
+      steps = s.steps;
+    }
+    printf("%-6s loop: peak accel %5.0f cm/s^2, rms %5.0f cm/s^2, %d steps\n", heavy ? "heavy" : "light", peak, rms, steps);
+    if (peak > MAX_ACCEL * 1.1) ok = false;
+  }
+
+  for (float cps : {0.05f, -0.5f, 3.0f}) {
+    double rate = steadyRate(cps), expected = fabs(cps) * STEPS_PER_CM;
+    printf("%5.2f cm/s: %.3f steps/s, expected %.3f\n", cps, rate, expected);
+    if (fabs(rate - expected) > expected * 0.001) ok = false;
+  }
+  return ok ? 0 : 1;
+}